@@ -6,20 +6,37 @@
 #include "addr2line.h"
 
 #include <cstdint>
+#include <algorithm>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/commandlineflags.h"
 #include "base/logging.h"
 #include "symbol_map.h"
+#include "symbolization_index.h"
 #include "third_party/abseil/absl/container/node_hash_map.h"
 #include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/strings/string_view.h"
 #include "llvm/DebugInfo/DWARF/DWARFContext.h"
 #include "llvm/DebugInfo/DWARF/DWARFDebugAranges.h"
 #include "llvm/Object/ObjectFile.h"
+#include "util/symbolize/elf_reader.h"
 
 ABSL_RETIRED_FLAG(bool, use_legacy_symbolizer, false,
                   "whether to use google3 symbolizer");
+ABSL_FLAG(int64_t, addr2line_cache_size, 65536,
+          "Maximum number of address ranges whose inline stacks are cached "
+          "by the symbolizer, evicting the least recently used ones. 0 caches "
+          "all of them without bound, a negative value disables the cache.");
+ABSL_FLAG(std::string, symbolization_index_dir, "",
+          "Directory of the symbolization indexes, named after the build id "
+          "of their binary. If set, a binary is symbolized from its index "
+          "instead of its DWARF, and create_llvm_prof writes a missing index "
+          "for the next runs.");
 
 namespace {
 // This maps from a string naming a section to a pair containing a
@@ -39,6 +56,61 @@ llvm::object::OwningBinary<llvm::object::ObjectFile> GetOwningBinary(
   }
   return std::move(object_owning_binary_or_err.get());
 }
+
+// Adds the low and high pc of every range of DIE, if it is a subroutine, and
+// of the subroutines inlined into it to BOUNDARIES. These are the only
+// addresses where the inlined chain returned by getInlinedChainForAddress can
+// change. Inlined subroutines are only found directly in subroutines or in
+// lexical blocks, so all other DIEs (parameters, variables, labels...) are
+// skipped.
+void CollectInlinedRangeBoundaries(const llvm::DWARFDie &die,
+                                   std::vector<uint64_t> *boundaries) {
+  if (die.isSubroutineDIE()) {
+    auto ranges = die.getAddressRanges();
+    if (ranges) {
+      for (const llvm::DWARFAddressRange &range : *ranges) {
+        boundaries->push_back(range.LowPC);
+        boundaries->push_back(range.HighPC);
+      }
+    } else {
+      llvm::consumeError(ranges.takeError());
+    }
+  }
+  for (const llvm::DWARFDie &child : die.children()) {
+    if (child.getTag() == llvm::dwarf::DW_TAG_inlined_subroutine ||
+        child.getTag() == llvm::dwarf::DW_TAG_lexical_block)
+      CollectInlinedRangeBoundaries(child, boundaries);
+  }
+}
+
+// Returns true if [LOW_PC, HIGH_PC) overlaps one of SAMPLED_FUNCTIONS, a map
+// from the start address of functions to their size.
+bool OverlapsSampledFunction(
+    uint64_t low_pc, uint64_t high_pc,
+    const std::map<uint64_t, uint64_t> &sampled_functions) {
+  auto next = sampled_functions.lower_bound(low_pc);
+  if (next != sampled_functions.end() && next->first < high_pc) return true;
+  if (next == sampled_functions.begin()) return false;
+  auto prev = std::prev(next);
+  return low_pc < prev->first + prev->second;
+}
+
+// Returns the path of the index of BINARY_NAME in --symbolization_index_dir,
+// and stores its build id in BUILD_ID. Returns an empty string if the flag is
+// not set or the binary has no build id.
+std::string GetSymbolizationIndexPath(const std::string &binary_name,
+                                      std::string *build_id) {
+  const std::string index_dir = absl::GetFlag(FLAGS_symbolization_index_dir);
+  if (index_dir.empty()) return "";
+  *build_id = devtools_crosstool_autofdo::ElfReader(binary_name).GetBuildId();
+  std::string index_path =
+      devtools_crosstool_autofdo::IndexedAddr2line::IndexPath(index_dir,
+                                                              *build_id);
+  if (index_path.empty())
+    LOG(WARNING) << "'" << binary_name << "' has no build id, it cannot "
+                 << "be symbolized from an index.";
+  return index_path;
+}
 }  // namespace
 
 namespace devtools_crosstool_autofdo {
@@ -50,38 +122,181 @@ Addr2line *Addr2line::Create(const std::string &binary_name) {
 Addr2line *Addr2line::CreateWithSampledFunctions(
     const std::string &binary_name,
     const std::map<uint64_t, uint64_t> *sampled_functions) {
-  Addr2line *addr2line = new LLVMAddr2line(binary_name);
+  std::string build_id;
+  const std::string index_path =
+      GetSymbolizationIndexPath(binary_name, &build_id);
+  if (!index_path.empty()) {
+    Addr2line *indexed =
+        new IndexedAddr2line(binary_name, index_path, build_id);
+    if (indexed->Prepare()) return indexed;
+    delete indexed;
+  }
+
+  LLVMAddr2line *addr2line = new LLVMAddr2line(binary_name, sampled_functions);
   if (!addr2line->Prepare()) {
     delete addr2line;
     return nullptr;
-  } else {
-    return addr2line;
+  }
+  const int64_t cache_size = absl::GetFlag(FLAGS_addr2line_cache_size);
+  if (cache_size < 0) return addr2line;
+  return new CachingAddr2line(std::unique_ptr<Addr2line>(addr2line),
+                              cache_size);
+}
+
+void WriteSymbolizationIndex(const std::string &binary_name) {
+  std::string build_id;
+  const std::string index_path =
+      GetSymbolizationIndexPath(binary_name, &build_id);
+  if (index_path.empty()) return;
+  if (IndexedAddr2line(binary_name, index_path, build_id).Prepare()) return;
+
+  // The index has to cover the whole binary, not only the sampled functions.
+  LLVMAddr2line addr2line(binary_name);
+  if (!addr2line.Prepare()) return;
+  if (IndexedAddr2line::WriteIndex(addr2line, addr2line.GetCodeRanges(),
+                                   build_id, index_path))
+    LOG(INFO) << "Wrote symbolization index '" << index_path << "'.";
+}
+
+CachingAddr2line::CachingAddr2line(std::unique_ptr<Addr2line> addr2line,
+                                   size_t max_entries)
+    : Addr2line(addr2line->binary_name()),
+      addr2line_(std::move(addr2line)),
+      max_entries_(max_entries) {}
+
+CachingAddr2line::~CachingAddr2line() {
+  const uint64_t lookups = stats_.hits + stats_.misses;
+  if (lookups == 0) return;
+  LOG(INFO) << "Symbolization cache for '" << binary_name_
+            << "': " << stats_.hits << " hits, " << stats_.misses
+            << " misses (" << 100.0 * stats_.hits / lookups
+            << "% hit rate), " << stats_.evictions << " evictions.";
+}
+
+bool CachingAddr2line::Prepare() { return addr2line_->Prepare(); }
+
+void CachingAddr2line::GetInlineStack(uint64_t addr, SourceStack *stack) const {
+  auto next = index_.upper_bound(addr);
+  if (next != index_.begin()) {
+    EntryList::iterator entry = std::prev(next)->second;
+    if (addr < entry->end_addr) {
+      ++stats_.hits;
+      if (max_entries_ > 0) entries_.splice(entries_.begin(), entries_, entry);
+      stack->insert(stack->end(), entry->stack.begin(), entry->stack.end());
+      return;
+    }
+  }
+
+  ++stats_.misses;
+  Entry entry;
+  // Addresses without a known range, e.g. those without debug info, are not
+  // cached, as each of them would need an entry of its own.
+  if (!addr2line_->GetInlineStackRange(addr, &entry.start_addr,
+                                       &entry.end_addr)) {
+    addr2line_->GetInlineStack(addr, stack);
+    return;
+  }
+  addr2line_->GetInlineStack(addr, &entry.stack);
+  // Keep the cached ranges disjoint, so that a lookup only has to check the
+  // range starting right before the address.
+  if (next != index_.end())
+    entry.end_addr = std::min(entry.end_addr, next->first);
+  if (next != index_.begin())
+    entry.start_addr =
+        std::max(entry.start_addr, std::prev(next)->second->end_addr);
+  stack->insert(stack->end(), entry.stack.begin(), entry.stack.end());
+
+  entries_.push_front(std::move(entry));
+  index_.emplace_hint(next, entries_.front().start_addr, entries_.begin());
+  if (max_entries_ > 0 && entries_.size() > max_entries_) {
+    ++stats_.evictions;
+    index_.erase(entries_.back().start_addr);
+    entries_.pop_back();
   }
 }
 
-LLVMAddr2line::LLVMAddr2line(const std::string &binary_name)
-    : Addr2line(binary_name), binary_(GetOwningBinary(binary_name)) {}
+bool CachingAddr2line::GetInlineStackBoundaries(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<uint64_t> *boundaries) const {
+  return addr2line_->GetInlineStackBoundaries(start_addr, end_addr,
+                                              boundaries);
+}
+
+bool CachingAddr2line::GetInlineStackRange(uint64_t addr, uint64_t *start_addr,
+                                           uint64_t *end_addr) const {
+  return addr2line_->GetInlineStackRange(addr, start_addr, end_addr);
+}
+
+LLVMAddr2line::LLVMAddr2line(
+    const std::string &binary_name,
+    const std::map<uint64_t, uint64_t> *sampled_functions)
+    : Addr2line(binary_name), sampled_functions_(sampled_functions),
+      binary_(GetOwningBinary(binary_name)) {}
 
 bool LLVMAddr2line::Prepare() {
   if (!binary_.getBinary()) return false;
   dwarf_info_ = llvm::DWARFContext::create(*binary_.getBinary());
+  // Only the unit DIEs are read here. The DIE trees and line tables of the
+  // units that are kept are read when they are first queried.
   for (auto &unit : dwarf_info_->compile_units()) {
-    unit_map_[unit->getOffset()] = unit.get();
+    auto ranges = unit->collectAddressRanges();
+    if (!ranges) {
+      llvm::consumeError(ranges.takeError());
+      continue;
+    }
+    if (sampled_functions_ != nullptr &&
+        std::none_of(ranges->begin(), ranges->end(),
+                     [this](const llvm::DWARFAddressRange &range) {
+                       return OverlapsSampledFunction(
+                           range.LowPC, range.HighPC, *sampled_functions_);
+                     }))
+      continue;
+    for (const llvm::DWARFAddressRange &range : *ranges) {
+      if (range.LowPC < range.HighPC)
+        unit_ranges_.emplace(range.LowPC,
+                             std::make_pair(range.HighPC, unit.get()));
+    }
   }
   return true;
 }
 
+llvm::DWARFUnit *LLVMAddr2line::FindUnit(uint64_t address) const {
+  auto next = unit_ranges_.upper_bound(address);
+  if (next == unit_ranges_.begin()) return nullptr;
+  --next;
+  return address < next->second.first ? next->second.second : nullptr;
+}
+
+const std::vector<uint64_t> *LLVMAddr2line::GetSubprogramBoundaries(
+    llvm::DWARFUnit *unit, uint64_t address) const {
+  // The innermost subroutine may be inlined, its parents lead to the
+  // subprogram it is inlined into.
+  llvm::DWARFDie die = unit->getSubroutineForAddress(address);
+  while (die.isValid() && !die.isSubprogramDIE()) die = die.getParent();
+  if (!die.isValid())
+    return nullptr;
+  auto inserted = subprogram_boundaries_.emplace(die.getOffset(),
+                                                 std::vector<uint64_t>());
+  std::vector<uint64_t> &boundaries = inserted.first->second;
+  if (inserted.second) {
+    CollectInlinedRangeBoundaries(die, &boundaries);
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                     boundaries.end());
+  }
+  return &boundaries;
+}
+
 void LLVMAddr2line::GetInlineStack(uint64_t address, SourceStack *stack) const {
-  auto cu_iter =
-      unit_map_.find(dwarf_info_->getDebugAranges()->findAddress(address));
-  if (cu_iter == unit_map_.end())
+  llvm::DWARFUnit *unit = FindUnit(address);
+  if (unit == nullptr)
     return;
   const llvm::DWARFDebugLine::LineTable *line_table =
-      dwarf_info_->getLineTableForUnit(cu_iter->second);
+      dwarf_info_->getLineTableForUnit(unit);
   if (line_table == nullptr)
     return;
   llvm::SmallVector<llvm::DWARFDie, 4> InlinedChain;
-  cu_iter->second->getInlinedChainForAddress(address, InlinedChain);
+  unit->getInlinedChainForAddress(address, InlinedChain);
 
   uint32_t row_index = line_table->lookupAddress(
       {address, llvm::object::SectionedAddress::UndefSection});
@@ -94,8 +309,9 @@ void LLVMAddr2line::GetInlineStack(uint64_t address, SourceStack *stack) const {
     const char *function_name =
         FunctionDIE.getSubroutineName(llvm::DINameKind::LinkageName);
     uint32_t start_line = FunctionDIE.getDeclLine();
-    std::string file_name;
-    std::string dir_name;
+    // Both names point into the DWARF sections, SourceInfo interns them.
+    absl::string_view file_name;
+    absl::string_view dir_name;
     if (line_table->hasFileAtIndex(file)) {
       const auto &entry = line_table->Prologue.getFileNameEntry(file);
       file_name = llvm::dwarf::toString(entry.Name).getValue();
@@ -112,4 +328,113 @@ void LLVMAddr2line::GetInlineStack(uint64_t address, SourceStack *stack) const {
     FunctionDIE.getCallerFrame(file, line, col, discriminator);
   }
 }
+
+bool LLVMAddr2line::GetInlineStackBoundaries(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<uint64_t> *boundaries) const {
+  boundaries->clear();
+  boundaries->push_back(start_addr);
+  bool found_line_table = false;
+  auto unit_range = unit_ranges_.upper_bound(start_addr);
+  if (unit_range != unit_ranges_.begin()) --unit_range;
+  for (; unit_range != unit_ranges_.end() && unit_range->first < end_addr;
+       ++unit_range) {
+    const uint64_t low_pc = std::max(start_addr, unit_range->first);
+    const uint64_t high_pc = std::min(end_addr, unit_range->second.first);
+    if (low_pc >= high_pc)
+      continue;
+    llvm::DWARFUnit *unit = unit_range->second.second;
+    const llvm::DWARFDebugLine::LineTable *line_table =
+        dwarf_info_->getLineTableForUnit(unit);
+    if (line_table == nullptr)
+      continue;
+    found_line_table = true;
+
+    // The file, line and discriminator only change at line table rows.
+    std::vector<uint64_t> rows;
+    for (const auto &sequence : line_table->Sequences) {
+      if (sequence.HighPC <= low_pc || sequence.LowPC >= high_pc)
+        continue;
+      for (unsigned i = sequence.FirstRowIndex; i < sequence.LastRowIndex; ++i)
+        rows.push_back(line_table->Rows[i].Address.Address);
+    }
+    std::sort(rows.begin(), rows.end());
+    boundaries->push_back(low_pc);
+    boundaries->insert(boundaries->end(), rows.begin(), rows.end());
+    // The inlined chain only changes at the boundaries of inlined subroutines,
+    // so step from one to the next. Outside of any subprogram, e.g. in padding
+    // between functions, step to the next row instead.
+    for (uint64_t addr = low_pc; addr < high_pc;) {
+      const std::vector<uint64_t> *next_candidates =
+          GetSubprogramBoundaries(unit, addr);
+      if (next_candidates == nullptr) next_candidates = &rows;
+      auto next = std::upper_bound(next_candidates->begin(),
+                                   next_candidates->end(), addr);
+      addr = next == next_candidates->end() ? high_pc
+                                            : std::min(*next, high_pc);
+      boundaries->push_back(addr);
+    }
+  }
+  if (!found_line_table)
+    return false;
+
+  boundaries->erase(std::remove_if(boundaries->begin(), boundaries->end(),
+                                   [start_addr, end_addr](uint64_t addr) {
+                                     return addr < start_addr ||
+                                            addr >= end_addr;
+                                   }),
+                    boundaries->end());
+  std::sort(boundaries->begin(), boundaries->end());
+  boundaries->erase(std::unique(boundaries->begin(), boundaries->end()),
+                    boundaries->end());
+  return true;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> LLVMAddr2line::GetCodeRanges()
+    const {
+  std::vector<std::pair<uint64_t, uint64_t>> code_ranges;
+  for (const llvm::object::SectionRef &section :
+       binary_.getBinary()->sections()) {
+    if (section.isText() && section.getSize() > 0)
+      code_ranges.emplace_back(section.getAddress(),
+                               section.getAddress() + section.getSize());
+  }
+  return code_ranges;
+}
+
+bool LLVMAddr2line::GetInlineStackRange(uint64_t address,
+                                        uint64_t *start_addr,
+                                        uint64_t *end_addr) const {
+  llvm::DWARFUnit *unit = FindUnit(address);
+  if (unit == nullptr)
+    return false;
+  const llvm::DWARFDebugLine::LineTable *line_table =
+      dwarf_info_->getLineTableForUnit(unit);
+  if (line_table == nullptr)
+    return false;
+  uint32_t row_index = line_table->lookupAddress(
+      {address, llvm::object::SectionedAddress::UndefSection});
+  if (row_index == -1U)
+    return false;
+
+  // The file, line and discriminator are those of the row, which is never the
+  // end of its sequence, so the next row ends the range.
+  uint64_t start = line_table->Rows[row_index].Address.Address;
+  uint64_t end = line_table->Rows[row_index + 1].Address.Address;
+  // The inlined chain only changes at the boundaries of inlined subroutines.
+  // Addresses outside of any subprogram, e.g. padding between functions, are
+  // rare, so there is no need to find where the next subprogram starts.
+  const std::vector<uint64_t> *boundaries =
+      GetSubprogramBoundaries(unit, address);
+  if (boundaries == nullptr)
+    return false;
+  auto next = std::upper_bound(boundaries->begin(), boundaries->end(), address);
+  if (next != boundaries->end())
+    end = std::min(end, *next);
+  if (next != boundaries->begin())
+    start = std::max(start, *std::prev(next));
+  *start_addr = start;
+  *end_addr = end;
+  return true;
+}
 }  // namespace devtools_crosstool_autofdo
@@ -7,8 +7,12 @@
 #define AUTOFDO_ADDR2LINE_H_
 
 #include <cstdint>
+#include <list>
 #include <map>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/integral_types.h"
 #include "base/macros.h"
@@ -40,6 +44,27 @@ class Addr2line {
   // Stores the inline stack of ADDR in STACK.
   virtual void GetInlineStack(uint64_t addr, SourceStack *stack) const = 0;
 
+  // Stores in BOUNDARIES the sorted addresses in [START_ADDR, END_ADDR) at
+  // which the inline stack may change, always starting with START_ADDR. The
+  // inline stack is the same for all addresses between two consecutive
+  // boundaries. Returns false if the boundaries cannot be derived, in which
+  // case every address has to be queried separately.
+  virtual bool GetInlineStackBoundaries(uint64_t start_addr, uint64_t end_addr,
+                                        std::vector<uint64_t> *boundaries)
+      const {
+    return false;
+  }
+
+  // Stores in [START_ADDR, END_ADDR) the range around ADDR over which the
+  // inline stack is the same as the one of ADDR. Returns false if the range
+  // cannot be derived.
+  virtual bool GetInlineStackRange(uint64_t addr, uint64_t *start_addr,
+                                   uint64_t *end_addr) const {
+    return false;
+  }
+
+  const std::string &binary_name() const { return binary_name_; }
+
  protected:
   std::string binary_name_;
 
@@ -47,19 +72,101 @@ class Addr2line {
   DISALLOW_COPY_AND_ASSIGN(Addr2line);
 };
 
+// Addr2line that remembers the inline stacks found by another Addr2line. An
+// entry covers the whole range over which the wrapped Addr2line reports the
+// same inline stack, so all the addresses of a line table row share it.
+// Addresses for which the wrapped Addr2line cannot tell the range are not
+// cached. If MAX_ENTRIES is positive, the least recently used entries are
+// evicted to keep at most that many. It is not thread-safe.
+class CachingAddr2line : public Addr2line {
+ public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+
+  CachingAddr2line(std::unique_ptr<Addr2line> addr2line, size_t max_entries);
+  ~CachingAddr2line() override;
+
+  bool Prepare() override;
+  void GetInlineStack(uint64_t addr, SourceStack *stack) const override;
+  bool GetInlineStackBoundaries(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<uint64_t> *boundaries) const override;
+  bool GetInlineStackRange(uint64_t addr, uint64_t *start_addr,
+                           uint64_t *end_addr) const override;
+
+  const Stats &stats() const { return stats_; }
+
+  // Returns the number of cached ranges.
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    uint64_t start_addr;
+    uint64_t end_addr;
+    SourceStack stack;
+  };
+  // Entries ordered from the most to the least recently used.
+  typedef std::list<Entry> EntryList;
+
+  std::unique_ptr<Addr2line> addr2line_;
+  const size_t max_entries_;
+  mutable EntryList entries_;
+  // Map from the start address of each entry to the entry.
+  mutable std::map<uint64_t, EntryList::iterator> index_;
+  mutable Stats stats_;
+  DISALLOW_COPY_AND_ASSIGN(CachingAddr2line);
+};
+
 #if defined(HAVE_LLVM)
 class LLVMAddr2line : public Addr2line {
  public:
-  explicit LLVMAddr2line(const std::string &binary_name);
+  // If SAMPLED_FUNCTIONS, a map from the start address of functions to their
+  // size, is not null, only the compilation units containing one of them are
+  // symbolized. It is only read by Prepare().
+  explicit LLVMAddr2line(
+      const std::string &binary_name,
+      const std::map<uint64_t, uint64_t> *sampled_functions = nullptr);
   bool Prepare() override;
   void GetInlineStack(uint64_t address, SourceStack *stack) const override;
+  bool GetInlineStackBoundaries(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<uint64_t> *boundaries) const override;
+  bool GetInlineStackRange(uint64_t address, uint64_t *start_addr,
+                           uint64_t *end_addr) const override;
+
+  // Returns the [start, end) address ranges of the executable sections.
+  std::vector<std::pair<uint64_t, uint64_t>> GetCodeRanges() const;
 
  private:
-  // map from cu_offset to the CompileUnit.
-  std::map<uint32_t, llvm::DWARFUnit *> unit_map_;
+  // Returns the compilation unit containing ADDRESS, or nullptr.
+  llvm::DWARFUnit *FindUnit(uint64_t address) const;
+
+  // Returns the sorted addresses at which the inlined chain may change within
+  // the subprogram of UNIT containing ADDRESS, or nullptr if there is none.
+  // They are collected the first time the subprogram is queried.
+  const std::vector<uint64_t> *GetSubprogramBoundaries(
+      llvm::DWARFUnit *unit, uint64_t address) const;
+
+  const std::map<uint64_t, uint64_t> *sampled_functions_;
+  // Map from the start of each address range of the compilation units to its
+  // end and unit. When only sampled functions are symbolized, it only has the
+  // units containing one of them.
+  std::map<uint64_t, std::pair<uint64_t, llvm::DWARFUnit *>> unit_ranges_;
+  // Map from the offset of subprogram DIEs to their boundaries, see
+  // GetSubprogramBoundaries.
+  mutable std::map<uint64_t, std::vector<uint64_t>> subprogram_boundaries_;
   llvm::object::OwningBinary<llvm::object::ObjectFile> binary_;
   std::unique_ptr<llvm::DWARFContext> dwarf_info_;
 };
+
+// Writes the index of BINARY_NAME to --symbolization_index_dir, for
+// Addr2line::Create to symbolize it from there, unless the flag is not set or
+// a valid index is already there. The index is built from an LLVMAddr2line of
+// the whole binary. Failures are logged; symbolization then keeps using DWARF.
+void WriteSymbolizationIndex(const std::string &binary_name);
 #else
 class AddressQuery;
 class InlineStackHandler;
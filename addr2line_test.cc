@@ -0,0 +1,175 @@
+// These tests check that CachingAddr2line returns the inline stacks of the
+// Addr2line it wraps, and only queries it once per range, that LLVMAddr2line
+// only symbolizes the compilation units of sampled functions when given some,
+// and that its inline stack ranges are right and cheap to find.
+
+#include "addr2line.h"
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "source_info.h"
+#include "gtest/gtest.h"
+#include "third_party/abseil/absl/memory/memory.h"
+
+#define FLAGS_test_srcdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+namespace {
+
+using ::devtools_crosstool_autofdo::Addr2line;
+using ::devtools_crosstool_autofdo::CachingAddr2line;
+using ::devtools_crosstool_autofdo::LLVMAddr2line;
+using ::devtools_crosstool_autofdo::SourceStack;
+
+const char kTestDataDir[] = "/testdata/";
+
+// Addr2line whose inline stack only changes every 16 bytes, at which point the
+// line number is the address divided by 16.
+class FakeAddr2line : public Addr2line {
+ public:
+  explicit FakeAddr2line(int *queries)
+      : Addr2line("fake.binary"), queries_(queries) {}
+
+  bool Prepare() override { return true; }
+
+  void GetInlineStack(uint64_t addr, SourceStack *stack) const override {
+    ++*queries_;
+    stack->emplace_back("foo", "/src", "foo.cc", 1, addr / 16, 0);
+  }
+
+  bool GetInlineStackRange(uint64_t addr, uint64_t *start_addr,
+                           uint64_t *end_addr) const override {
+    *start_addr = addr & ~15ULL;
+    *end_addr = *start_addr + 16;
+    return true;
+  }
+
+ private:
+  int *queries_;
+};
+
+uint32_t LineOf(const Addr2line &addr2line, uint64_t addr) {
+  SourceStack stack;
+  addr2line.GetInlineStack(addr, &stack);
+  EXPECT_EQ(stack.size(), 1);
+  return stack.empty() ? 0 : stack[0].line;
+}
+
+TEST(CachingAddr2lineTest, SharesRanges) {
+  int queries = 0;
+  CachingAddr2line addr2line(absl::make_unique<FakeAddr2line>(&queries), 0);
+  for (uint64_t addr = 0x1000; addr < 0x1100; ++addr)
+    EXPECT_EQ(LineOf(addr2line, addr), addr / 16);
+  // Query the addresses again, in a different order.
+  for (uint64_t addr = 0x10ff; addr >= 0x1000; --addr)
+    EXPECT_EQ(LineOf(addr2line, addr), addr / 16);
+  EXPECT_EQ(queries, 16);
+  EXPECT_EQ(addr2line.size(), 16);
+  EXPECT_EQ(addr2line.stats().misses, 16);
+  EXPECT_EQ(addr2line.stats().hits, 2 * 0x100 - 16);
+  EXPECT_EQ(addr2line.stats().evictions, 0);
+  EXPECT_EQ(addr2line.binary_name(), "fake.binary");
+}
+
+TEST(CachingAddr2lineTest, EvictsLeastRecentlyUsed) {
+  int queries = 0;
+  CachingAddr2line addr2line(absl::make_unique<FakeAddr2line>(&queries), 2);
+  LineOf(addr2line, 0x1000);
+  LineOf(addr2line, 0x1010);
+  // Makes 0x1010 the least recently used range.
+  LineOf(addr2line, 0x1001);
+  LineOf(addr2line, 0x1020);
+  EXPECT_EQ(queries, 3);
+  EXPECT_EQ(addr2line.size(), 2);
+  EXPECT_EQ(addr2line.stats().evictions, 1);
+
+  EXPECT_EQ(LineOf(addr2line, 0x1002), 0x100);
+  EXPECT_EQ(LineOf(addr2line, 0x1021), 0x102);
+  EXPECT_EQ(queries, 3);
+  EXPECT_EQ(LineOf(addr2line, 0x1011), 0x101);
+  EXPECT_EQ(queries, 4);
+  EXPECT_EQ(addr2line.stats().evictions, 2);
+}
+
+TEST(LLVMAddr2lineTest, OnlySymbolizesSampledUnits) {
+  const std::string binary = FLAGS_test_srcdir + kTestDataDir + "test.binary";
+  // build_tree, in trees.c.
+  const std::map<uint64_t, uint64_t> sampled_functions = {{0x405060, 0x4b5}};
+  LLVMAddr2line all(binary);
+  ASSERT_TRUE(all.Prepare());
+  LLVMAddr2line sampled(binary, &sampled_functions);
+  ASSERT_TRUE(sampled.Prepare());
+
+  // trees.c, whose functions are all symbolized.
+  for (uint64_t addr = 0x4049b0; addr < 0x405c1d; ++addr) {
+    SourceStack expected, actual;
+    all.GetInlineStack(addr, &expected);
+    sampled.GetInlineStack(addr, &actual);
+    ASSERT_EQ(actual.size(), expected.size()) << std::hex << addr;
+    for (int i = 0; i < expected.size(); ++i) {
+      EXPECT_STREQ(actual[i].func_name, expected[i].func_name);
+      EXPECT_EQ(actual[i].line, expected[i].line);
+    }
+  }
+  // deflate.c, which has no sampled function.
+  SourceStack stack;
+  all.GetInlineStack(0x4013b0, &stack);
+  EXPECT_FALSE(stack.empty());
+  stack.clear();
+  sampled.GetInlineStack(0x4013b0, &stack);
+  EXPECT_TRUE(stack.empty());
+}
+
+// A CachingAddr2line miss looks up both the inline stack and its range, so
+// finding the range must cost less than finding the stack for the cache to
+// pay off.
+TEST(LLVMAddr2lineTest, InlineStackRangeCostsLessThanInlineStack) {
+  const std::string binary = FLAGS_test_srcdir + kTestDataDir + "test.binary";
+  LLVMAddr2line addr2line(binary);
+  ASSERT_TRUE(addr2line.Prepare());
+  std::vector<uint64_t> addrs;
+  for (const auto &code_range : addr2line.GetCodeRanges()) {
+    for (uint64_t addr = code_range.first; addr < code_range.second; ++addr)
+      addrs.push_back(addr);
+  }
+  ASSERT_FALSE(addrs.empty());
+
+  for (uint64_t addr : addrs) {
+    uint64_t start_addr, end_addr;
+    if (!addr2line.GetInlineStackRange(addr, &start_addr, &end_addr)) continue;
+    ASSERT_LE(start_addr, addr) << std::hex << addr;
+    ASSERT_LT(addr, end_addr) << std::hex << addr;
+    SourceStack expected, actual;
+    addr2line.GetInlineStack(addr, &expected);
+    addr2line.GetInlineStack(start_addr, &actual);
+    ASSERT_EQ(actual.size(), expected.size()) << std::hex << addr;
+    for (int i = 0; i < expected.size(); ++i) {
+      EXPECT_STREQ(actual[i].func_name, expected[i].func_name);
+      EXPECT_EQ(actual[i].line, expected[i].line);
+    }
+  }
+
+  // The DIEs have all been read above, so only the lookups are timed.
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t addr : addrs) {
+    SourceStack stack;
+    addr2line.GetInlineStack(addr, &stack);
+  }
+  const auto stack_time = std::chrono::steady_clock::now() - start;
+  start = std::chrono::steady_clock::now();
+  for (uint64_t addr : addrs) {
+    uint64_t start_addr, end_addr;
+    addr2line.GetInlineStackRange(addr, &start_addr, &end_addr);
+  }
+  const auto range_time = std::chrono::steady_clock::now() - start;
+  EXPECT_LT(
+      std::chrono::duration_cast<std::chrono::microseconds>(range_time).count(),
+      std::chrono::duration_cast<std::chrono::microseconds>(stack_time)
+          .count());
+}
+
+}  // namespace
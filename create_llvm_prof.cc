@@ -6,6 +6,7 @@
 #include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/strings/match.h"
 #if defined(HAVE_LLVM)
+#include <algorithm>
 #include <fstream>
 #include <memory>
 #include <string>
@@ -18,6 +19,7 @@
 #include "llvm_propeller_options_builder.h"
 #include "llvm_propeller_profile_writer.h"
 #include "perfdata_reader.h"
+#include "profile.h"
 #include "profile_creator.h"
 #include "third_party/abseil/absl/status/status.h"
 #include "third_party/abseil/absl/strings/str_split.h"
@@ -93,7 +95,8 @@ devtools_crosstool_autofdo::PropellerOptions CreatePropellerOptionsFromFlags() {
           .SetClusterOutName(absl::GetFlag(FLAGS_out))
           .SetSymbolOrderOutName(absl::GetFlag(FLAGS_propeller_symorder))
           .SetProfiledBinaryName(absl::GetFlag(FLAGS_profiled_binary_name))
-          .SetIgnoreBuildId(absl::GetFlag(FLAGS_ignore_build_id)));
+          .SetIgnoreBuildId(absl::GetFlag(FLAGS_ignore_build_id))
+          .SetJobs(std::max(absl::GetFlag(FLAGS_jobs), 1)));
 }
 
 int main(int argc, char **argv) {
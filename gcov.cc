@@ -14,11 +14,16 @@
 
 // Define the flag used by gcov.
 
+#include <fcntl.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <memory>
 
 #include "gcov.h"
 #include "third_party/abseil/absl/flags/flag.h"
@@ -36,203 +41,224 @@ const uint32 GCOV_TAG_AFDO_WORKING_SET = 0xaf000000;
 const uint32 GCOV_DATA_MAGIC = 0x67636461; /* "gcda" */
 const char *GCOV_ELF_SECTION_NAME = ".gnu.switches.text";
 
-#define GCOV_BLOCK_BYTE_SIZE (1 << 12)
+namespace devtools_crosstool_autofdo {
 
-struct gcov_var {
-  FILE *file;
-  uint32 byte_offset;
-  uint32 byte_length;
-  int32 error;
-  int32 mode;
-  uint64 byte_alloc;
-  char *buffer;
-};
-
-static struct gcov_var gcov_var;
+bool GcovReader::Open(const char *name) {
+  CHECK(!map_);
+  offset_ = size_ = 0;
+  error_ = 0;
+  version_ = absl::GetFlag(FLAGS_gcov_version);
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    map_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map_ == MAP_FAILED) {
+      map_ = nullptr;
+      size_ = 0;
+      close(fd);
+      return false;
+    }
+    madvise(map_, size_, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  return true;
+}
 
-static void gcov_write_block(unsigned byte_size) {
-  if (fwrite(gcov_var.buffer, byte_size, 1, gcov_var.file) != 1) {
-    gcov_var.error = 1;
+int GcovReader::Close() {
+  if (map_) {
+    munmap(map_, size_);
+    map_ = nullptr;
   }
-  gcov_var.byte_offset -= byte_size;
+  size_ = offset_ = 0;
+  return error_;
 }
 
-int gcov_open(const char *name, int mode) {
-  CHECK(!gcov_var.file);
-  gcov_var.byte_offset = gcov_var.byte_length = 0;
-  gcov_var.error = 0;
-  if (mode >= 0)
-    gcov_var.file = fopen(name, (mode > 0) ? "rb" : "r+b");
-
-  if (gcov_var.file) {
-    gcov_var.mode = 1;
-  } else if (mode <= 0) {
-    gcov_var.file = fopen(name, "w+b");
-    if (gcov_var.file) {
-      gcov_var.mode = mode * 2 + 1;
-    }
+const char *GcovReader::ReadBytes(size_t bytes) {
+  if (size_ - offset_ < bytes) {
+    offset_ = size_;
+    error_ = 1;
+    return nullptr;
   }
-  if (!gcov_var.file) {
+  const char *result = static_cast<const char *>(map_) + offset_;
+  offset_ += bytes;
+  return result;
+}
+
+uint32 GcovReader::ReadUnsigned() {
+  const char *buffer = ReadBytes(4);
+  if (!buffer) {
     return 0;
   }
-
-  setbuf(gcov_var.file, NULL);
-
-  return 1;
+  // Strings saved in bytes leave the following words unaligned.
+  uint32 value;
+  memcpy(&value, buffer, sizeof(value));
+  return value;
 }
 
-int gcov_close(void) {
-  if (gcov_var.file) {
-    if (gcov_var.byte_offset && gcov_var.mode < 0) {
-      gcov_write_block(gcov_var.byte_offset);
-    }
-    fclose(gcov_var.file);
-    gcov_var.file = 0;
-    gcov_var.byte_length = 0;
+uint64 GcovReader::ReadCounter() {
+  const char *buffer = ReadBytes(8);
+  if (!buffer) {
+    return 0;
   }
-  gcov_var.mode = 0;
-  int err = gcov_var.error;
-  return err;
+  uint32 words[2];
+  memcpy(words, buffer, sizeof(words));
+  return words[0] | (static_cast<uint64>(words[1]) << 32);
 }
 
-static inline void gcov_allocate(unsigned byte_length) {
-  uint64 new_byte_size = gcov_var.byte_alloc;
-
-  if (!new_byte_size) {
-    new_byte_size = GCOV_BLOCK_BYTE_SIZE;
+const char *GcovReader::ReadString() {
+  uint32 length = ReadUnsigned();
+  if (!length) {
+    return nullptr;
+  }
+  if (version_ == 2) {
+    return ReadBytes(length);
+  } else {
+    return ReadBytes(static_cast<size_t>(length) << 2);
   }
-  new_byte_size += byte_length;
-  new_byte_size *= 2;
-
-  gcov_var.byte_alloc = new_byte_size;
-  gcov_var.buffer =
-      static_cast<char *>(realloc(gcov_var.buffer, new_byte_size));
 }
 
-static inline char *gcov_write_bytes(unsigned bytes) {
-  char *result;
+bool GcovWriter::Open(const char *name) {
+  CHECK(!file_);
+  buffer_.clear();
+  buffer_.reserve(1 << 20);
+  file_ = fopen(name, "wb");
+  return file_ != nullptr;
+}
 
-  CHECK_LT(gcov_var.mode, 0);
-  if (gcov_var.byte_offset + bytes > gcov_var.byte_alloc) {
-    gcov_allocate(gcov_var.byte_offset + bytes);
+int GcovWriter::Close() {
+  if (!file_) {
+    return 0;
   }
-  result = &gcov_var.buffer[gcov_var.byte_offset];
-  gcov_var.byte_offset += bytes;
-
-  return result;
+  int error = 0;
+  if (!buffer_.empty() &&
+      fwrite(buffer_.data(), buffer_.size(), 1, file_) != 1) {
+    error = 1;
+  }
+  if (fclose(file_) != 0) {
+    error = 1;
+  }
+  file_ = nullptr;
+  buffer_.clear();
+  return error;
 }
 
-static inline uint32 *gcov_write_words(unsigned words) {
-  uint32 *result;
-  unsigned bytes = words << 2;
+char *GcovWriter::WriteBytes(size_t bytes) {
+  CHECK(file_);
+  size_t offset = buffer_.size();
+  buffer_.resize(offset + bytes);
+  return buffer_.data() + offset;
+}
 
-  return reinterpret_cast<uint32 *>(gcov_write_bytes(bytes));
+void GcovWriter::WriteUnsigned(uint32 value) {
+  memcpy(WriteBytes(4), &value, sizeof(value));
 }
 
+void GcovWriter::WriteCounter(uint64 value) {
+  uint32 words[2] = {static_cast<uint32>(value),
+                     static_cast<uint32>(value >> 32)};
+  memcpy(WriteBytes(8), words, sizeof(words));
+}
 
-void gcov_write_unsigned(uint32 value) {
-  uint32 *buffer = gcov_write_words(1);
-  buffer[0] = value;
+void GcovWriter::WriteString(const char *string) {
+  if (!string) {
+    WriteUnsigned(0);
+    return;
+  }
+  uint32 length = strlen(string);
+  uint32 alloc;
+  size_t bytes;
+  if (version_ == 2) {
+    // Length includes the terminating 0 and is saved in bytes.
+    alloc = length + 1;
+    bytes = alloc;
+  } else {
+    // Length is saved in words and padding is added.
+    alloc = (length + 4) >> 2;
+    bytes = alloc << 2;
+  }
+  char *buffer = WriteBytes(4 + bytes);
+  memcpy(buffer, &alloc, sizeof(alloc));
+  memcpy(buffer + 4, string, length);
+  memset(buffer + 4 + length, 0, bytes - length);
 }
 
-void gcov_write_counter(uint64 value) {
-  uint32 *buffer = gcov_write_words(2);
+}  // namespace devtools_crosstool_autofdo
 
-  buffer[0] = static_cast<uint32>(value);
-  buffer[1] = static_cast<uint32>(value >> 32);
-}
+using devtools_crosstool_autofdo::GcovReader;
+using devtools_crosstool_autofdo::GcovWriter;
 
-void gcov_write_string(const char *string) {
-  unsigned length = 0;
-  unsigned alloc = 0;
-  uint32 *buffer;
-
-  if (string) {
-    length = strlen(string);
-    if (absl::GetFlag(FLAGS_gcov_version) == 2) {
-      // Length includes the terminating 0 and is saved in bytes.
-      alloc = length + 1;
-      char *byte_buffer = gcov_write_bytes(4 + alloc);
-      byte_buffer[3 + alloc] = 0;
-      buffer = reinterpret_cast<uint32 *>(byte_buffer);
+// The file opened by gcov_open on this thread.
+static thread_local std::unique_ptr<GcovReader> gcov_reader;
+static thread_local std::unique_ptr<GcovWriter> gcov_writer;
+
+int gcov_open(const char *name, int mode) {
+  CHECK(!gcov_reader && !gcov_writer);
+  if (mode >= 0) {
+    gcov_reader = std::make_unique<GcovReader>();
+    if (!gcov_reader->Open(name)) {
+      gcov_reader.reset();
+      return 0;
     }
-    else {
-      // Length is saved in words and padding is added.
-      alloc = (length + 4) >> 2;
-      buffer = gcov_write_words(1 + alloc);
-      buffer[alloc] = 0;
+  } else {
+    gcov_writer =
+        std::make_unique<GcovWriter>(absl::GetFlag(FLAGS_gcov_version));
+    if (!gcov_writer->Open(name)) {
+      gcov_writer.reset();
+      return 0;
     }
   }
+  return 1;
+}
 
-  buffer[0] = alloc;
-  memcpy(&buffer[1], string, length);
+int gcov_close(void) {
+  int err = 0;
+  if (gcov_reader) {
+    err = gcov_reader->Close();
+    gcov_reader.reset();
+  }
+  if (gcov_writer) {
+    err = gcov_writer->Close();
+    gcov_writer.reset();
+  }
+  return err;
 }
 
-static inline const char *gcov_read_bytes(unsigned bytes) {
-  const char *result;
-  unsigned excess_bytes = gcov_var.byte_length - gcov_var.byte_offset;
+void gcov_write_unsigned(uint32 value) {
+  CHECK(gcov_writer);
+  gcov_writer->WriteUnsigned(value);
+}
 
-  CHECK_GT(gcov_var.mode, 0);
-  CHECK(bytes < GCOV_BLOCK_BYTE_SIZE);
-  if (excess_bytes < bytes) {
-    memmove(gcov_var.buffer, gcov_var.buffer + gcov_var.byte_offset, excess_bytes);
-    gcov_var.byte_offset = 0;
-    gcov_var.byte_length = excess_bytes;
-    if (gcov_var.byte_length + bytes > gcov_var.byte_alloc) {
-      gcov_allocate(gcov_var.byte_length + bytes);
-    }
-    excess_bytes = gcov_var.byte_alloc - gcov_var.byte_length;
-    excess_bytes = fread(gcov_var.buffer + gcov_var.byte_length,
-                   1, excess_bytes, gcov_var.file);
-    gcov_var.byte_length += excess_bytes;
-    if (gcov_var.byte_length < bytes) {
-      gcov_var.byte_length = 0;
-      return 0;
-    }
-  }
-  result = &gcov_var.buffer[gcov_var.byte_offset];
-  gcov_var.byte_offset += bytes;
-  return result;
+void gcov_write_counter(uint64 value) {
+  CHECK(gcov_writer);
+  gcov_writer->WriteCounter(value);
 }
 
-static inline const uint32 *gcov_read_words(unsigned words) {
-  unsigned bytes = words << 2;
-  return reinterpret_cast<const uint32 *>(gcov_read_bytes(bytes));
+void gcov_write_string(const char *string) {
+  CHECK(gcov_writer);
+  gcov_writer->WriteString(string);
 }
 
 uint32 gcov_read_unsigned(void) {
-  uint32 value;
-  const uint32 *buffer = gcov_read_words(1);
-
-  if (!buffer) {
-    return 0;
-  }
-  value = buffer[0];
-  return value;
+  CHECK(gcov_reader);
+  return gcov_reader->ReadUnsigned();
 }
 
 uint64 gcov_read_counter(void) {
-  uint64 value;
-  const uint32 *buffer = gcov_read_words(2);
-
-  if (!buffer)
-    return 0;
-  value = buffer[0];
-  value |= (static_cast<uint64>(buffer[1])) << 32;
-  return value;
+  CHECK(gcov_reader);
+  return gcov_reader->ReadCounter();
 }
 
 const char * gcov_read_string(void) {
-  unsigned length = gcov_read_unsigned();
-
-  if (!length) {
-    return 0;
-  }
-
-  if (absl::GetFlag(FLAGS_gcov_version) == 2) {
-    return gcov_read_bytes (length);
-  }
-  else {
-    return (const char *) gcov_read_words (length);
-  }
+  CHECK(gcov_reader);
+  // --gcov_version may be set after the file is opened, from its header.
+  gcov_reader->set_version(absl::GetFlag(FLAGS_gcov_version));
+  return gcov_reader->ReadString();
 }
@@ -17,7 +17,12 @@
 #ifndef AUTOFDO_GCOV_H_
 #define AUTOFDO_GCOV_H_
 
+#include <stddef.h>
+
+#include <vector>
+
 #include "base/common.h"
+#include "base/macros.h"
 #include "third_party/abseil/absl/flags/declare.h"
 
 extern const uint32 GCOV_TAG_AFDO_FILE_NAMES;
@@ -40,6 +45,74 @@ enum hist_type {
   HIST_TYPE_INDIR_CALL_TOPN
 };
 
+namespace devtools_crosstool_autofdo {
+
+// Reads a gcov file mapped into memory. Each GcovReader is independent of
+// the others, so several files can be read at once, from any threads.
+class GcovReader {
+ public:
+  GcovReader() {}
+  ~GcovReader() { Close(); }
+
+  // Maps the file NAME. Returns false if it cannot be opened or mapped.
+  bool Open(const char *name);
+
+  // Unmaps the file. Returns nonzero if a read went past its end.
+  int Close();
+
+  // Sets the gcov version the strings are encoded with. It defaults to
+  // --gcov_version at the time the file is opened.
+  void set_version(uint64 version) { version_ = version; }
+
+  // The readers return 0 past the end of the file. Strings point into the
+  // mapped file and are valid until Close().
+  uint32 ReadUnsigned();
+  uint64 ReadCounter();
+  const char *ReadString();
+
+ private:
+  const char *ReadBytes(size_t bytes);
+
+  void *map_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  int32 error_ = 0;
+  uint64 version_ = 0;
+  DISALLOW_COPY_AND_ASSIGN(GcovReader);
+};
+
+// Writes a gcov file. The contents are accumulated in memory and written to
+// the file at once by Close(). Each GcovWriter is independent of the others.
+class GcovWriter {
+ public:
+  // Strings are encoded as expected by gcov VERSION.
+  explicit GcovWriter(uint64 version) : version_(version) {}
+  ~GcovWriter() { Close(); }
+
+  // Creates or truncates the file NAME. Returns false if it cannot be opened.
+  bool Open(const char *name);
+
+  // Writes the contents and closes the file. Returns nonzero on error.
+  int Close();
+
+  void WriteUnsigned(uint32 value);
+  void WriteCounter(uint64 value);
+  void WriteString(const char *string);
+
+ private:
+  char *WriteBytes(size_t bytes);
+
+  FILE *file_ = nullptr;
+  std::vector<char> buffer_;
+  const uint64 version_;
+  DISALLOW_COPY_AND_ASSIGN(GcovWriter);
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+// The functions below operate on a single file per thread, which is read if
+// MODE is non-negative and written otherwise. They are kept for code that
+// does not need to pass a GcovReader or GcovWriter around.
 int gcov_open(const char *name, int mode);
 
 int gcov_close(void);
@@ -8,32 +8,60 @@
 #include <string.h>
 
 #include <cstdint>
+#include <vector>
 
 #include "addr2line.h"
 #include "symbol_map.h"
 
 namespace devtools_crosstool_autofdo {
-InstructionMap::~InstructionMap() {
-  for (const auto &addr_info : inst_map_) {
-    delete addr_info.second;
-  }
-}
-
 void InstructionMap::BuildPerFunctionInstructionMap(const std::string &name,
                                                     uint64_t start_addr,
                                                     uint64_t end_addr) {
   if (start_addr >= end_addr) {
     return;
   }
-  for (uint64_t addr = start_addr; addr < end_addr; addr++) {
-    InstInfo *info = new InstInfo();
-    addr2line_->GetInlineStack(addr, &info->source_stack);
-    inst_map_.insert(InstMap::value_type(addr, info));
-    if (info->source_stack.size() > 0) {
-      symbol_map_->AddSourceCount(name, info->source_stack, 0, 1, 1,
-                                  SymbolMap::PERFDATA);
+  start_addr_ = start_addr;
+  end_addr_ = end_addr;
+
+  // Only symbolize the addresses where the inline stack may change. If the
+  // symbolizer cannot tell where that happens, fall back to querying each
+  // byte of the function.
+  std::vector<uint64_t> boundaries;
+  if (!addr2line_->GetInlineStackBoundaries(start_addr, end_addr,
+                                            &boundaries)) {
+    for (uint64_t addr = start_addr; addr < end_addr; addr++) {
+      AddRange(name, addr, addr + 1);
     }
+    return;
+  }
+  for (int i = 0; i < boundaries.size(); i++) {
+    AddRange(name, boundaries[i],
+             i + 1 < boundaries.size() ? boundaries[i + 1] : end_addr);
+  }
+}
+
+void InstructionMap::AddRange(const std::string &name, uint64_t start_addr,
+                              uint64_t end_addr) {
+  InstInfo &info = inst_map_[start_addr];
+  info.end_addr = end_addr;
+  addr2line_->GetInlineStack(start_addr, &info.source_stack);
+  if (info.source_stack.size() > 0) {
+    symbol_map_->AddSourceCount(name, info.source_stack, 0,
+                                end_addr - start_addr, 1, SymbolMap::PERFDATA);
+  }
+}
+
+const InstructionMap::InstInfo *InstructionMap::GetInstInfo(
+    uint64_t addr) const {
+  InstMap::const_iterator iter = inst_map_.upper_bound(addr);
+  if (iter == inst_map_.begin()) {
+    return nullptr;
+  }
+  --iter;
+  if (addr >= iter->second.end_addr) {
+    return nullptr;
   }
+  return &iter->second;
 }
 
 }  // namespace devtools_crosstool_autofdo
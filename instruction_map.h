@@ -22,8 +22,9 @@ namespace devtools_crosstool_autofdo {
 class SampleReader;
 class Addr2line;
 
-// InstructionMap stores all the disassembled instructions in
-// the binary, and maps it to its information.
+// InstructionMap stores the source information of the instructions in
+// the binary. Consecutive addresses that share the same inline stack are
+// stored as a single address range.
 class InstructionMap {
  public:
   // Arguments:
@@ -33,35 +34,49 @@ class InstructionMap {
   //           according to the debug info of each instruction.
   InstructionMap(Addr2line *addr2line,
                  SymbolMap *symbol)
-      : symbol_map_(symbol), addr2line_(addr2line) {
+      : symbol_map_(symbol), addr2line_(addr2line),
+        start_addr_(0), end_addr_(0) {
   }
 
-  // Deletes all the InstInfo, which was allocated in BuildInstMap.
-  ~InstructionMap();
-
-  // Returns the size of the instruction map.
+  // Returns the number of address ranges in the instruction map.
   uint64_t size() const { return inst_map_.size(); }
 
   // Builds instruction map for a function.
   void BuildPerFunctionInstructionMap(const std::string &name,
                                       uint64_t start_addr, uint64_t end_addr);
 
-  // Contains information about each instruction.
+  // Contains information about a range of instructions.
   struct InstInfo {
     const SourceInfo &source(int i) const {
       DCHECK(i >= 0 && source_stack.size() > i);
       return source_stack[i];
     }
+    // End address (exclusive) of the range this information applies to.
+    uint64_t end_addr = 0;
     SourceStack source_stack;
   };
 
-  typedef std::map<uint64_t, InstInfo *> InstMap;
+  // Returns the information of the instruction at ADDR, or nullptr if ADDR
+  // is not covered by the instruction map.
+  const InstInfo *GetInstInfo(uint64_t addr) const;
+
+  // Returns the address range [start_addr, end_addr) covered by the map.
+  uint64_t start_addr() const { return start_addr_; }
+  uint64_t end_addr() const { return end_addr_; }
+
+  // A map from the start address of each range to its information.
+  typedef std::map<uint64_t, InstInfo> InstMap;
   const InstMap &inst_map() const {
     return inst_map_;
   }
 
  private:
-  // A map from instruction address to its information.
+  // Adds the range [START_ADDR, END_ADDR), whose instructions share the
+  // inline stack of START_ADDR, to the map and to the symbol map of NAME.
+  void AddRange(const std::string &name, uint64_t start_addr,
+                uint64_t end_addr);
+
+  // A map from instruction address range to its information.
   InstMap inst_map_;
 
   // A map from symbol name to symbol data.
@@ -70,6 +85,10 @@ class InstructionMap {
   // Addr2line driver which is used to derive source stack.
   Addr2line *addr2line_;
 
+  // The address range covered by inst_map_.
+  uint64_t start_addr_;
+  uint64_t end_addr_;
+
   DISALLOW_COPY_AND_ASSIGN(InstructionMap);
 };
 }  // namespace devtools_crosstool_autofdo
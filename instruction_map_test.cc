@@ -47,6 +47,29 @@ TEST_F(InstructionMapTest, PerFunctionInstructionMap) {
       addr2line, &symbol_map);
   symbol_map.AddSymbol("longest_match");
   inst_map.BuildPerFunctionInstructionMap("longest_match", 0x401680, 0x401871);
+  // Consecutive bytes share the inline stack of their instruction, and most
+  // instructions that of their neighbours, so there are far fewer ranges than
+  // bytes.
+  EXPECT_LT(inst_map.size() * 4, 0x401871 - 0x401680);
+  EXPECT_EQ(inst_map.GetInstInfo(0x40167f), nullptr);
+  for (uint64_t addr = 0x401680; addr < 0x401871; addr++) {
+    const devtools_crosstool_autofdo::InstructionMap::InstInfo *info =
+        inst_map.GetInstInfo(addr);
+    ASSERT_NE(info, nullptr) << std::hex << addr;
+    // The range must have the inline stack of every address it covers.
+    devtools_crosstool_autofdo::SourceStack stack;
+    addr2line->GetInlineStack(addr, &stack);
+    ASSERT_EQ(info->source_stack.size(), stack.size()) << std::hex << addr;
+    for (int i = 0; i < stack.size(); ++i) {
+      EXPECT_STREQ(info->source(i).func_name, stack[i].func_name);
+      EXPECT_EQ(info->source(i).dir_name, stack[i].dir_name);
+      EXPECT_EQ(info->source(i).file_name, stack[i].file_name);
+      EXPECT_EQ(info->source(i).start_line, stack[i].start_line);
+      EXPECT_EQ(info->source(i).line, stack[i].line);
+      EXPECT_EQ(info->source(i).discriminator, stack[i].discriminator);
+    }
+  }
+  EXPECT_EQ(inst_map.GetInstInfo(0x401871), nullptr);
   delete addr2line;
 }
 }  // namespace
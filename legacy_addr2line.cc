@@ -18,6 +18,12 @@
 
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "base/logging.h"
 #include "symbolize/bytereader.h"
 #include "symbolize/dwarf2reader.h"
@@ -26,6 +32,11 @@
 #include "symbolize/functioninfo.h"
 #include "symbolize/elf_reader.h"
 #include "symbol_map.h"
+#include "third_party/abseil/absl/flags/declare.h"
+#include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/memory/memory.h"
+
+ABSL_DECLARE_FLAG(int32_t, jobs);
 
 namespace {
 void GetSection(const devtools_crosstool_autofdo::SectionMap &sections,
@@ -52,6 +63,33 @@ void GetSection(const devtools_crosstool_autofdo::SectionMap &sections,
   if (size_p)
     *size_p = size;
 }
+
+// Returns the offsets of the compilation units in the .debug_info section
+// DATA of SIZE bytes, found by following their initial length fields. A unit
+// whose length is invalid ends the section, and is returned so that parsing
+// it reports the error.
+std::vector<uint64_t> FindCompilationUnits(
+    const char *data, size_t size,
+    const devtools_crosstool_autofdo::ByteReader &reader) {
+  std::vector<uint64_t> offsets;
+  uint64_t pos = 0;
+  while (pos < size) {
+    offsets.push_back(pos);
+    if (size - pos < 4) break;
+    uint64_t length = reader.ReadFourBytes(data + pos);
+    uint64_t header_size = 4;
+    // In 64-bit DWARF, the initial length is all 1 bits followed by the
+    // actual length in the next 8 bytes.
+    if (length == 0xffffffff) {
+      if (size - pos < 12) break;
+      length = reader.ReadEightBytes(data + pos + 4);
+      header_size = 12;
+    }
+    if (length == 0 || length > size - pos - header_size) break;
+    pos += header_size + length;
+  }
+  return offsets;
+}
 }  // namespace
 
 namespace devtools_crosstool_autofdo {
@@ -113,9 +151,11 @@ bool Google3Addr2line::Prepare() {
   }
 
   size_t debug_info_size = 0;
+  const char *debug_info_data = NULL;
   size_t debug_ranges_size = 0;
   const char *debug_ranges_data = NULL;
-  GetSection(sections, ".debug_info", NULL, &debug_info_size, binary_name_, "");
+  GetSection(sections, ".debug_info", &debug_info_data, &debug_info_size,
+             binary_name_, "");
   GetSection(sections, ".debug_ranges", &debug_ranges_data,
              &debug_ranges_size, binary_name_, "");
   AddressRangeList debug_ranges(debug_ranges_data,
@@ -130,25 +170,65 @@ bool Google3Addr2line::Prepare() {
   // .debug_info. Otherwise, we'll iterate through .debug_line section,
   // assuming that compilation units are stored continuously in it.
   if (debug_info_size > 0) {
-    size_t debug_info_pos = 0;
-    while (debug_info_pos < debug_info_size) {
-      DirectoryVector dirs;
-      FileVector files;
-      CULineInfoHandler handler(&files, &dirs, line_map_, sampled_functions_);
-      inline_stack_handler_->set_directory_names(&dirs);
-      inline_stack_handler_->set_file_names(&files);
-      inline_stack_handler_->set_line_handler(&handler);
-      CompilationUnit compilation_unit(
-          binary_name_, sections, debug_info_pos, &reader,
-          inline_stack_handler_);
-      debug_info_pos += compilation_unit.Start();
-      if (compilation_unit.malformed()) {
+    // The compilation units are parsed concurrently, each into its own
+    // handler and line map, which are then merged in the order of the units
+    // so that the result does not depend on the thread schedule.
+    struct ParsedUnit {
+      std::unique_ptr<AddressToLineMap> line_map;
+      std::unique_ptr<InlineStackHandler> handler;
+      bool malformed = false;
+    };
+    const std::vector<uint64_t> unit_offsets =
+        FindCompilationUnits(debug_info_data, debug_info_size, reader);
+    std::vector<ParsedUnit> units(unit_offsets.size());
+    std::atomic<size_t> next_unit(0);
+    const uint64 vaddr = elf_->VaddrOfFirstLoadSegment();
+
+    auto worker = [&]() {
+      // CompilationUnit changes the offset size of its ByteReader, so each
+      // thread reads with its own.
+      ByteReader unit_reader(ENDIANNESS_LITTLE);
+      unit_reader.SetAddressSize(width);
+      AddressRangeList unit_ranges(debug_ranges_data, debug_ranges_size,
+                                   &unit_reader);
+      for (size_t i = next_unit++; i < units.size(); i = next_unit++) {
+        ParsedUnit &unit = units[i];
+        unit.line_map = absl::make_unique<AddressToLineMap>();
+        unit.handler = absl::make_unique<InlineStackHandler>(
+            &unit_ranges, sections, &unit_reader, sampled_functions_, vaddr);
+        DirectoryVector dirs;
+        FileVector files;
+        CULineInfoHandler handler(&files, &dirs, unit.line_map.get(),
+                                  sampled_functions_);
+        unit.handler->set_directory_names(&dirs);
+        unit.handler->set_file_names(&files);
+        unit.handler->set_line_handler(&handler);
+        CompilationUnit compilation_unit(binary_name_, sections,
+                                         unit_offsets[i], &unit_reader,
+                                         unit.handler.get());
+        compilation_unit.Start();
+        unit.malformed = compilation_unit.malformed();
+      }
+    };
+    const size_t jobs = std::min<size_t>(
+        std::max(absl::GetFlag(FLAGS_jobs), 1), units.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < jobs; ++i)
+      threads.emplace_back(worker);
+    worker();
+    for (std::thread &thread : threads) thread.join();
+
+    for (ParsedUnit &unit : units) {
+      line_map_->Append(*unit.line_map);
+      inline_stack_handler_->Merge(unit.handler.get());
+      if (unit.malformed) {
         LOG(WARNING) << "File '" << binary_name_ << "' has mangled "
                      << ".debug_info section.";
         // If the compilation unit is malformed, we do not know how
         // big it is, so it is only safe to give up.
         break;
       }
+      unit = ParsedUnit();
     }
   } else {
     const char *data;
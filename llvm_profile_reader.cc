@@ -1,13 +1,28 @@
 #include "llvm_profile_reader.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "string_pool.h"
 #include "symbol_map.h"
+#include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/strings/string_view.h"
 #include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LLVMContext.h"
 #include "llvm/ProfileData/SampleProfReader.h"
 
 namespace devtools_crosstool_autofdo {
 
 const char *LLVMProfileReader::GetName(const llvm::StringRef &N) {
-  return names_.insert(N.str()).first->c_str();
+  return InternString(absl::string_view(N.data(), N.size())).data();
 }
 
 #if LLVM_VERSION_MAJOR >= 12
@@ -34,7 +49,12 @@ bool LLVMProfileReader::ReadFromFile(const std::string &filename) {
   if (reader->read() != llvm::sampleprof_error::success) {
     return false;
   }
+  ReadFromSampleProfileReader(reader.get());
+  return true;
+}
 
+void LLVMProfileReader::ReadFromSampleProfileReader(
+    llvm::sampleprof::SampleProfileReader *reader) {
   // LLVMProfileReader's profile symbol list will live longer than sample
   // profile reader, so need to use ProfileSymbolList::merge to copy the
   // underlying string data in reader Buffer into LLVMProfileReader's
@@ -47,62 +67,80 @@ bool LLVMProfileReader::ReadFromFile(const std::string &filename) {
     SetProfileSymbolList(std::move(prof_sym_list));
   }
 
-  for (const auto &name_profile : reader->getProfiles()) {
-    SourceStack stack;
-    ReadFromFunctionSamples(stack, name_profile.second);
+  for (const auto &name_profile : reader->getProfiles())
+    ReadFromFunctionSamples(name_profile.second);
+}
+
+Symbol *LLVMProfileReader::GetSymbol(InlineInstance *instance) {
+  if (instance->symbol == nullptr) {
+    Symbol *caller = GetSymbol(instance->caller);
+    std::pair<CallsiteMap::iterator, bool> ret = caller->callsites.insert(
+        CallsiteMap::value_type(instance->callsite, nullptr));
+    if (ret.second)
+      ret.first->second = new Symbol(instance->callsite.second, "", "", 0);
+    instance->symbol = ret.first->second;
   }
-  return true;
+  return instance->symbol;
 }
 
 void LLVMProfileReader::ReadFromFunctionSamples(
-    const SourceStack &stack, const llvm::sampleprof::FunctionSamples &fs) {
+    const llvm::sampleprof::FunctionSamples &fs) {
   const char *func_name = GetName(fs.getName());
+  if (!shouldMergeProfileForSym(func_name)) return;
 
-  if (stack.empty() && !shouldMergeProfileForSym(func_name)) return;
+  symbol_map_->AddSymbol(func_name);
+  symbol_map_->AddSymbolEntryCount(func_name, fs.getHeadSamples());
+  InlineInstance outline = {nullptr, Callsite(0, nullptr),
+                            symbol_map_->map().at(func_name)};
+  AddSamples(fs, func_name, &outline);
 
-  const char *top_func_name = nullptr;
-  if (stack.empty()) {
-    top_func_name = func_name;
-    symbol_map_->AddSymbol(func_name);
-    symbol_map_->AddSymbolEntryCount(func_name, fs.getHeadSamples());
-  } else {
-    top_func_name = stack.back().func_name;
+  // The total count for a top-level function can be non-zero but the body
+  // samples may be zero if there is no debug information for the function.
+  // In this case, the total counts are populated but pos_counts is left empty.
+  // Please see b/175733095 for more details.
+  // NB: For inline instances, this can theoritically happen if lines without
+  // debug information receive samples and lines with debug information don't.
+  // It's not something we have seen in practice so it's not being implemented.
+  if (outline.symbol->total_count == 0) {
+    symbol_map_->AddSymbolEntryCount(func_name, 0, fs.getTotalSamples());
   }
+}
+
+uint64_t LLVMProfileReader::AddSamples(
+    const llvm::sampleprof::FunctionSamples &fs, const char *func_name,
+    InlineInstance *instance) {
+  const bool use_discriminator_encoding =
+      absl::GetFlag(FLAGS_use_discriminator_encoding);
+  uint64_t total_count = 0;
   for (const auto &loc_sample : fs.getBodySamples()) {
     SourceInfo info(func_name, "", "", 0, loc_sample.first.LineOffset,
                     loc_sample.first.Discriminator);
-    SourceStack new_stack;
-    new_stack.push_back(info);
-    new_stack.insert(new_stack.end(), stack.begin(), stack.end());
-    symbol_map_->AddSourceCount(top_func_name, new_stack,
-                                loc_sample.second.getSamples(), 1);
+    const uint64_t offset = info.Offset(use_discriminator_encoding);
+    const uint64_t count = loc_sample.second.getSamples();
+    ProfileInfo &profile = GetSymbol(instance)->pos_counts[offset];
+    profile.count += count;
+    profile.num_inst += 1;
     for (const auto &target_count : loc_sample.second.getCallTargets()) {
-      symbol_map_->AddIndirectCallTarget(top_func_name, new_stack,
-                                         GetName(target_count.getKey()),
-                                         target_count.getValue());
+      profile.target_map[symbol_map_->GetOriginalName(
+          GetName(target_count.getKey()))] = target_count.getValue();
     }
+    total_count += count;
   }
   for (const auto &loc_fsmap : fs.getCallsiteSamples()) {
     SourceInfo info(func_name, "", "", 0, loc_fsmap.first.LineOffset,
                     loc_fsmap.first.Discriminator);
-    SourceStack new_stack;
-    new_stack.push_back(info);
-    new_stack.insert(new_stack.end(), stack.begin(), stack.end());
-    for (const auto &name_fs : loc_fsmap.second)
-      ReadFromFunctionSamples(new_stack, name_fs.second);
-  }
-
-  // The total count for a top-level function can be non-zero but the body
-  // samples may be zero if there is no debug information for the function.
-  // In this case, the total counts are populated but pos_counts is left empty.
-  // Please see b/175733095 for more details.
-  // NB: For inline instances, this can theoritically happen if lines without
-  // debug information receive samples and lines with debug information don't.
-  // It's not something we have seen in practice so it's not being implemented.
-  if (stack.empty() &&
-      symbol_map_->map().at(func_name)->total_count == 0) {
-    symbol_map_->AddSymbolEntryCount(func_name, 0, fs.getTotalSamples());
+    const uint64_t offset = info.Offset(use_discriminator_encoding);
+    for (const auto &name_fs : loc_fsmap.second) {
+      const char *callee_name = GetName(name_fs.second.getName());
+      InlineInstance callee = {instance, Callsite(offset, callee_name),
+                               nullptr};
+      total_count += AddSamples(name_fs.second, callee_name, &callee);
+    }
   }
+  // Only instances with body samples in their subtree have a symbol.
+  if (instance->symbol != nullptr)
+    instance->symbol->total_count += total_count;
+  return total_count;
 }
 
 // Return whether to read the samples from current profile for the
@@ -147,4 +185,59 @@ bool LLVMProfileReader::shouldMergeProfileForSym(const std::string name) {
   return true;
 }
 
+void ReadLLVMProfilesInParallel(
+    const std::vector<std::string> &filenames, int jobs, SymbolMap *symbol_map,
+    llvm::sampleprof::ProfileSymbolList *prof_sym_list) {
+  jobs = std::min<size_t>(jobs, filenames.size());
+  std::atomic<size_t> next_file(0);
+  // The files before NEXT_TO_PARSE have been parsed, and the ones before
+  // NEXT_TO_MERGE merged into SYMBOL_MAP.
+  size_t next_to_parse = 0, next_to_merge = 0;
+  std::mutex mutex;
+  std::condition_variable turn;
+
+  auto worker = [&]() {
+    for (size_t i = next_file++; i < filenames.size(); i = next_file++) {
+      llvm::LLVMContext C;
+#if LLVM_VERSION_MAJOR >= 12
+      auto reader_or_err = llvm::sampleprof::SampleProfileReader::create(
+          filenames[i], C, llvm::sampleprof::FSDiscriminatorPass::PassLast);
+#else
+      auto reader_or_err =
+          llvm::sampleprof::SampleProfileReader::create(filenames[i], C);
+#endif
+      std::unique_ptr<llvm::sampleprof::SampleProfileReader> reader;
+      if (!reader_or_err.getError()) reader = std::move(reader_or_err.get());
+
+      // SampleProfileReader::read() sets global state of llvm::sampleprof,
+      // e.g. FunctionSamples::UseMD5, so the files are parsed one at a time
+      // and in order, leaving the state of the last file.
+      std::unique_lock<std::mutex> lock(mutex);
+      turn.wait(lock, [&]() { return next_to_parse == i; });
+      if (reader != nullptr &&
+          reader->read() != llvm::sampleprof_error::success)
+        reader.reset();
+      ++next_to_parse;
+      turn.notify_all();
+      lock.unlock();
+
+      SymbolMap file_map;
+      LLVMProfileReader file_reader(&file_map);
+      if (reader != nullptr) file_reader.ReadFromSampleProfileReader(&*reader);
+      reader.reset();
+
+      lock.lock();
+      turn.wait(lock, [&]() { return next_to_merge == i; });
+      symbol_map->MergeSymbols(file_map);
+      if (prof_sym_list != nullptr && file_reader.GetProfileSymbolList())
+        prof_sym_list->merge(*file_reader.GetProfileSymbolList());
+      ++next_to_merge;
+      turn.notify_all();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < jobs; ++i) threads.emplace_back(worker);
+  for (std::thread &thread : threads) thread.join();
+}
+
 }  // namespace devtools_crosstool_autofdo
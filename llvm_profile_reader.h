@@ -3,8 +3,13 @@
 #ifndef AUTOFDO_LLVM_PROFILE_READER_H_
 #define AUTOFDO_LLVM_PROFILE_READER_H_
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 #include "base_profile_reader.h"
 #include "source_info.h"
+#include "symbol_map.h"
 #include "third_party/abseil/absl/container/node_hash_set.h"
 #include "llvm/Config/llvm-config.h"
 #include "llvm/ProfileData/SampleProf.h"
@@ -16,6 +21,7 @@ namespace llvm {
 class StringRef;
 namespace sampleprof {
 class FunctionSamples;
+class SampleProfileReader;
 }
 }  // namespace llvm
 
@@ -40,9 +46,8 @@ struct SpecialSyms {
 class LLVMProfileReader : public ProfileReader {
  public:
   explicit LLVMProfileReader(SymbolMap *symbol_map,
-                             absl::node_hash_set<std::string>& names,
                              SpecialSyms *special_syms = nullptr)
-      : symbol_map_(symbol_map), names_(names), special_syms_(special_syms) {}
+      : symbol_map_(symbol_map), special_syms_(special_syms) {}
 
 #if LLVM_VERSION_MAJOR >= 12
   bool ReadFromFile(const std::string &output_file) override {
@@ -55,6 +60,11 @@ class LLVMProfileReader : public ProfileReader {
   bool ReadFromFile(const std::string &output_file) override;
 #endif
 
+  // Reads the profiles of READER, on which read() has already been called,
+  // into the symbol map.
+  void ReadFromSampleProfileReader(
+      llvm::sampleprof::SampleProfileReader *reader);
+
   bool shouldMergeProfileForSym(const std::string name);
 
   void SetProfileSymbolList(
@@ -67,16 +77,47 @@ class LLVMProfileReader : public ProfileReader {
   }
 
  private:
+  // Returns a copy of "N" interned in StringPool::Global(), which outlives the
+  // profile the name is read from.
   const char *GetName(const llvm::StringRef &N);
 
-  void ReadFromFunctionSamples(const SourceStack &stack,
-                               const llvm::sampleprof::FunctionSamples &fs);
+  // An inline instance of a function in the symbol map. Its symbol is only
+  // created once samples are added to it or to its inlinees.
+  struct InlineInstance {
+    InlineInstance *caller;
+    // The callsite of the instance in its caller.
+    Callsite callsite;
+    Symbol *symbol;
+  };
+
+  // Returns the symbol of INSTANCE, adding it and the symbols of its callers
+  // to the symbol map if they do not exist yet.
+  Symbol *GetSymbol(InlineInstance *instance);
+
+  // Adds the samples of the outline function FS to the symbol map.
+  void ReadFromFunctionSamples(const llvm::sampleprof::FunctionSamples &fs);
+
+  // Adds the samples of FS, the profile of FUNC_NAME, to INSTANCE and its
+  // inlinees, walking the callsite tree of the symbol map along with the
+  // profile. Returns the sum of the body samples of FS and its inlinees,
+  // which is also added to the total count of INSTANCE.
+  uint64_t AddSamples(const llvm::sampleprof::FunctionSamples &fs,
+                      const char *func_name, InlineInstance *instance);
 
   SymbolMap *symbol_map_;
-  absl::node_hash_set<std::string>& names_;
   SpecialSyms *special_syms_;
   std::unique_ptr<llvm::sampleprof::ProfileSymbolList> prof_sym_list_;
 };
+
+// Reads the LLVM profiles FILENAMES on JOBS threads into SYMBOL_MAP, and their
+// profile symbol lists into PROF_SYM_LIST if it is not null. Each file is read
+// into a symbol map of its own, which is merged into SYMBOL_MAP in the order of
+// FILENAMES with SymbolMap::MergeSymbols. The result is the same as reading the
+// files in order with an LLVMProfileReader each, and each thread holds at most
+// one file's profile in memory.
+void ReadLLVMProfilesInParallel(
+    const std::vector<std::string> &filenames, int jobs, SymbolMap *symbol_map,
+    llvm::sampleprof::ProfileSymbolList *prof_sym_list);
 }  // namespace devtools_crosstool_autofdo
 
 #endif  // AUTOFDO_LLVM_PROFILE_READER_H_
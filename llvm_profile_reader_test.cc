@@ -2,11 +2,15 @@
 
 #include "llvm_profile_reader.h"
 
+#include <fstream>
+#include <string>
+#include <vector>
+
 #include "base/commandlineflags.h"
 #include "symbol_map.h"
 #include "gtest/gtest.h"
-#include "third_party/abseil/absl/container/node_hash_set.h"
 #include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/strings/str_cat.h"
 
 #define FLAGS_test_tmpdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
 
@@ -32,8 +36,7 @@ void VerifySymbolMap(const devtools_crosstool_autofdo::SymbolMap &symbol_map) {
 
 TEST(LLVMProfileReaderTest, ReadBinaryTest) {
   devtools_crosstool_autofdo::SymbolMap symbol_map;
-  absl::node_hash_set<std::string> names;
-  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map, names);
+  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map);
   reader.ReadFromFile(FLAGS_test_srcdir +
                       "/testdata/"
                       "llvm_autoprof.golden.binprof");
@@ -42,8 +45,7 @@ TEST(LLVMProfileReaderTest, ReadBinaryTest) {
 
 TEST(LLVMProfileReaderTest, ReadTextTest) {
   devtools_crosstool_autofdo::SymbolMap symbol_map;
-  absl::node_hash_set<std::string> names;
-  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map, names);
+  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map);
   EXPECT_TRUE(
       reader.ReadFromFile(FLAGS_test_srcdir +
                           "/testdata/"
@@ -54,8 +56,7 @@ TEST(LLVMProfileReaderTest, ReadTextTest) {
 
 TEST(LLVMProfileReaderTest, ReadEmptyBodyNonZeroFunctionTotalTest) {
   devtools_crosstool_autofdo::SymbolMap symbol_map;
-  absl::node_hash_set<std::string> names;
-  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map, names);
+  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map);
   reader.ReadFromFile(FLAGS_test_srcdir +
                       "/testdata/"
                       "llvm_testzero.golden.textprof");
@@ -64,4 +65,60 @@ TEST(LLVMProfileReaderTest, ReadEmptyBodyNonZeroFunctionTotalTest) {
 
   EXPECT_EQ(data->total_count, 1000);
 }
+
+void ExpectSameSymbol(const devtools_crosstool_autofdo::Symbol &expected,
+                      const devtools_crosstool_autofdo::Symbol &actual) {
+  EXPECT_EQ(actual.total_count, expected.total_count);
+  EXPECT_EQ(actual.head_count, expected.head_count);
+  ASSERT_EQ(actual.pos_counts.size(), expected.pos_counts.size());
+  for (const auto &pos_count : expected.pos_counts) {
+    ASSERT_EQ(actual.pos_counts.count(pos_count.first), 1);
+    const auto &info = actual.pos_counts.at(pos_count.first);
+    EXPECT_EQ(info.count, pos_count.second.count);
+    EXPECT_EQ(info.num_inst, pos_count.second.num_inst);
+    EXPECT_EQ(info.target_map, pos_count.second.target_map);
+  }
+  ASSERT_EQ(actual.callsites.size(), expected.callsites.size());
+  for (const auto &callsite_symbol : expected.callsites) {
+    auto iter = actual.callsites.find(callsite_symbol.first);
+    ASSERT_NE(iter, actual.callsites.end());
+    ExpectSameSymbol(*callsite_symbol.second, *iter->second);
+  }
+}
+
+TEST(LLVMProfileReaderTest, ReadInParallelTest) {
+  // Call target counts differ between the profiles, and _Z4zerov has no body
+  // samples in some of them.
+  std::vector<std::string> filenames;
+  for (int i = 0; i < 8; ++i) {
+    filenames.push_back(
+        absl::StrCat(testing::TempDir(), "/parallel", i, ".textprof"));
+    std::ofstream out(filenames.back());
+    out << "main:" << 1000 + i << ":" << i << "\n"
+        << " 1: " << 10 * i << "\n"
+        << " 2: " << 5 + i << " _Z3foov:" << i + 1 << " _Z3barv:" << 7 - i
+        << "\n"
+        << " 3: _Z3foov:" << 3 * i << "\n"
+        << "  1: " << 3 * i << " _Z3barv:" << i << "\n"
+        << "_Z4zerov:" << 100 + i << ":" << i << "\n"
+        << " 1: " << (i % 3 == 2 ? i : 0) << "\n";
+    if (i % 2 == 1) out << "_Z3foov:" << 50 * i << ":1\n 1: " << i << "\n";
+  }
+
+  devtools_crosstool_autofdo::SymbolMap expected;
+  for (const std::string &filename : filenames) {
+    devtools_crosstool_autofdo::LLVMProfileReader reader(&expected);
+    ASSERT_TRUE(reader.ReadFromFile(filename));
+  }
+  devtools_crosstool_autofdo::SymbolMap actual;
+  devtools_crosstool_autofdo::ReadLLVMProfilesInParallel(filenames, 4, &actual,
+                                                         nullptr);
+
+  ASSERT_EQ(actual.map().size(), expected.map().size());
+  for (const auto &name_symbol : expected.map()) {
+    SCOPED_TRACE(name_symbol.first);
+    ASSERT_EQ(actual.map().count(name_symbol.first), 1);
+    ExpectSameSymbol(*name_symbol.second, *actual.map().at(name_symbol.first));
+  }
+}
 }  // namespace
@@ -150,7 +150,7 @@ llvm::StringRef LLVMProfileBuilder::GetNameRef(const std::string &str) {
     LOG(WARNING) << "Unexpected character '.' in function name: " << ret->first
                << ". Likely thin LTO .llvm.<hash> suffix has not been cleared.";
   }
-  return llvm::StringRef(ret->first.c_str());
+  return llvm::StringRef(ret->first.data(), ret->first.size());
 }
 
 llvm::sampleprof::SampleProfileWriter *LLVMProfileWriter::CreateSampleWriter(
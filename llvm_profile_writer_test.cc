@@ -1,6 +1,11 @@
 #include "llvm_profile_writer.h"
 
+#include <fstream>
+#include <sstream>
+#include <string>
+
 #include "addr2line.h"
+#include "profile.h"
 #include "profile_creator.h"
 #include "symbol_map.h"
 #include "gmock/gmock.h"
@@ -81,6 +86,32 @@ TEST(LlvmProfileWriterTest, ReadProfile) {
   ASSERT_EQ(call_targets.lookup("_Z3bari"), 8045);
 }
 
+TEST(LlvmProfileWriterTest, SameProfileWithMultipleJobs) {
+  const std::string binary =
+      absl::StrCat(FLAGS_test_srcdir, "/testdata/", "test.binary");
+  const std::string profile =
+      absl::StrCat(FLAGS_test_srcdir, "/testdata/", "test.lbr");
+
+  // Returns the text profile created from "profile" on "jobs" threads.
+  auto create_profile = [&](int jobs) {
+    absl::SetFlag(&FLAGS_jobs, jobs);
+    const std::string output =
+        absl::StrCat(testing::TempDir(), "/jobs", jobs, ".afdo");
+    ProfileCreator creator(binary);
+    LLVMProfileWriter writer(llvm::sampleprof::SPF_Text);
+    EXPECT_TRUE(creator.CreateProfile(profile, "perf", &writer, output));
+    std::ifstream stream(output);
+    std::stringstream contents;
+    contents << stream.rdbuf();
+    return contents.str();
+  };
+  const std::string serial_profile = create_profile(1);
+  const std::string parallel_profile = create_profile(4);
+  absl::SetFlag(&FLAGS_jobs, 1);
+  EXPECT_FALSE(serial_profile.empty());
+  EXPECT_EQ(parallel_profile, serial_profile);
+}
+
 TEST(LlvmProfileWriterTest, ConvertProfile) {
   SymbolMap symbol_map;
   symbol_map.set_count_threshold(1);
@@ -9,6 +9,7 @@
 #include "llvm_propeller_options.pb.h"
 #include "llvm_propeller_statistics.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
 
 namespace devtools_crosstool_autofdo {
 
@@ -51,6 +52,8 @@ class AbstractPropellerWholeProgramInfo {
   }
 
  protected:
+  // Arena of the nodes and edges of all cfgs, filled by a CFGBuilder.
+  llvm::BumpPtrAllocator cfg_allocator_;
   // See CFGMapTy.
   CFGMapTy cfgs_;
   const PropellerOptions options_;
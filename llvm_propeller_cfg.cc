@@ -1,13 +1,23 @@
 #include "llvm_propeller_cfg.h"
 
+#include <algorithm>
+#include <array>
 #include <memory>
+#include <new>
 #include <numeric>
 #include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "base/logging.h"
 
 namespace devtools_crosstool_autofdo {
+// CFGBuilder allocates nodes and edges in an arena, which never destroys them.
+static_assert(std::is_trivially_destructible<CFGNode>::value &&
+                  std::is_trivially_destructible<CFGEdge>::value,
+              "CFG nodes and edges must not own memory.");
+
 std::string CFGNode::GetName() const {
   std::string bb_name = cfg_->GetPrimaryName().str();
   if (!is_entry()) {
@@ -17,113 +27,246 @@ std::string CFGNode::GetName() const {
   return bb_name;
 }
 
-CFGEdge *ControlFlowGraph::CreateEdge(CFGNode *from, CFGNode *to,
-                                      uint64_t weight,
-                                      CFGEdge::Kind kind) {
-  auto edge = std::make_unique<CFGEdge>(from, to, weight, kind);
-  auto* ret = edge.get();
-  auto has_duplicates =
-      [from, to](const std::vector<std::unique_ptr<CFGEdge>> &edges) {
-        for (auto &e : edges)
-          if (e->src_ == from && e->sink_ == to) return true;
-        return false;
-      };
-  (void)(has_duplicates);  // For release build warning.
-  if (from->cfg() == to->cfg()) {
-    CHECK(!has_duplicates(intra_edges_));
-    from->intra_outs_.push_back(edge.get());
-    to->intra_ins_.push_back(edge.get());
-    intra_edges_.push_back(std::move(edge));
-  } else {
-    DCHECK(!has_duplicates(inter_edges_));
-    from->inter_outs_.push_back(edge.get());
-    to->inter_ins_.push_back(edge.get());
-    inter_edges_.push_back(std::move(edge));
-  }
-  return ret;
+CFGBuilder::NodeId CFGBuilder::AddNode(ControlFlowGraph *cfg,
+                                       uint64_t symbol_ordinal, uint64_t addr,
+                                       uint32_t bb_index, uint64_t size,
+                                       uint64_t freq) {
+  if (cfgs_.empty() || cfgs_.back().cfg != cfg)
+    cfgs_.push_back({cfg, static_cast<NodeId>(nodes_.size()), 0});
+  ++cfgs_.back().num_nodes;
+  node_cfgs_.push_back(cfgs_.size() - 1);
+  nodes_.emplace_back(symbol_ordinal, addr, bb_index, size, cfg, freq);
+  return nodes_.size() - 1;
 }
 
-void ControlFlowGraph::FinishCreatingControlFlowGraph() {
-  CalculateNodeFreqs();
-  CoalesceColdNodes();
+CFGBuilder::EdgeId CFGBuilder::AddEdge(NodeId from, NodeId to,
+                                       uint64_t weight, CFGEdge::Kind kind) {
+  edges_.push_back({from, to, weight, kind});
+  return edges_.size() - 1;
 }
 
-void ControlFlowGraph::CalculateNodeFreqs() {
-  if (nodes_.empty()) return;
-  auto sum_edge_weight = [](const std::vector<CFGEdge *> &edges) -> uint64_t {
-    return std::accumulate(
-        edges.begin(), edges.end(), 0,
-        [](uint64_t sum, const CFGEdge *edge) { return sum + edge->weight_; });
-  };
-  ForEachNodeRef([this, &sum_edge_weight](CFGNode &node) {
-    // A node (basic block) may have multiple outgoing calls to different
-    // functions. In that case, a single execution of that node counts toward
-    // the weight of each of its calls as wells as returns back to the
-    // callsites. To avoid double counting, we only consider the heaviest
-    // call-out and return-in towards calculating the node's frequency. This
-    // mitigates the case discussed in b/155488527 at the expense of possible
-    // underestimation. The underestimation may happen when these calls and
-    // returns occur in separate LBR stacks. Another source of underestimation
-    // is indirect calls. A node may only have one indirect call instruction,
-    // but if different functions are called by that indirect call, the node's
-    // frequency is equal to the aggregation of call-outs rather than their max.
-
+void CFGBuilder::CalculateNodeFreqs() {
+  // A node (basic block) may have multiple outgoing calls to different
+  // functions. In that case, a single execution of that node counts toward
+  // the weight of each of its calls as wells as returns back to the
+  // callsites. To avoid double counting, we only consider the heaviest
+  // call-out and return-in towards calculating the node's frequency. This
+  // mitigates the case discussed in b/155488527 at the expense of possible
+  // underestimation. The underestimation may happen when these calls and
+  // returns occur in separate LBR stacks. Another source of underestimation
+  // is indirect calls. A node may only have one indirect call instruction,
+  // but if different functions are called by that indirect call, the node's
+  // frequency is equal to the aggregation of call-outs rather than their max.
+  struct NodeWeights {
     uint64_t max_call_out = 0;
-    uint64_t max_ret_in = 0;
-
-    // Total incoming edge frequency to the node's entry (first instruction).
-    uint64_t sum_in = 0;
     // Total outgoing edge frequency from the node's exit (last instruction).
     uint64_t sum_out = 0;
+    // Total incoming edge frequency to the node's entry (first instruction).
+    uint64_t sum_in = 0;
+    // The return-in counted is the last one in the order of the in edges of
+    // the node: returns from the same function come after the ones from other
+    // functions.
+    uint64_t last_inter_ret_in = 0;
+    uint64_t last_intra_ret_in = 0;
+    bool has_intra_ret_in = false;
+  };
+  std::vector<NodeWeights> weights(nodes_.size());
+  for (const Edge &edge : edges_) {
+    NodeWeights &from = weights[edge.from];
+    if (edge.kind == CFGEdge::Kind::kCall)
+      from.max_call_out = std::max(from.max_call_out, edge.weight);
+    else
+      from.sum_out += edge.weight;
 
-    for (auto *out_edges : {&node.inter_outs_, &node.intra_outs_}) {
-      for (auto &edge : *out_edges) {
-        if (edge->IsCall())
-          max_call_out = std::max(max_call_out, edge->weight());
-        else
-          sum_out += edge->weight();
-      }
+    NodeWeights &to = weights[edge.to];
+    if (edge.kind != CFGEdge::Kind::kRet) {
+      to.sum_in += edge.weight;
+    } else if (node_cfgs_[edge.from] == node_cfgs_[edge.to]) {
+      to.last_intra_ret_in = edge.weight;
+      to.has_intra_ret_in = true;
+    } else {
+      to.last_inter_ret_in = edge.weight;
     }
+  }
+
+  for (const CfgNodes &cfg_nodes : cfgs_) {
+    bool hot = false;
+    NodeId entry = cfg_nodes.first_node;
+    for (NodeId id = cfg_nodes.first_node;
+         id < cfg_nodes.first_node + cfg_nodes.num_nodes; ++id) {
+      const NodeWeights &w = weights[id];
+      const uint64_t ret_in =
+          w.has_intra_ret_in ? w.last_intra_ret_in : w.last_inter_ret_in;
+      nodes_[id].set_freq(
+          std::max({w.max_call_out, ret_in, w.sum_out, w.sum_in}));
+      hot |= (nodes_[id].freq() != 0);
+      if (nodes_[id].symbol_ordinal() < nodes_[entry].symbol_ordinal())
+        entry = id;
+    }
+    // Make sure entry node has a non-zero frequency if function is hot.
+    if (hot && nodes_[entry].freq() == 0) nodes_[entry].set_freq(1);
+  }
+}
+
+void CFGBuilder::Build(bool calculate_freqs) {
+  const uint32_t num_nodes = nodes_.size();
+  const uint32_t num_edges = edges_.size();
+  if (calculate_freqs) CalculateNodeFreqs();
 
-    for (auto *in_edges : {&node.inter_ins_, &node.intra_ins_}) {
-      for (auto &edge : *in_edges) {
-        if (edge->IsReturn())
-          max_ret_in = std::max(max_call_out, edge->weight());
-        else
-          sum_in += edge->weight();
+  // Position of every node in the arena: CFGs are laid out in the order they
+  // were added and their nodes are sorted by ordinal. When frequencies are
+  // calculated, the cold nodes of every CFG are coalesced into its
+  // lowest-ordinal cold node, and the other ones get no position.
+  constexpr uint32_t kNoPosition = ~0U;
+  std::vector<uint32_t> node_positions(num_nodes, kNoPosition);
+  std::vector<uint32_t> cfg_positions(cfgs_.size() + 1);
+  std::vector<uint32_t> coalesced_cold_node_positions(cfgs_.size(),
+                                                      kNoPosition);
+  {
+    std::vector<bool> has_edges(num_nodes);
+    for (const Edge &edge : edges_)
+      has_edges[edge.from] = has_edges[edge.to] = true;
+    std::vector<NodeId> order(num_nodes);
+    std::iota(order.begin(), order.end(), 0);
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < cfgs_.size(); ++i) {
+      const CfgNodes &cfg_nodes = cfgs_[i];
+      auto begin = order.begin() + cfg_nodes.first_node;
+      auto end = begin + cfg_nodes.num_nodes;
+      std::sort(begin, end, [this](NodeId lhs, NodeId rhs) {
+        return nodes_[lhs].symbol_ordinal() < nodes_[rhs].symbol_ordinal();
+      });
+      cfg_positions[i] = position;
+      NodeId coalesced_cold_node = 0;
+      for (auto it = begin; it != end; ++it) {
+        CFGNode &n = nodes_[*it];
+        cfg_nodes.cfg->hot_tag_ |= (n.freq() != 0);
+        if (!calculate_freqs || n.freq()) {
+          node_positions[*it] = position++;
+          continue;
+        }
+        // Since all edges are created from profiles, that means, all edges
+        // must have weight > 0, which also means, if a node is cold
+        // (feq_ == 0), then the node must not have any edges.
+        CHECK(!has_edges[*it]);
+        if (coalesced_cold_node_positions[i] != kNoPosition) {
+          nodes_[coalesced_cold_node].GrowOnCoallesce(n.size());
+        } else {
+          coalesced_cold_node = *it;
+          coalesced_cold_node_positions[i] = position;
+          node_positions[*it] = position++;
+        }
       }
     }
+    cfg_positions[cfgs_.size()] = position;
+  }
+  const uint32_t num_positions = cfg_positions[cfgs_.size()];
 
-    node.set_freq(std::max({max_call_out, max_ret_in, sum_out, sum_in}));
+  // Position of every edge in the arena: the edges owned by each CFG are laid
+  // out in the order they were added, intra function edges first.
+  std::vector<uint32_t> num_intra_edges(cfgs_.size()), num_inter_edges(
+                                                           cfgs_.size());
+  for (const Edge &edge : edges_) {
+    if (node_cfgs_[edge.from] == node_cfgs_[edge.to])
+      ++num_intra_edges[node_cfgs_[edge.from]];
+    else
+      ++num_inter_edges[node_cfgs_[edge.from]];
+  }
+  std::vector<uint32_t> intra_edge_positions(cfgs_.size()),
+      inter_edge_positions(cfgs_.size());
+  for (uint32_t i = 0, position = 0; i < cfgs_.size(); ++i) {
+    intra_edge_positions[i] = position;
+    inter_edge_positions[i] = position + num_intra_edges[i];
+    position += num_intra_edges[i] + num_inter_edges[i];
+  }
 
-    this->hot_tag_ |= (node.freq() != 0);
-  });
-  // Make sure entry node has a non-zero frequency if function is hot.
-  if (this->hot_tag_ && GetEntryNode()->freq() == 0)
-    GetEntryNode()->set_freq(1);
-}
+  CFGNode *nodes = allocator_->Allocate<CFGNode>(num_positions);
+  CFGEdge *edges = allocator_->Allocate<CFGEdge>(num_edges);
+  CFGEdge **adjacency = allocator_->Allocate<CFGEdge *>(2 * num_edges);
 
-void ControlFlowGraph::CoalesceColdNodes() {
-  for (auto i = nodes_.begin(), j = nodes_.end(); i != j;) {
-    auto &n = *i;
-    if (n->freq()) {
-      ++i;
-      continue;
+  for (NodeId id = 0; id < num_nodes; ++id) {
+    if (node_positions[id] != kNoPosition)
+      new (&nodes[node_positions[id]]) CFGNode(nodes_[id]);
+  }
+  for (const Edge &edge : edges_) {
+    CFGNode &from = nodes[node_positions[edge.from]];
+    CFGNode &to = nodes[node_positions[edge.to]];
+    if (node_cfgs_[edge.from] == node_cfgs_[edge.to]) {
+      ++from.num_intra_outs_;
+      ++to.num_intra_ins_;
+    } else {
+      ++from.num_inter_outs_;
+      ++to.num_inter_ins_;
     }
-    // Since all edges are created from profiles, that means, all edges must
-    // have weight > 0, which also means, if a node is cold (feq_ == 0), then
-    // the node must not have any edges.
-    CHECK(n->intra_ins_.empty() && n->intra_outs_.empty() &&
-          n->inter_outs_.empty() && n->inter_ins_.empty());
-    if (coalesced_cold_node_ != nullptr) {
-      coalesced_cold_node_->GrowOnCoallesce(n->size());
-      i = nodes_.erase(i);
+  }
+  for (uint32_t i = 0, position = 0; i < num_positions; ++i) {
+    CFGNode &node = nodes[i];
+    node.edges_ = adjacency + position;
+    position += node.num_intra_outs_ + node.num_inter_outs_ +
+                node.num_intra_ins_ + node.num_inter_ins_;
+  }
+
+  // Number of edges already stored in each of the four adjacency lists of
+  // every node. Edges are stored in the order they were added.
+  std::vector<std::array<uint32_t, 4>> num_stored(num_positions);
+  for (const Edge &edge : edges_) {
+    const uint32_t from_position = node_positions[edge.from];
+    const uint32_t to_position = node_positions[edge.to];
+    CFGNode &from = nodes[from_position];
+    CFGNode &to = nodes[to_position];
+    CFGEdge *cfg_edge;
+    if (node_cfgs_[edge.from] == node_cfgs_[edge.to]) {
+      cfg_edge = &edges[intra_edge_positions[node_cfgs_[edge.from]]++];
+      from.edges_[num_stored[from_position][0]++] = cfg_edge;
+      to.edges_[to.num_intra_outs_ + to.num_inter_outs_ +
+                num_stored[to_position][2]++] = cfg_edge;
     } else {
-      coalesced_cold_node_ = n.get();
-      ++i;
+      cfg_edge = &edges[inter_edge_positions[node_cfgs_[edge.from]]++];
+      from.edges_[from.num_intra_outs_ + num_stored[from_position][1]++] =
+          cfg_edge;
+      to.edges_[to.num_intra_outs_ + to.num_inter_outs_ + to.num_intra_ins_ +
+                num_stored[to_position][3]++] = cfg_edge;
     }
+    new (cfg_edge) CFGEdge(&from, &to, edge.weight, edge.kind);
   }
+
+  // Check that no edge is duplicated. Every sink remembers the last node from
+  // which an edge reaches it, so this takes linear time in the number of edges.
+  std::vector<uint32_t> last_src_positions(num_positions, num_positions);
+  for (uint32_t i = 0; i < num_positions; ++i) {
+    for (llvm::ArrayRef<CFGEdge *> out_edges :
+         {nodes[i].intra_outs(), nodes[i].inter_outs()}) {
+      for (const CFGEdge *edge : out_edges) {
+        uint32_t &last_src_position = last_src_positions[edge->sink() - nodes];
+        CHECK_NE(last_src_position, i)
+            << "Duplicated edges from " << nodes[i].GetName() << " to "
+            << edge->sink()->GetName();
+        last_src_position = i;
+      }
+    }
+  }
+
+  // Attach the nodes and edges to their CFGs.
+  for (uint32_t i = 0, edge_position = 0; i < cfgs_.size(); ++i) {
+    ControlFlowGraph *cfg = cfgs_[i].cfg;
+    cfg->nodes_ = llvm::MutableArrayRef<CFGNode>(
+        nodes + cfg_positions[i], cfg_positions[i + 1] - cfg_positions[i]);
+    if (coalesced_cold_node_positions[i] != kNoPosition)
+      cfg->coalesced_cold_node_ = nodes + coalesced_cold_node_positions[i];
+    cfg->intra_edges_ =
+        llvm::ArrayRef<CFGEdge>(edges + edge_position, num_intra_edges[i]);
+    edge_position += num_intra_edges[i];
+    cfg->inter_edges_ =
+        llvm::ArrayRef<CFGEdge>(edges + edge_position, num_inter_edges[i]);
+    edge_position += num_inter_edges[i];
+  }
+
+  cfgs_.clear();
+  nodes_.clear();
+  node_cfgs_.clear();
+  edges_.clear();
 }
+
 std::ostream& operator<<(std::ostream& os, CFGEdge::Kind kind) {
   switch (kind) {
     case CFGEdge::Kind::kBranchOrFallthough:
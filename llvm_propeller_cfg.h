@@ -1,27 +1,31 @@
 #ifndef AUTOFDO_LLVM_PROPELLER_CFG_H_
 #define AUTOFDO_LLVM_PROPELLER_CFG_H_
 
+#include <cstdint>
 #include <cstdio>
 #include <memory>
 #include <numeric>
 #include <ostream>
-#include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "base/logging.h"  // For "CHECK".
 #include "llvm_propeller_bbsections.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
 
 namespace devtools_crosstool_autofdo {
 
 class CFGNode;
 class ControlFlowGraph;
 class CFGNodeBundle;
+class CFGBuilder;
 
-// All instances of CFGEdge are owned by their cfg_.
+// All instances of CFGEdge are owned by their cfg_ and allocated by a
+// CFGBuilder.
 class CFGEdge final {
  public:
   // Branch kind.
@@ -48,7 +52,7 @@ class CFGEdge final {
 
  private:
   friend class ControlFlowGraph;
-  friend class PropellerWholeProgramInfo;
+  friend class CFGBuilder;
 
   void IncrementWeight(uint64_t increment) { weight_ += increment; }
   void ReplaceSink(CFGNode *sink) { sink_ = sink; }
@@ -60,7 +64,8 @@ class CFGEdge final {
 
 std::ostream& operator<<(std::ostream& os, CFGEdge::Kind kind);
 
-// All instances of CFGNode are owned by their cfg_.
+// All instances of CFGNode are owned by their cfg_ and allocated by a
+// CFGBuilder.
 class CFGNode final {
  public:
   explicit CFGNode(uint64_t symbol_ordinal, uint64_t addr, uint64_t bb_index,
@@ -80,21 +85,35 @@ class CFGNode final {
   ControlFlowGraph* cfg() const { return cfg_; }
   CFGNodeBundle *bundle() const { return bundle_; }
 
-  const std::vector<CFGEdge *> &intra_outs() const { return intra_outs_; }
-  const std::vector<CFGEdge *> &intra_ins() const { return intra_ins_; }
-  const std::vector<CFGEdge *> &inter_outs() const { return inter_outs_; }
-  const std::vector<CFGEdge *> &inter_ins() const { return inter_ins_; }
+  llvm::ArrayRef<CFGEdge *> intra_outs() const {
+    return {edges_, num_intra_outs_};
+  }
+  llvm::ArrayRef<CFGEdge *> inter_outs() const {
+    return {edges_ + num_intra_outs_, num_inter_outs_};
+  }
+  llvm::ArrayRef<CFGEdge *> intra_ins() const {
+    return {edges_ + num_intra_outs_ + num_inter_outs_, num_intra_ins_};
+  }
+  llvm::ArrayRef<CFGEdge *> inter_ins() const {
+    return {edges_ + num_intra_outs_ + num_inter_outs_ + num_intra_ins_,
+            num_inter_ins_};
+  }
 
   template <class Visitor>
   void ForEachInEdgeRef(Visitor v) {
-    for (auto &edgeList : {intra_ins_, inter_ins_})
-      for (CFGEdge *E : edgeList) v(*E);
+    // intra_ins and inter_ins are adjacent.
+    for (CFGEdge *E : llvm::ArrayRef<CFGEdge *>(
+             edges_ + num_intra_outs_ + num_inter_outs_,
+             num_intra_ins_ + num_inter_ins_))
+      v(*E);
   }
 
   template <class Visitor>
   void ForEachOutEdgeRef(Visitor v) {
-    for (auto &edgeList : {intra_outs_, inter_outs_})
-      for (CFGEdge *E : edgeList) v(*E);
+    // intra_outs and inter_outs are adjacent.
+    for (CFGEdge *E :
+         llvm::ArrayRef<CFGEdge *>(edges_, num_intra_outs_ + num_inter_outs_))
+      v(*E);
   }
   bool is_entry() const { return bb_index_ == 0; }
 
@@ -103,6 +122,7 @@ class CFGNode final {
  private:
   friend class ControlFlowGraph;
   friend class CFGNodeBundle;
+  friend class CFGBuilder;
 
   void GrowOnCoallesce(uint64_t size_increment) { size_ += size_increment; }
 
@@ -121,24 +141,18 @@ class CFGNode final {
   uint64_t size_ = 0;
   ControlFlowGraph * const cfg_;
 
-  std::vector<CFGEdge *> intra_outs_ = {};  // Intra function edges.
-  std::vector<CFGEdge *> intra_ins_ = {};   // Intra function edges.
-  std::vector<CFGEdge *> inter_outs_ = {};  // Calls to other functions.
-  std::vector<CFGEdge *> inter_ins_ = {};   // Returns from other functions.
+  // The edges of the node, in a slice of the adjacency array of its CFGBuilder:
+  // intra function out edges, calls to other functions, intra function in
+  // edges and returns from other functions, in this order.
+  CFGEdge **edges_ = nullptr;
+  uint32_t num_intra_outs_ = 0;
+  uint32_t num_inter_outs_ = 0;
+  uint32_t num_intra_ins_ = 0;
+  uint32_t num_inter_ins_ = 0;
 
   CFGNodeBundle *bundle_ = nullptr;
 };
 
-struct CFGNodeUniquePtrLessComparator {
-  bool operator()(const std::unique_ptr<CFGNode> &a,
-                  const std::unique_ptr<CFGNode> &b) const {
-    if (!a && b) return true;
-    if (a && !b) return false;
-    if (!a && !b) return false;
-    return a->symbol_ordinal() < b->symbol_ordinal();
-  }
-};
-
 class ControlFlowGraph {
  public:
   explicit ControlFlowGraph(const llvm::SmallVectorImpl<llvm::StringRef> &names)
@@ -148,7 +162,7 @@ class ControlFlowGraph {
 
   CFGNode *GetEntryNode() const {
     CHECK(!nodes_.empty());
-    return nodes_.begin()->get();
+    return &nodes_.front();
   }
 
   llvm::StringRef GetPrimaryName() const {
@@ -163,90 +177,107 @@ class ControlFlowGraph {
 
   template <class Visitor>
   void ForEachNodeRef(Visitor v) {
-    for (auto &N : nodes_) v(*N);
+    for (CFGNode &N : nodes_) v(N);
   }
 
   bool WriteAsDotGraph(llvm::StringRef cfgOutName);
 
-  // Create node and take ownership.
-  void CreateNodes(const std::vector<SymbolEntry *> &syms) {
-    DCHECK(nodes_.empty());
-    CHECK_NE(syms[0]->func_ptr, syms[0]);
-
-    // This is for bbaddressmap workflow, the function symbol is excluded from
-    // "syms" vector, all symbols contains in "syms" are basic block symbols.
-    // bbindex starts from 0.
-    int bbidx = 0;
-    for (SymbolEntry *s : syms)
-      nodes_.emplace(
-          new CFGNode(s->ordinal, s->addr, bbidx++, s->size, this));
-  }
-
-  // Create edge and take ownership. Note: the caller must be responsible for
-  // not creating duplicated edges.
-  CFGEdge *CreateEdge(CFGNode *from, CFGNode *to, uint64_t weight,
-                      CFGEdge::Kind kind);
-
-  void FinishCreatingControlFlowGraph();
-
   const llvm::SmallVectorImpl<llvm::StringRef> &names() const {
     return names_;
   }
-  const std::set<std::unique_ptr<CFGNode>, CFGNodeUniquePtrLessComparator>
-      &nodes() const {
-    return nodes_;
-  }
+  llvm::MutableArrayRef<CFGNode> nodes() const { return nodes_; }
 
-  const std::vector<std::unique_ptr<CFGEdge>> &intra_edges() const {
-    return intra_edges_;
-  }
+  llvm::ArrayRef<CFGEdge> intra_edges() const { return intra_edges_; }
 
-  const std::vector<std::unique_ptr<CFGEdge>> &inter_edges() const {
-    return inter_edges_;
-  }
-
-  // APIs for test purposes.
-  static std::unique_ptr<ControlFlowGraph> CreateForTest() {
-    return std::make_unique<ControlFlowGraph>(
-        llvm::SmallVector<llvm::StringRef, 4>());
-  }
-
-  CFGNode *InsertNodeForTest(std::unique_ptr<CFGNode> node) {
-    return nodes_.insert(std::move(node)).first->get();
-  }
+  llvm::ArrayRef<CFGEdge> inter_edges() const { return inter_edges_; }
 
   const CFGNode* GetCoallescedColdNodeForTest() const {
     return coalesced_cold_node_;
   }
 
  private:
-  friend class MockPropellerWholeProgramInfo;
+  friend class CFGBuilder;
   friend class PropellerProfWriter;
 
-  void CalculateNodeFreqs();
-
-  void CoalesceColdNodes();
-
   bool hot_tag_ = false;
   // Function names associated with this CFG: The first name is the primary
   // function name and the rest are aliases. The primary name is necessary.
   llvm::SmallVector<llvm::StringRef, 3> names_;
 
   // All cold nodes (and their edges) are coalesced into the lowest-ordinal cold
-  // node by CoalesceColdNodes. This remains null if all nodes are hot.
+  // node by CFGBuilder. This remains null if all nodes are hot.
   CFGNode* coalesced_cold_node_ = nullptr;
 
-  // CFGs own all nodes. Nodes here are *strictly* sorted by addresses /
-  // ordinals.
-  std::set<std::unique_ptr<CFGNode>, CFGNodeUniquePtrLessComparator> nodes_;
-
-  // CFGs own all edges. All edges are owned by their src's CFGs and they
-  // appear exactly once in one of the following two fields. The src and sink
-  // nodes of each edge contain a pointer to the edge, which means, each edge is
-  // recorded exactly twice in Nodes' inter_ins_, inter_outs, intra_ints or
-  // intra_out_.
-  std::vector<std::unique_ptr<CFGEdge>> intra_edges_;
-  std::vector<std::unique_ptr<CFGEdge>> inter_edges_;
+  // Nodes of this CFG, contiguous in the arena of its CFGBuilder. Nodes here
+  // are *strictly* sorted by addresses / ordinals.
+  llvm::MutableArrayRef<CFGNode> nodes_;
+
+  // Edges owned by this CFG, contiguous in the arena of its CFGBuilder. All
+  // edges are owned by their src's CFGs and they appear exactly once in one of
+  // the following two fields. The src and sink nodes of each edge contain a
+  // pointer to the edge, which means, each edge is recorded exactly twice in
+  // the nodes' adjacency lists.
+  llvm::ArrayRef<CFGEdge> intra_edges_;
+  llvm::ArrayRef<CFGEdge> inter_edges_;
+};
+
+// Builds the nodes and edges of a set of CFGs at once. Nodes and edges are
+// first recorded, and Build() then allocates them in an arena: the nodes of
+// every CFG are contiguous and sorted by ordinal, the edges owned by every CFG
+// are contiguous, and the adjacency lists of all nodes are consecutive slices
+// of a single array. The arena must outlive the CFGs.
+class CFGBuilder {
+ public:
+  // Nodes and edges are identified by the order in which they are added.
+  using NodeId = uint32_t;
+  using EdgeId = uint32_t;
+
+  explicit CFGBuilder(llvm::BumpPtrAllocator *allocator)
+      : allocator_(allocator) {}
+
+  // Adds a node to CFG. All the nodes of a CFG must be added consecutively.
+  NodeId AddNode(ControlFlowGraph *cfg, uint64_t symbol_ordinal, uint64_t addr,
+                 uint32_t bb_index, uint64_t size, uint64_t freq = 0);
+
+  // Adds an edge from FROM to TO, owned by the CFG of FROM. The caller must be
+  // responsible for not adding duplicated edges, which Build() CHECKs.
+  EdgeId AddEdge(NodeId from, NodeId to, uint64_t weight, CFGEdge::Kind kind);
+
+  CFGEdge::Kind edge_kind(EdgeId edge) const { return edges_[edge].kind; }
+  void IncrementEdgeWeight(EdgeId edge, uint64_t increment) {
+    edges_[edge].weight += increment;
+  }
+
+  // Allocates the nodes and edges of all CFGs, which are not accessible
+  // before. If "calculate_freqs" is true, node frequencies are calculated from
+  // the edge weights and the cold nodes of every CFG are coalesced into one.
+  // Otherwise, the frequencies given to AddNode are kept. The builder must not
+  // be used afterwards.
+  void Build(bool calculate_freqs);
+
+ private:
+  struct CfgNodes {
+    ControlFlowGraph *cfg;
+    NodeId first_node;
+    uint32_t num_nodes;
+  };
+  struct Edge {
+    NodeId from;
+    NodeId to;
+    uint64_t weight;
+    CFGEdge::Kind kind;
+  };
+
+  // Sets the frequency of every node from the weights of its edges, and makes
+  // sure the entry node of every hot CFG has a non-zero frequency.
+  void CalculateNodeFreqs();
+
+  llvm::BumpPtrAllocator *allocator_;
+  std::vector<CfgNodes> cfgs_;
+  std::vector<CFGNode> nodes_;
+  // Index of the CFG of every node in cfgs_.
+  std::vector<uint32_t> node_cfgs_;
+  std::vector<Edge> edges_;
 };
 }  // namespace devtools_crosstool_autofdo
 #endif  // AUTOFDO_LLVM_PROPELLER_CFG_H_
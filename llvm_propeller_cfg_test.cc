@@ -0,0 +1,139 @@
+#include "llvm_propeller_cfg.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+
+namespace {
+
+using ::devtools_crosstool_autofdo::CFGBuilder;
+using ::devtools_crosstool_autofdo::CFGEdge;
+using ::devtools_crosstool_autofdo::CFGNode;
+using ::devtools_crosstool_autofdo::ControlFlowGraph;
+
+std::vector<uint64_t> GetOrdinals(const ControlFlowGraph &cfg) {
+  std::vector<uint64_t> ordinals;
+  for (const CFGNode &node : cfg.nodes())
+    ordinals.push_back(node.symbol_ordinal());
+  return ordinals;
+}
+
+// Returns the node of "cfg" with "ordinal", or nullptr.
+const CFGNode *GetNode(const ControlFlowGraph &cfg, uint64_t ordinal) {
+  for (const CFGNode &node : cfg.nodes())
+    if (node.symbol_ordinal() == ordinal) return &node;
+  return nullptr;
+}
+
+TEST(CFGBuilderTest, CoalescesColdNodes) {
+  llvm::BumpPtrAllocator allocator;
+  ControlFlowGraph foo(llvm::SmallVector<llvm::StringRef, 1>{"foo"});
+  ControlFlowGraph bar(llvm::SmallVector<llvm::StringRef, 1>{"bar"});
+  ControlFlowGraph baz(llvm::SmallVector<llvm::StringRef, 1>{"baz"});
+
+  // Nodes are added out of ordinal order, and the size of every node is ten
+  // times its ordinal.
+  CFGBuilder builder(&allocator);
+  auto add_node = [&builder](ControlFlowGraph *cfg, uint64_t ordinal,
+                             uint32_t bb_index) {
+    return builder.AddNode(cfg, ordinal, 0x1000 + ordinal * 0x10, bb_index,
+                           10 * ordinal);
+  };
+  add_node(&foo, 3, 2);
+  const CFGBuilder::NodeId foo1 = add_node(&foo, 1, 0);
+  add_node(&foo, 5, 4);
+  const CFGBuilder::NodeId foo2 = add_node(&foo, 2, 1);
+  const CFGBuilder::NodeId foo4 = add_node(&foo, 4, 3);
+  const CFGBuilder::NodeId bar9 = add_node(&bar, 9, 3);
+  add_node(&bar, 8, 2);
+  add_node(&bar, 7, 1);
+  const CFGBuilder::NodeId bar6 = add_node(&bar, 6, 0);
+  add_node(&baz, 11, 1);
+  add_node(&baz, 10, 0);
+
+  builder.AddEdge(foo1, foo2, 10, CFGEdge::Kind::kBranchOrFallthough);
+  builder.AddEdge(foo2, bar6, 7, CFGEdge::Kind::kCall);
+  builder.AddEdge(foo2, foo4, 10, CFGEdge::Kind::kBranchOrFallthough);
+  builder.AddEdge(bar6, bar9, 7, CFGEdge::Kind::kBranchOrFallthough);
+  builder.AddEdge(bar9, foo2, 7, CFGEdge::Kind::kRet);
+  builder.Build(/*calculate_freqs=*/true);
+
+  // All nodes are in one array, sorted by ordinal in every CFG, and the cold
+  // nodes of a CFG are coalesced into its first cold node.
+  EXPECT_EQ(GetOrdinals(foo), std::vector<uint64_t>({1, 2, 3, 4}));
+  EXPECT_EQ(GetOrdinals(bar), std::vector<uint64_t>({6, 7, 9}));
+  EXPECT_EQ(GetOrdinals(baz), std::vector<uint64_t>({10}));
+  EXPECT_EQ(bar.nodes().data(), foo.nodes().data() + foo.nodes().size());
+  EXPECT_EQ(baz.nodes().data(), bar.nodes().data() + bar.nodes().size());
+
+  ASSERT_EQ(foo.GetCoallescedColdNodeForTest(), GetNode(foo, 3));
+  EXPECT_EQ(foo.GetCoallescedColdNodeForTest()->size(), 30 + 50);
+  EXPECT_EQ(foo.GetCoallescedColdNodeForTest()->freq(), 0);
+  ASSERT_EQ(bar.GetCoallescedColdNodeForTest(), GetNode(bar, 7));
+  EXPECT_EQ(bar.GetCoallescedColdNodeForTest()->size(), 70 + 80);
+  ASSERT_EQ(baz.GetCoallescedColdNodeForTest(), GetNode(baz, 10));
+  EXPECT_EQ(baz.GetCoallescedColdNodeForTest()->size(), 100 + 110);
+  EXPECT_TRUE(foo.IsHot());
+  EXPECT_TRUE(bar.IsHot());
+  EXPECT_FALSE(baz.IsHot());
+
+  const CFGNode *n1 = GetNode(foo, 1), *n2 = GetNode(foo, 2),
+                *n4 = GetNode(foo, 4), *n6 = GetNode(bar, 6),
+                *n9 = GetNode(bar, 9);
+  ASSERT_NE(n1, nullptr);
+  ASSERT_NE(n2, nullptr);
+  ASSERT_NE(n4, nullptr);
+  ASSERT_NE(n6, nullptr);
+  ASSERT_NE(n9, nullptr);
+  EXPECT_EQ(n1->freq(), 10);
+  EXPECT_EQ(n2->freq(), 10);
+  EXPECT_EQ(n6->freq(), 7);
+
+  // Every CFG owns its intra function edges, then its calls and returns.
+  ASSERT_EQ(foo.intra_edges().size(), 2);
+  ASSERT_EQ(foo.inter_edges().size(), 1);
+  ASSERT_EQ(bar.intra_edges().size(), 1);
+  ASSERT_EQ(bar.inter_edges().size(), 1);
+  EXPECT_TRUE(baz.intra_edges().empty());
+  EXPECT_TRUE(baz.inter_edges().empty());
+  const CFGEdge &e12 = foo.intra_edges()[0], &e24 = foo.intra_edges()[1],
+                &call = foo.inter_edges()[0], &e69 = bar.intra_edges()[0],
+                &ret = bar.inter_edges()[0];
+  EXPECT_EQ(e12.src(), n1);
+  EXPECT_EQ(e12.sink(), n2);
+  EXPECT_EQ(e24.src(), n2);
+  EXPECT_EQ(e24.sink(), n4);
+  EXPECT_EQ(call.src(), n2);
+  EXPECT_EQ(call.sink(), n6);
+  EXPECT_TRUE(call.IsCall());
+  EXPECT_EQ(e69.src(), n6);
+  EXPECT_EQ(e69.sink(), n9);
+  EXPECT_EQ(ret.src(), n9);
+  EXPECT_EQ(ret.sink(), n2);
+  EXPECT_TRUE(ret.IsReturn());
+
+  // The adjacency lists of every node point to the edges above.
+  using EdgeList = std::vector<const CFGEdge *>;
+  auto edge_list = [](llvm::ArrayRef<CFGEdge *> edges) {
+    return EdgeList(edges.begin(), edges.end());
+  };
+  EXPECT_EQ(edge_list(n2->intra_outs()), EdgeList({&e24}));
+  EXPECT_EQ(edge_list(n2->inter_outs()), EdgeList({&call}));
+  EXPECT_EQ(edge_list(n2->intra_ins()), EdgeList({&e12}));
+  EXPECT_EQ(edge_list(n2->inter_ins()), EdgeList({&ret}));
+  EXPECT_EQ(edge_list(n6->inter_ins()), EdgeList({&call}));
+  EXPECT_EQ(edge_list(n6->intra_outs()), EdgeList({&e69}));
+  EXPECT_EQ(edge_list(n9->inter_outs()), EdgeList({&ret}));
+  for (const ControlFlowGraph *cfg : {&foo, &bar, &baz}) {
+    const CFGNode *cold = cfg->GetCoallescedColdNodeForTest();
+    EXPECT_TRUE(cold->intra_outs().empty() && cold->inter_outs().empty() &&
+                cold->intra_ins().empty() && cold->inter_ins().empty());
+  }
+}
+
+}  // namespace
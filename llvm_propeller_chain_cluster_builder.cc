@@ -1,16 +1,96 @@
 #include "llvm_propeller_chain_cluster_builder.h"
 
+#include <algorithm>
+
 #include "llvm_propeller_cfg.h"
 #include "llvm_propeller_node_chain.h"
 
 namespace devtools_crosstool_autofdo {
 
+namespace {
+// A cluster is not merged into its predecessor cluster if its execution
+// density is less than 1/kMaxDensityDegradation of the predecessor's.
+constexpr uint64_t kMaxDensityDegradation = 8;
+}  // namespace
+
+NodeChain *ChainClusterBuilder::GetMostLikelyPredecessor(
+    NodeChain &chain) const {
+  // Total weight of call edges from every caller chain into 'chain'.
+  absl::flat_hash_map<NodeChain *, uint64_t> caller_weights;
+  chain.VisitEachNodeRef([&](CFGNode &node) {
+    for (CFGEdge *edge : node.inter_ins()) {
+      if (!edge->IsCall() || edge->weight() == 0) continue;
+      NodeChain *caller_chain = GetNodeChain(edge->src());
+      if (caller_chain == nullptr || caller_chain == &chain ||
+          !chain_to_cluster_map_.contains(caller_chain))
+        continue;
+      caller_weights[caller_chain] += edge->weight();
+    }
+  });
+
+  NodeChain *best_pred = nullptr;
+  uint64_t best_weight = 0;
+  for (const auto &[caller_chain, weight] : caller_weights) {
+    if (weight > best_weight ||
+        (weight == best_weight && caller_chain->id() < best_pred->id())) {
+      best_pred = caller_chain;
+      best_weight = weight;
+    }
+  }
+  return best_pred;
+}
+
+void ChainClusterBuilder::MergeClusters(ChainCluster &pred_cluster,
+                                        ChainCluster &cluster) {
+  for (auto &chain : cluster.chains)
+    chain_to_cluster_map_[chain.get()] = &pred_cluster;
+  pred_cluster.MergeWith(cluster);
+  clusters_.erase(cluster.id());
+}
+
 // This function builds clusters of node chains and returns them in a vector.
 // After this is called, all clusters are moved to the this vector and the
 // clusters_ map becomes empty.
+//
+// Clusters are merged following the call-chain clustering (C3) heuristic
+// (https://dl.acm.org/doi/10.5555/3049832.3049858): every cluster is visited
+// in decreasing order of execution density and is appended to the cluster of
+// its most likely caller, as long as the merged cluster does not exceed
+// max_cluster_size and the density does not degrade too much.
 std::vector<std::unique_ptr<ChainCluster>>
 ChainClusterBuilder::BuildClusters() {
-  // TODO(rahmanl) Implement MergeClusters Ref: b/154756435.
+  // Find the most likely predecessor of every chain before any merging. This
+  // also fixes the order in which clusters are visited.
+  absl::flat_hash_map<NodeChain *, NodeChain *> pred_chains;
+  std::vector<ChainCluster *> sorted_clusters;
+  for (auto &[unused, cluster] : clusters_) {
+    sorted_clusters.push_back(cluster.get());
+    if (NodeChain *pred = GetMostLikelyPredecessor(*cluster->delegate_chain))
+      pred_chains.emplace(cluster->delegate_chain, pred);
+  }
+  std::sort(sorted_clusters.begin(), sorted_clusters.end(),
+            [](const ChainCluster *a, const ChainCluster *b) {
+              if (a->exec_density() != b->exec_density())
+                return a->exec_density() > b->exec_density();
+              return a->id() < b->id();
+            });
+
+  for (ChainCluster *cluster : sorted_clusters) {
+    // Every cluster is only merged into another when it is visited, so it is
+    // still alive here.
+    auto pred_it = pred_chains.find(cluster->delegate_chain);
+    if (pred_it == pred_chains.end()) continue;
+    ChainCluster *pred_cluster = chain_to_cluster_map_.at(pred_it->second);
+    if (pred_cluster == cluster) continue;
+    if (pred_cluster->size + cluster->size >
+        code_layout_params_.max_cluster_size())
+      continue;
+    if (cluster->exec_density() * kMaxDensityDegradation <
+        pred_cluster->exec_density())
+      continue;
+    MergeClusters(*pred_cluster, *cluster);
+  }
+
   std::vector<std::unique_ptr<ChainCluster>> built_clusters;
   for (auto &elem : clusters_)
     built_clusters.push_back(std::move(elem.second));
@@ -1,10 +1,13 @@
 #ifndef AUTOFDO_LLVM_PROPELLER_CHAIN_CLUSTER_BUILDER_H_
 #define AUTOFDO_LLVM_PROPELLER_CHAIN_CLUSTER_BUILDER_H_
 
+#include <iterator>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
 #include "llvm_propeller_node_chain.h"
+#include "llvm_propeller_options.pb.h"
 #include "third_party/abseil/absl/container/flat_hash_map.h"
 #include "third_party/abseil/absl/container/node_hash_map.h"
 
@@ -38,6 +41,16 @@ struct ChainCluster {
     chains.push_back(std::move(chain));
   }
 
+  // Moves all chains of 'other' to the end of this cluster and updates the
+  // size and frequency accordingly. 'other' is left empty.
+  void MergeWith(ChainCluster &other) {
+    std::move(other.chains.begin(), other.chains.end(),
+              std::back_inserter(chains));
+    other.chains.clear();
+    size += other.size;
+    freq += other.freq;
+  }
+
   // Helper method for iterating over all nodes in this cluster (in order).
   // Its Argument v is a function with CFGNode* as its single argument.
   template <class Visitor>
@@ -51,8 +64,9 @@ class ChainClusterBuilder {
   // ChainClusterBuilder constructor: This initializes one cluster per each
   // chain and transfers the ownership of the NodeChain pointer to their
   // associated clusters.
-  explicit ChainClusterBuilder(
-      std::vector<std::unique_ptr<NodeChain>> &&chains) {
+  ChainClusterBuilder(const PropellerCodeLayoutParameters &code_layout_params,
+                      std::vector<std::unique_ptr<NodeChain>> &&chains)
+      : code_layout_params_(code_layout_params) {
     for (auto &c_ptr : chains) {
       // Transfer the ownership of chains to clusters
       ChainCluster *cluster = new ChainCluster(std::move(c_ptr));
@@ -63,9 +77,13 @@ class ChainClusterBuilder {
     chains.clear();
   }
 
+  // Merges the clusters based on the call graph and returns them in a
+  // vector.
   std::vector<std::unique_ptr<ChainCluster>> BuildClusters();
 
  private:
+  const PropellerCodeLayoutParameters code_layout_params_;
+
   // All clusters currently in process.
   absl::flat_hash_map<uint64_t, std::unique_ptr<ChainCluster>> clusters_;
 
@@ -73,6 +91,13 @@ class ChainClusterBuilder {
   // TODO(b/160191690): Remove node_hash_map before create_llvm_prof upstream
   // release to remove the dependency on absl.
   absl::flat_hash_map<NodeChain *, ChainCluster *> chain_to_cluster_map_;
+
+  // Returns the chain which has the heaviest call edges into 'chain', or
+  // nullptr if 'chain' is not called from any other chain.
+  NodeChain *GetMostLikelyPredecessor(NodeChain &chain) const;
+
+  // Merges 'cluster' into the end of 'pred_cluster' and removes 'cluster'.
+  void MergeClusters(ChainCluster &pred_cluster, ChainCluster &cluster);
 };
 
 }  // namespace devtools_crosstool_autofdo
@@ -1,8 +1,11 @@
 #include "llvm_propeller_code_layout.h"
 
 #include <algorithm>
+#include <atomic>
 #include <iterator>
 #include <memory>
+#include <numeric>
+#include <thread>  // NOLINT(build/c++11)
 #include <tuple>
 #include <unordered_map>
 #include <utility>
@@ -26,19 +29,19 @@ CFGScoreMapTy CodeLayout::ComputeCfgScores(
   CFGScoreMapTy score_map;
   for (const ControlFlowGraph *cfg : cfgs_) {
     uint64_t intra_score = 0;
-    for (const auto &edge : cfg->intra_edges()) {
-      if (edge->weight() == 0) continue;
+    for (const CFGEdge &edge : cfg->intra_edges()) {
+      if (edge.weight() == 0) continue;
       // Compute the distance between the end of src and beginning of sink.
-      int64_t distance = static_cast<int64_t>(get_node_addr(edge->sink())) -
-                         get_node_addr(edge->src()) - edge->src()->size();
-      intra_score += code_layout_scorer_.GetEdgeScore(*edge, distance);
+      int64_t distance = static_cast<int64_t>(get_node_addr(edge.sink())) -
+                         get_node_addr(edge.src()) - edge.src()->size();
+      intra_score += code_layout_scorer_.GetEdgeScore(edge, distance);
     }
     uint64_t inter_out_score = 0;
-    for (const auto &edge : cfg->inter_edges()) {
-      if (edge->weight() == 0 || edge->IsReturn()) continue;
-      int64_t distance = static_cast<int64_t>(get_node_addr(edge->sink())) -
-                         get_node_addr(edge->src()) - edge->src()->size();
-      inter_out_score += code_layout_scorer_.GetEdgeScore(*edge, distance);
+    for (const CFGEdge &edge : cfg->inter_edges()) {
+      if (edge.weight() == 0 || edge.IsReturn()) continue;
+      int64_t distance = static_cast<int64_t>(get_node_addr(edge.sink())) -
+                         get_node_addr(edge.src()) - edge.src()->size();
+      inter_out_score += code_layout_scorer_.GetEdgeScore(edge, distance);
     }
     score_map.emplace(cfg, CFGScore({intra_score, inter_out_score}));
   }
@@ -73,19 +76,53 @@ CFGScoreMapTy CodeLayout::ComputeOptLayoutScores(
 CodeLayoutResult CodeLayout::OrderAll() {
   // Build optimal node chains for eac CFG.
   // TODO(rahmanl) Call NodeChainBuilder(cfgs_).BuildChains() for interp
+  std::vector<std::vector<std::unique_ptr<NodeChain>>> chains_per_cfg(
+      cfgs_.size());
+  const unsigned jobs =
+      std::max(1U, std::min<unsigned>(jobs_, cfgs_.size()));
+  if (jobs == 1) {
+    for (int i = 0; i < cfgs_.size(); ++i)
+      chains_per_cfg[i] =
+          NodeChainBuilder(code_layout_scorer_, cfgs_[i]).BuildChains();
+  } else {
+    // The CFGs are chained independently. Every job repeatedly takes the
+    // largest CFG left, so that a large CFG does not start last and delay
+    // the whole layout.
+    std::vector<int> order(cfgs_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](int lhs, int rhs) {
+      return cfgs_[lhs]->nodes().size() > cfgs_[rhs]->nodes().size();
+    });
+    std::atomic<int> next{0};
+    std::vector<std::thread> threads;
+    for (unsigned job = 0; job < jobs; ++job) {
+      threads.emplace_back([&] {
+        for (int i = next++; i < order.size(); i = next++)
+          chains_per_cfg[order[i]] =
+              NodeChainBuilder(code_layout_scorer_, cfgs_[order[i]])
+                  .BuildChains();
+      });
+    }
+    for (std::thread &t : threads) t.join();
+  }
+  // Gather the chains in the order of CFGs, independently of the number of
+  // jobs.
   std::vector<std::unique_ptr<NodeChain>> built_chains;
-  for (auto *cfg : cfgs_) {
-    auto chains = NodeChainBuilder(code_layout_scorer_, cfg).BuildChains();
+  for (auto &chains : chains_per_cfg)
     std::move(chains.begin(), chains.end(), std::back_inserter(built_chains));
-  }
   // Further cluster the constructed chains to get the global order of all
   // nodes.
-  auto clusters = ChainClusterBuilder(std::move(built_chains)).BuildClusters();
-
-  // Order clusters consistent with the original ordering.
-  // TODO(rahmanl): Order clusters in decreasing order of their exec density.
-  absl::c_sort(clusters,
-            [](auto &lhs, auto &rhs) { return lhs->id() < rhs->id(); });
+  auto clusters =
+      ChainClusterBuilder(code_layout_params_, std::move(built_chains))
+          .BuildClusters();
+
+  // Order clusters in decreasing order of their exec density. Ties are broken
+  // by the original ordering.
+  absl::c_sort(clusters, [](auto &lhs, auto &rhs) {
+    if (lhs->exec_density() != rhs->exec_density())
+      return lhs->exec_density() > rhs->exec_density();
+    return lhs->id() < rhs->id();
+  });
 
   CFGScoreMapTy orig_score_map = ComputeOrigLayoutScores();
   CFGScoreMapTy opt_score_map = ComputeOptLayoutScores(clusters);
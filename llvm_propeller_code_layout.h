@@ -63,18 +63,27 @@ using CodeLayoutResult = std::unordered_map<uint64_t, FuncLayoutClusterInfo>;
 
 class CodeLayout {
  public:
+  // The basic blocks of the CFGs are chained on up to "jobs" threads.
   explicit CodeLayout(const PropellerCodeLayoutParameters &code_layout_params,
-                      const std::vector<ControlFlowGraph *> &cfgs)
-      : code_layout_scorer_(code_layout_params), cfgs_(cfgs) {}
+                      const std::vector<ControlFlowGraph *> &cfgs,
+                      unsigned jobs = 1)
+      : code_layout_params_(code_layout_params),
+        code_layout_scorer_(code_layout_params),
+        cfgs_(cfgs),
+        jobs_(jobs) {}
 
   // This performs code layout on all hot cfgs in the prop_prof_writer instance
   // and returns the global order information for all function.
+  // The result does not depend on the number of jobs.
   CodeLayoutResult OrderAll();
 
  private:
+  const PropellerCodeLayoutParameters code_layout_params_;
   const PropellerCodeLayoutScorer code_layout_scorer_;
   // CFGs targeted for code layout.
   const std::vector<ControlFlowGraph *> cfgs_;
+  // Maximum number of threads building node chains.
+  const unsigned jobs_;
 
   // Returns the intra-procedural ext-tsp scores for the given CFGs given a
   // function for getting the address of each CFG node.
@@ -98,67 +98,67 @@ TEST(CodeLayoutScorerTest, GetEdgeScore) {
 
   ASSERT_EQ(bar_cfg.inter_edges().size(), 1);
   {
-    const auto &call_edge = bar_cfg.inter_edges().front();
-    ASSERT_TRUE(call_edge->IsCall());
-    ASSERT_NE(call_edge->weight(), 0);
-    ASSERT_NE(call_edge->src()->size(), 0);
+    const CFGEdge &call_edge = bar_cfg.inter_edges().front();
+    ASSERT_TRUE(call_edge.IsCall());
+    ASSERT_NE(call_edge.weight(), 0);
+    ASSERT_NE(call_edge.src()->size(), 0);
     // Score with negative src-to-sink distance (backward call).
     // Check that for calls, half of src size is always added to the distance.
-    EXPECT_EQ(scorer.GetEdgeScore(*call_edge, -10),
-              call_edge->weight() * 1 * 200 *
-                  (100 - 10 + call_edge->src()->size() / 2));
+    EXPECT_EQ(scorer.GetEdgeScore(call_edge, -10),
+              call_edge.weight() * 1 * 200 *
+                  (100 - 10 + call_edge.src()->size() / 2));
     // Score with zero src-to-sink distance (forward call).
     EXPECT_EQ(
-        scorer.GetEdgeScore(*call_edge, 0),
-        call_edge->weight() * 2 * 100 * (200 - call_edge->src()->size() / 2));
+        scorer.GetEdgeScore(call_edge, 0),
+        call_edge.weight() * 2 * 100 * (200 - call_edge.src()->size() / 2));
     // Score with positive src-to-sink distance (forward call).
-    EXPECT_EQ(scorer.GetEdgeScore(*call_edge, 20),
-              call_edge->weight() * 2 * 100 *
-                  (200 - 20 - call_edge->src()->size() / 2));
+    EXPECT_EQ(scorer.GetEdgeScore(call_edge, 20),
+              call_edge.weight() * 2 * 100 *
+                  (200 - 20 - call_edge.src()->size() / 2));
     // Score must be zero when beyond the src-to-sink distance exceeds the
     // distance parameters.
-    EXPECT_EQ(scorer.GetEdgeScore(*call_edge, 250), 0);
-    EXPECT_EQ(scorer.GetEdgeScore(*call_edge, -150), 0);
+    EXPECT_EQ(scorer.GetEdgeScore(call_edge, 250), 0);
+    EXPECT_EQ(scorer.GetEdgeScore(call_edge, -150), 0);
   }
 
   ASSERT_EQ(foo_cfg.inter_edges().size(), 2);
-  for (const std::unique_ptr<CFGEdge> &ret_edge : foo_cfg.inter_edges()) {
-    ASSERT_TRUE(ret_edge->IsReturn());
-    ASSERT_NE(ret_edge->weight(), 0);
-    ASSERT_NE(ret_edge->sink()->size(), 0);
+  for (const CFGEdge &ret_edge : foo_cfg.inter_edges()) {
+    ASSERT_TRUE(ret_edge.IsReturn());
+    ASSERT_NE(ret_edge.weight(), 0);
+    ASSERT_NE(ret_edge.sink()->size(), 0);
     // Score with negative src-to-sink distance (backward return).
     // Check that for returns, half of sink size is always added to the
     // distance.
-    EXPECT_EQ(scorer.GetEdgeScore(*ret_edge, -10),
-              ret_edge->weight() * 1 * 200 *
-                  (100 - 10 + ret_edge->sink()->size() / 2));
+    EXPECT_EQ(scorer.GetEdgeScore(ret_edge, -10),
+              ret_edge.weight() * 1 * 200 *
+                  (100 - 10 + ret_edge.sink()->size() / 2));
     // Score with zero src-to-sink distance (forward return).
     EXPECT_EQ(
-        scorer.GetEdgeScore(*ret_edge, 0),
-        ret_edge->weight() * 2 * 100 * (200 - ret_edge->sink()->size() / 2));
+        scorer.GetEdgeScore(ret_edge, 0),
+        ret_edge.weight() * 2 * 100 * (200 - ret_edge.sink()->size() / 2));
     // Score with positive src-to-sink distance (forward return).
-    EXPECT_EQ(scorer.GetEdgeScore(*ret_edge, 20),
-              ret_edge->weight() * 2 * 100 *
-                  (200 - 20 - ret_edge->sink()->size() / 2));
-    EXPECT_EQ(scorer.GetEdgeScore(*ret_edge, 250), 0);
-    EXPECT_EQ(scorer.GetEdgeScore(*ret_edge, -150), 0);
+    EXPECT_EQ(scorer.GetEdgeScore(ret_edge, 20),
+              ret_edge.weight() * 2 * 100 *
+                  (200 - 20 - ret_edge.sink()->size() / 2));
+    EXPECT_EQ(scorer.GetEdgeScore(ret_edge, 250), 0);
+    EXPECT_EQ(scorer.GetEdgeScore(ret_edge, -150), 0);
   }
 
-  for (const std::unique_ptr<CFGEdge> &edge : foo_cfg.intra_edges()) {
-    ASSERT_EQ(edge->kind(),
+  for (const CFGEdge &edge : foo_cfg.intra_edges()) {
+    ASSERT_EQ(edge.kind(),
               devtools_crosstool_autofdo::CFGEdge::Kind::kBranchOrFallthough);
-    ASSERT_NE(edge->weight(), 0);
+    ASSERT_NE(edge.weight(), 0);
     // Fallthrough score.
-    EXPECT_EQ(scorer.GetEdgeScore(*edge, 0), edge->weight() * 10 * 100 * 200);
+    EXPECT_EQ(scorer.GetEdgeScore(edge, 0), edge.weight() * 10 * 100 * 200);
     // Backward edge (within distance threshold) score.
-    EXPECT_EQ(scorer.GetEdgeScore(*edge, -40),
-              edge->weight() * 1 * 200 * (100 - 40));
+    EXPECT_EQ(scorer.GetEdgeScore(edge, -40),
+              edge.weight() * 1 * 200 * (100 - 40));
     // Forward edge (within distance threshold) score.
-    EXPECT_EQ(scorer.GetEdgeScore(*edge, 80),
-              edge->weight() * 2 * 100 * (200 - 80));
+    EXPECT_EQ(scorer.GetEdgeScore(edge, 80),
+              edge.weight() * 2 * 100 * (200 - 80));
     // Forward and backward edge beyond the distance thresholds (zero score).
-    EXPECT_EQ(scorer.GetEdgeScore(*edge, 201), 0);
-    EXPECT_EQ(scorer.GetEdgeScore(*edge, -101), 0);
+    EXPECT_EQ(scorer.GetEdgeScore(edge, 201), 0);
+    EXPECT_EQ(scorer.GetEdgeScore(edge, -101), 0);
   }
 }
 
@@ -343,19 +343,57 @@ TEST(CodeLayoutTest, FindOptimalMultiFunctionLayout) {
             func_cluster_info_4.original_score.intra_score);
   EXPECT_EQ(func_cluster_info_9.optimized_score.intra_score, 0);
   EXPECT_EQ(func_cluster_info_9.original_score.intra_score, 0);
-  // TODO(rahmanl): Check for improvement in inter_out_score once we have
-  // function reordering.
+  // 'foo' is only called from 'bar'. So it must have been placed right after
+  // 'bar' and both must be within the call's forward jump distance.
+  EXPECT_GT(func_cluster_info_4.optimized_score.inter_out_score, 0);
 
   // Check the layout index of hot clusters.
-  EXPECT_EQ(0, func_cluster_info_1.clusters.front().layout_index);
-  EXPECT_EQ(1, func_cluster_info_4.clusters.front().layout_index);
+  EXPECT_EQ(0, func_cluster_info_4.clusters.front().layout_index);
+  EXPECT_EQ(1, func_cluster_info_1.clusters.front().layout_index);
   EXPECT_EQ(2, func_cluster_info_9.clusters.front().layout_index);
 
   // Check that the layout indices of cold clusters are consistent with their
   // hot counterparts.
-  EXPECT_EQ(0, func_cluster_info_1.cold_cluster_layout_index);
-  EXPECT_EQ(1, func_cluster_info_4.cold_cluster_layout_index);
+  EXPECT_EQ(0, func_cluster_info_4.cold_cluster_layout_index);
+  EXPECT_EQ(1, func_cluster_info_1.cold_cluster_layout_index);
   EXPECT_EQ(2, func_cluster_info_9.cold_cluster_layout_index);
 }
 
+TEST(CodeLayoutTest, FindSameLayoutWithMultipleJobs) {
+  // Chaining modifies the CFG nodes, so every layout needs its own CFGs.
+  auto whole_program_info = GetTestWholeProgramInfo(
+      "/testdata/"
+      "propeller_simple_multi_function.protobuf");
+  ASSERT_NE(nullptr, whole_program_info);
+  auto parallel_whole_program_info = GetTestWholeProgramInfo(
+      "/testdata/"
+      "propeller_simple_multi_function.protobuf");
+  ASSERT_NE(nullptr, parallel_whole_program_info);
+
+  auto layout_info =
+      CodeLayout(whole_program_info->options().code_layout_params(),
+                 whole_program_info->GetHotCfgs())
+          .OrderAll();
+  auto parallel_layout_info =
+      CodeLayout(parallel_whole_program_info->options().code_layout_params(),
+                 parallel_whole_program_info->GetHotCfgs(), /*jobs=*/4)
+          .OrderAll();
+  ASSERT_EQ(layout_info.size(), parallel_layout_info.size());
+  for (const auto &[ordinal, func_cluster_info] : layout_info) {
+    auto it = parallel_layout_info.find(ordinal);
+    ASSERT_NE(it, parallel_layout_info.end());
+    EXPECT_EQ(it->second.cfg->GetPrimaryName(),
+              func_cluster_info.cfg->GetPrimaryName());
+    EXPECT_EQ(it->second.cold_cluster_layout_index,
+              func_cluster_info.cold_cluster_layout_index);
+    ASSERT_EQ(it->second.clusters.size(), func_cluster_info.clusters.size());
+    for (int i = 0; i < func_cluster_info.clusters.size(); ++i) {
+      EXPECT_EQ(it->second.clusters[i].layout_index,
+                func_cluster_info.clusters[i].layout_index);
+      EXPECT_EQ(it->second.clusters[i].bb_indexes,
+                func_cluster_info.clusters[i].bb_indexes);
+    }
+  }
+}
+
 }  // namespace
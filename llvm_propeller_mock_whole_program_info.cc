@@ -2,8 +2,11 @@
 
 #include <fcntl.h>  // for "O_RDONLY"
 
+#include <map>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "llvm_propeller_cfg.pb.h"
 #include "llvm_propeller_options.pb.h"
@@ -14,13 +17,6 @@
 
 namespace devtools_crosstool_autofdo {
 
-static std::unique_ptr<CFGNode> CreateNodeFromNodePb(const CFGNodePb &nodepb,
-                                                     ControlFlowGraph *cfg) {
-  return std::make_unique<CFGNode>(nodepb.symbol_ordinal(), 0,
-                                   nodepb.bb_index(), nodepb.size(), cfg,
-                                   nodepb.freq());
-}
-
 bool MockPropellerWholeProgramInfo::CreateCfgs() {
   std::string perf_name = options_.perf_names(0);
   int fd = open(perf_name.c_str(), O_RDONLY);
@@ -50,7 +46,9 @@ static CFGEdge::Kind convertFromPBKind(CFGEdgePb::Kind kindpb) {
 void MockPropellerWholeProgramInfo::CreateCfgsFromProtobuf() {
   bump_ptr_allocator_ = std::make_unique<llvm::BumpPtrAllocator>();
   string_saver_ = std::make_unique<llvm::StringSaver>(*bump_ptr_allocator_);
-  std::map<uint64_t, CFGNode *> ordinal_to_node_map;
+  CFGBuilder builder(&cfg_allocator_);
+  std::map<uint64_t, CFGBuilder::NodeId> ordinal_to_node_map;
+  std::vector<std::unique_ptr<ControlFlowGraph>> cfgs;
   // Now construct the CFG.
   for (const auto &cfgpb : propeller_pb_.cfg()) {
     llvm::SmallVector<llvm::StringRef, 3> names;
@@ -59,27 +57,25 @@ void MockPropellerWholeProgramInfo::CreateCfgsFromProtobuf() {
       names.emplace_back(string_saver_->save(name));
     auto cfg = std::make_unique<ControlFlowGraph>(std::move(names));
     ++stats_.cfgs_created;
-    std::vector<SymbolEntry *> symbols;
     for (const auto &nodepb : cfgpb.node()) {
-      std::unique_ptr<CFGNode> node = CreateNodeFromNodePb(nodepb, cfg.get());
-      ordinal_to_node_map.try_emplace(node->symbol_ordinal(), node.get());
-      if (node->freq()) cfg->hot_tag_ = true;
-      cfg->nodes_.emplace(std::move(node));
+      CFGBuilder::NodeId node =
+          builder.AddNode(cfg.get(), nodepb.symbol_ordinal(), 0,
+                          nodepb.bb_index(), nodepb.size(), nodepb.freq());
+      ordinal_to_node_map.try_emplace(nodepb.symbol_ordinal(), node);
     }
-    stats_.nodes_created += cfg->nodes_.size();
-    cfgs_.emplace(cfg->names().front(), std::move(cfg));
+    stats_.nodes_created += cfgpb.node_size();
+    cfgs.push_back(std::move(cfg));
   }
 
   // Now construct the edges
-  auto help_construct_edge = [&ordinal_to_node_map, this](auto &edges) {
+  auto help_construct_edge = [&ordinal_to_node_map, &builder,
+                              this](auto &edges) {
     for (const auto &edgepb : edges) {
-      auto *from_n = ordinal_to_node_map[edgepb.source()];
-      auto *to_n = ordinal_to_node_map[edgepb.sink()];
-      CHECK(from_n);
-      CHECK(to_n);
-      auto *cfg = from_n->cfg();
-      CHECK(cfg);
-      cfg->CreateEdge(from_n, to_n, edgepb.weight(),
+      auto from_i = ordinal_to_node_map.find(edgepb.source());
+      auto to_i = ordinal_to_node_map.find(edgepb.sink());
+      CHECK(from_i != ordinal_to_node_map.end());
+      CHECK(to_i != ordinal_to_node_map.end());
+      builder.AddEdge(from_i->second, to_i->second, edgepb.weight(),
                       convertFromPBKind(edgepb.kind()));
       ++stats_.edges_created;
     }
@@ -90,6 +86,9 @@ void MockPropellerWholeProgramInfo::CreateCfgsFromProtobuf() {
       help_construct_edge(nodepb.inter_outs());
     }
   }
+  // Node frequencies come from the protobuf.
+  builder.Build(/*calculate_freqs=*/false);
+  for (auto &cfg : cfgs) cfgs_.emplace(cfg->names().front(), std::move(cfg));
   propeller_pb_.Clear();
 }
 
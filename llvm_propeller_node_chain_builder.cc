@@ -13,9 +13,9 @@ void NodeChainBuilder::InitNodeChains() {
   for (ControlFlowGraph *cfg : cfgs_) {
     // TODO(rahmanl) Construct bundles as vector of CFGNodes.
     // For now, make single-node chains for every hot node.
-    for (auto &node : cfg->nodes())
-      if (node->freq()) {
-        auto chain = std::make_unique<NodeChain>(node.get());
+    for (CFGNode &node : cfg->nodes())
+      if (node.freq()) {
+        auto chain = std::make_unique<NodeChain>(&node);
         chains_.try_emplace(chain->id(), std::move(chain));
       }
   }
@@ -118,9 +118,11 @@ void NodeChainBuilder::UpdateNodeChainAssembly(NodeChain *left_chain,
 
   // If score is non-zero, update the assembly map entry, otherwise make sure we
   // remove the associated entry.
-  if (score != 0)
+  if (score != 0) {
     node_chain_assemblies_[std::make_pair(left_chain, right_chain)] = score;
-  else
+    node_chain_assembly_queue_.emplace(score, left_chain->id(),
+                                       right_chain->id());
+  } else
     node_chain_assemblies_.erase(std::make_pair(left_chain, right_chain));
 }
 
@@ -178,11 +180,17 @@ void NodeChainBuilder::InitChainEdges() {
   // Set up the outgoing edges for every chain
   for (auto &elem : chains_) {
     auto *chain = elem.second.get();
-    chain->VisitEachNodeRef([chain](auto &n) {
-      n.ForEachOutEdgeRef([chain](CFGEdge &edge) {
+    chain->VisitEachNodeRef([this, chain](auto &n) {
+      n.ForEachOutEdgeRef([this, chain](CFGEdge &edge) {
         // Ignore returns and zero-frequency edges.
         // TODO(rahmanl): Remove IsCall() for interp
         if (!edge.weight() || edge.IsReturn() || edge.IsCall()) return;
+        // Ignore branches to CFGs which are not chained by this builder, as
+        // their nodes may be chained concurrently by another builder.
+        if (edge.sink()->cfg() != edge.src()->cfg() &&
+            std::find(cfgs_.begin(), cfgs_.end(), edge.sink()->cfg()) ==
+                cfgs_.end())
+          return;
         // Ignore edges running within the same bundle, as they won't be split.
         if (edge.src()->bundle() == edge.sink()->bundle()) return;
         auto *sink_node_chain = GetNodeChain(edge.sink());
@@ -198,21 +206,26 @@ void NodeChainBuilder::InitChainEdges() {
 void NodeChainBuilder::KeepMergingBestChains() {
   // Keep merging chains together until no more score gain can be achieved.
   while (!node_chain_assemblies_.empty()) {
-    // Find the assembly which brings about the maximum gain in score.
-    auto best_assembly = std::max_element(
-        node_chain_assemblies_.begin(), node_chain_assemblies_.end(),
-        [](auto &lhs, auto &rhs) {
-          if (lhs.second != rhs.second)
-            return lhs.second < rhs.second;
-          // Consistently break ties when the score is the same.
-          if (lhs.first.first->id() != rhs.first.first->id())
-            return lhs.first.first->id() < rhs.first.first->id();
-          return lhs.first.second->id() < rhs.first.second->id();
-        });
-    if (best_assembly != node_chain_assemblies_.end()) {
-      MergeChains(best_assembly->first.first, best_assembly->first.second);
-    }
+    CHECK(!node_chain_assembly_queue_.empty())
+        << "Chain assemblies are missing from the assembly queue.";
+    // Pop the assembly which brings about the maximum gain in score. Ties are
+    // consistently broken by the ids of the left and right chains.
+    uint64_t score, left_id, right_id;
+    std::tie(score, left_id, right_id) = node_chain_assembly_queue_.top();
+    node_chain_assembly_queue_.pop();
+
+    // Skip the entry if it does not match a current assembly.
+    auto left_chain = chains_.find(left_id);
+    auto right_chain = chains_.find(right_id);
+    if (left_chain == chains_.end() || right_chain == chains_.end()) continue;
+    auto assembly = node_chain_assemblies_.find(std::make_pair(
+        left_chain->second.get(), right_chain->second.get()));
+    if (assembly == node_chain_assemblies_.end() || assembly->second != score)
+      continue;
+
+    MergeChains(left_chain->second.get(), right_chain->second.get());
   }
+  node_chain_assembly_queue_ = {};
 }
 
 // This function sorts bb chains in decreasing order of their execution density.
@@ -2,6 +2,8 @@
 #define AUTOFDO_LLVM_PROPELLER_NODE_CHAIN_BUILDER_H_
 
 #include <map>
+#include <queue>
+#include <tuple>
 #include <vector>
 
 #include "llvm_propeller_cfg.h"
@@ -78,6 +80,13 @@ class NodeChainBuilder {
   std::map<std::pair<NodeChain *, NodeChain *>, uint64_t>
       node_chain_assemblies_;
 
+  // Max-heap of (score, left chain id, right chain id) for the assemblies in
+  // node_chain_assemblies_, ordered the same way ties are broken when picking
+  // the best assembly. Entries are not removed when an assembly changes or
+  // goes away; such stale entries are skipped when they reach the top.
+  std::priority_queue<std::tuple<uint64_t, uint64_t, uint64_t>>
+      node_chain_assembly_queue_;
+
   void MergeChainEdges(NodeChain *source, NodeChain *destination);
 
 
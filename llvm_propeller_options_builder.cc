@@ -45,4 +45,9 @@ PropellerOptionsBuilder::SetKeepFrontendIntermediateData(bool value) {
   return *this;
 }
 
+PropellerOptionsBuilder& PropellerOptionsBuilder::SetJobs(uint32_t value) {
+  data_.set_jobs(value);
+  return *this;
+}
+
 }  // namespace devtools_crosstool_autofdo
@@ -27,6 +27,7 @@ class PropellerOptionsBuilder {
   PropellerOptionsBuilder& SetProfiledBinaryName(const std::string& value);
   PropellerOptionsBuilder& SetIgnoreBuildId(bool value);
   PropellerOptionsBuilder& SetKeepFrontendIntermediateData(bool value);
+  PropellerOptionsBuilder& SetJobs(uint32_t value);
 
  private:
   PropellerOptions data_;
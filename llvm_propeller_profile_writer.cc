@@ -37,7 +37,8 @@ absl::Status GeneratePropellerProfiles(const PropellerOptions &opts) {
 
   const devtools_crosstool_autofdo::CodeLayoutResult layout_per_function =
       devtools_crosstool_autofdo::CodeLayout(
-          opts.code_layout_params(), writer->whole_program_info()->GetHotCfgs())
+          opts.code_layout_params(), writer->whole_program_info()->GetHotCfgs(),
+          opts.jobs())
           .OrderAll();
   if (!writer->Write(layout_per_function))
     return absl::InternalError("Failed to compute code layout result");
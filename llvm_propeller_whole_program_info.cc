@@ -3,7 +3,10 @@
 #include <fcntl.h>  // for "O_RDONLY"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <functional>
 #include <future>  // NOLINT(build/c++11)
 #include <numeric>
 #include <string>
@@ -17,6 +20,7 @@
 #include "third_party/abseil/absl/container/flat_hash_map.h"
 #include "third_party/abseil/absl/strings/str_format.h"
 #include "third_party/abseil/absl/strings/string_view.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/BinaryFormat/ELF.h"
@@ -35,22 +39,19 @@ using ::llvm::Optional;
 using ::llvm::StringRef;
 using ::llvm::object::ObjectFile;
 
-// Section .llvm_bb_addr_map consists of many AddrMapEntry.
-struct AddrMapEntry {
-  struct BbInfo {
-    uint64_t offset;
-    uint64_t size;
-    uint64_t meta;
-  };
-
-  uint64_t func_address;
-  std::vector<BbInfo> bb_info;
-};
+// The entries of .llvm_bb_addr_map are decoded in chunks of this many entries,
+// taken in turn by every job.
+constexpr size_t kBbAddrMapEntriesPerChunk = 1024;
 
 // Read a uleb field value and advance *p.
 template <class ValueType>
 bool ReadUlebField(absl::string_view field_name, const uint8_t **p,
                    const unsigned char *end_mark, ValueType *v) {
+  // Most offsets, sizes and metadata fit in a single byte.
+  if (*p != end_mark && !(**p & 0x80)) {
+    *v = *((*p)++);
+    return true;
+  }
   const char *err = nullptr;
   unsigned n = 0;
   *v = llvm::decodeULEB128(*p, &n, end_mark, &err);
@@ -63,26 +64,65 @@ bool ReadUlebField(absl::string_view field_name, const uint8_t **p,
   return true;
 }
 
-// Read one bbaddrmap entry from *p, make sure never move *p beyond end.
-absl::optional<AddrMapEntry> ReadOneEntry(const uint8_t **p,
-                                          const uint8_t * const end) {
-  const uint64_t address = *(reinterpret_cast<const uint64_t *>(*p));
-  *p += sizeof(uint64_t);
-  uint64_t num_blocks = 0, meta = 0, size = 0, offset = 0, previous_offset = 0;
-  if (!ReadUlebField("bb count", p, end, &num_blocks)) return {};
-  std::vector<AddrMapEntry::BbInfo> blocks;
-  for (int ib = 0; ib < num_blocks; ++ib) {
-    previous_offset = offset;
-    if (ReadUlebField("bb offset", p, end, &offset) &&
-        ReadUlebField("bb size", p, end, &size) &&
-        ReadUlebField("bb metadata", p, end, &meta)) {
-      // Check assumption here: bb records appear in the order of "symbol
-      // offset".
-      CHECK(previous_offset <= offset);
-      blocks.push_back({offset, size, meta});
+// Advance *p past "n" uleb fields without decoding them, make sure never move
+// *p beyond end. The end of a uleb is the first byte with a clear high bit.
+bool SkipUlebFields(uint64_t n, const uint8_t **p, const uint8_t *const end) {
+  const uint8_t *q = *p;
+  for (; n != 0 && q != end; ++q) n -= !(*q & 0x80);
+  if (n != 0) {
+    LOG(ERROR) << "Read .bb_info uleb128 error: malformed uleb128, extends "
+                  "past end";
+    return false;
+  }
+  *p = q;
+  return true;
+}
+
+// First phase of the decoding of the section [begin, end): finds the function
+// address, the number of blocks and the extent of every entry, without
+// decoding the block records.
+bool ScanEntries(const uint8_t *const begin, const uint8_t *const end,
+                 std::vector<AddrMapEntry> *entries,
+                 std::vector<uint64_t> *num_blocks) {
+  for (const uint8_t *p = begin; p != end;) {
+    if (static_cast<size_t>(end - p) < sizeof(uint64_t)) {
+      LOG(ERROR) << "Read .bb_info function address error: unexpected end";
+      return false;
     }
+    uint64_t address;
+    std::memcpy(&address, p, sizeof(address));
+    p += sizeof(uint64_t);
+    uint64_t n = 0;
+    if (!ReadUlebField("bb count", &p, end, &n)) return false;
+    const uint64_t bb_info_offset = p - begin;
+    // Every block has an offset, a size and a metadata field.
+    if (!SkipUlebFields(3 * n, &p, end)) return false;
+    entries->push_back({address, bb_info_offset,
+                        static_cast<uint64_t>(p - begin), {}});
+    num_blocks->push_back(n);
   }
-  return AddrMapEntry{address, blocks};
+  return true;
+}
+
+// Second phase: decodes the "num_blocks" block records of "entry" in the
+// section starting at "begin" into "blocks".
+bool DecodeBlocks(const uint8_t *const begin, const AddrMapEntry &entry,
+                  uint64_t num_blocks, AddrMapEntry::BbInfo *blocks) {
+  const uint8_t *p = begin + entry.bb_info_offset;
+  const uint8_t *const end = begin + entry.end_offset;
+  uint64_t previous_offset = 0;
+  for (uint64_t ib = 0; ib < num_blocks; ++ib) {
+    AddrMapEntry::BbInfo &block = blocks[ib];
+    if (!ReadUlebField("bb offset", &p, end, &block.offset) ||
+        !ReadUlebField("bb size", &p, end, &block.size) ||
+        !ReadUlebField("bb metadata", &p, end, &block.meta))
+      return false;
+    // Check assumption here: bb records appear in the order of "symbol
+    // offset".
+    CHECK(previous_offset <= block.offset);
+    previous_offset = block.offset;
+  }
+  return true;
 }
 
 llvm::Optional<llvm::object::SectionRef> FindBbAddrMapSection(
@@ -100,8 +140,70 @@ llvm::Optional<llvm::object::SectionRef> FindBbAddrMapSection(
   }
   return llvm::None;
 }
+
+// Returns pointers to the entries of the unordered "counters", sorted by key
+// with "comp", so edges are created in the same order on every run.
+template <class CountersTy, class Compare>
+std::vector<const typename CountersTy::value_type *> SortedCounters(
+    const CountersTy &counters, Compare comp) {
+  std::vector<const typename CountersTy::value_type *> sorted;
+  sorted.reserve(counters.size());
+  for (const auto &entry : counters) sorted.push_back(&entry);
+  std::sort(sorted.begin(), sorted.end(),
+            [&comp](const auto *a, const auto *b) {
+              return comp(a->first, b->first);
+            });
+  return sorted;
+}
 }  // namespace
 
+bool DecodeBbAddrMap(const uint8_t *const begin, const uint8_t *const end,
+                     unsigned jobs, size_t entries_per_chunk,
+                     std::vector<AddrMapEntry> *entries,
+                     std::vector<AddrMapEntry::BbInfo> *blocks) {
+  std::vector<uint64_t> num_blocks;
+  if (!ScanEntries(begin, end, entries, &num_blocks)) return false;
+  // Index of the first block of every entry in "blocks".
+  std::vector<uint64_t> first_blocks(entries->size());
+  std::exclusive_scan(num_blocks.begin(), num_blocks.end(),
+                      first_blocks.begin(), uint64_t{0});
+  blocks->resize(entries->empty() ? 0
+                                  : first_blocks.back() + num_blocks.back());
+
+  // Entries are decoded in chunks, taken in turn by every job.
+  const size_t num_chunks =
+      (entries->size() + entries_per_chunk - 1) / entries_per_chunk;
+  std::atomic<size_t> next_chunk{0};
+  std::atomic<bool> ok{true};
+  auto decode_chunks = [&] {
+    for (size_t chunk = next_chunk++; chunk < num_chunks;
+         chunk = next_chunk++) {
+      const size_t chunk_end =
+          std::min(entries->size(), (chunk + 1) * entries_per_chunk);
+      for (size_t i = chunk * entries_per_chunk; i < chunk_end; ++i) {
+        AddrMapEntry &entry = (*entries)[i];
+        AddrMapEntry::BbInfo *entry_blocks = blocks->data() + first_blocks[i];
+        if (!DecodeBlocks(begin, entry, num_blocks[i], entry_blocks)) {
+          ok = false;
+          return;
+        }
+        entry.bb_info =
+            llvm::ArrayRef<AddrMapEntry::BbInfo>(entry_blocks, num_blocks[i]);
+      }
+    }
+  };
+  jobs = std::max<size_t>(1, std::min<size_t>(jobs, num_chunks));
+  if (jobs == 1) {
+    decode_chunks();
+  } else {
+    std::vector<std::thread> threads;
+    for (unsigned job = 0; job < jobs; ++job)
+      threads.emplace_back(decode_chunks);
+    for (std::thread &t : threads) t.join();
+  }
+  return ok;
+}
+
 std::unique_ptr<PropellerWholeProgramInfo> PropellerWholeProgramInfo::Create(
     const PropellerOptions &options) {
   BinaryPerfInfo bpi;
@@ -140,10 +242,11 @@ SymbolEntry *PropellerWholeProgramInfo::CreateFuncSymbolEntry(
   // Note, funcsym is not put into bb_addr_map_. It's accessible via
   // bb_addr_map_[func_name].front()->func_ptr.
   // Put into address_map_.
-  address_map_[address].emplace_back(std::make_unique<SymbolEntry>(
+  auto &address_syms = InsertAddress(address);
+  address_syms.emplace_back(std::make_unique<SymbolEntry>(
       ordinal, func_name, aliases, address, size, nullptr, 0));
   ++stats_.syms_created;
-  return address_map_[address].back().get();
+  return address_syms.back().get();
 }
 
 SymbolEntry *PropellerWholeProgramInfo::CreateBbSymbolEntry(
@@ -168,9 +271,10 @@ SymbolEntry *PropellerWholeProgramInfo::CreateBbSymbolEntry(
   CHECK(bb_index < iter->second.size());
   iter->second[bb_index] = bb_symbol.get();
   // Put into address_map_.
-  address_map_[address].emplace_back(std::move(bb_symbol));
+  auto &address_syms = InsertAddress(address);
+  address_syms.emplace_back(std::move(bb_symbol));
   ++stats_.syms_created;
-  return address_map_[address].back().get();
+  return address_syms.back().get();
 }
 
 void PropellerWholeProgramInfo::ReadSymbolTable() {
@@ -215,8 +319,13 @@ bool PropellerWholeProgramInfo::ReadBbAddrMapSection() {
     return false;
   }
   StringRef sec_contents = *exp_contents;
-  const unsigned char * p = sec_contents.bytes_begin();
-  const unsigned char * const end = sec_contents.bytes_end();
+  std::vector<AddrMapEntry> entries;
+  std::vector<AddrMapEntry::BbInfo> blocks_storage;
+  // Fail to read bbinfo section in the middle is irrecoverable.
+  if (!DecodeBbAddrMap(sec_contents.bytes_begin(), sec_contents.bytes_end(),
+                       options_.jobs(), kBbAddrMapEntriesPerChunk, &entries,
+                       &blocks_storage))
+    return false;
 
   uint64_t ordinal = 0;
   std::set<llvm::StringRef> conflicting_symbols;
@@ -300,20 +409,15 @@ bool PropellerWholeProgramInfo::ReadBbAddrMapSection() {
         }
         return conflicting_symbols_found;
       };
-  while (p != end) {
-    // ReadOneEntry moves p ahead ...
-    auto entry = ReadOneEntry(&p, end);
-    // Fail to read bbinfo section in the middle is irrecoverable.
-    if (!entry.has_value()) return false;
-
-    const uint64_t func_address = entry.value().func_address;
+  for (const AddrMapEntry &entry : entries) {
+    const uint64_t func_address = entry.func_address;
     auto iter = symtab_.find(func_address);
     // b/169962287 under some circumstances, bb_addr_map's symbol may not have
     // associated symbols.
     if (iter == symtab_.end()) {
       LOG(WARNING) << "Invalid entry inside '" << kBbAddrMapSectionName
                    << "', at offset: " << std::showbase << std::hex
-                   << p - sec_contents.bytes_begin()
+                   << entry.end_offset
                    << ". Function address listed: " << std::showbase << std::hex
                    << func_address;
       ++stats_.bbaddrmap_function_does_not_have_symtab_entry;
@@ -343,7 +447,7 @@ bool PropellerWholeProgramInfo::ReadBbAddrMapSection() {
     CHECK(!func_aliases.empty());
     const uint64_t func_size =
         llvm::object::ELFSymbolRef(iter->second.front()).getSize();
-    const auto &blocks = entry.value().bb_info;
+    llvm::ArrayRef<AddrMapEntry::BbInfo> blocks = entry.bb_info;
     // TODO(b/183514655): revisit this after bug fixes.
     if (blocks.empty() || (blocks.size() == 1 && blocks.front().size == 0)) {
       LOG(WARNING) << "Skipped trivial bbentry : " << std::showbase << std::hex
@@ -370,9 +474,25 @@ bool PropellerWholeProgramInfo::ReadBbAddrMapSection() {
     }
   }  // end of iterating bb info section.
   remove_conflicting_symbols();
+  BuildAddressIndex();
   return true;
 }
 
+void PropellerWholeProgramInfo::BuildAddressIndex() {
+  address_index_ = AddressIndex();
+  address_index_.starts.reserve(address_map_.size());
+  address_index_.first_symbol.reserve(address_map_.size() + 1);
+  for (const auto &[address, symbols] : address_map_) {
+    address_index_.starts.push_back(address);
+    address_index_.first_symbol.push_back(address_index_.symbols.size());
+    for (const std::unique_ptr<SymbolEntry> &s : symbols) {
+      address_index_.symbol_ends.push_back(s->addr + s->size);
+      address_index_.symbols.push_back(s.get());
+    }
+  }
+  address_index_.first_symbol.push_back(address_index_.symbols.size());
+}
+
 bool PropellerWholeProgramInfo::PopulateSymbolMap() {
   ReadSymbolTable();
   return ReadBbAddrMapSection();
@@ -399,43 +519,85 @@ Optional<LBRAggregation> PropellerWholeProgramInfo::ParsePerfData() {
     // event file name.
     match_mmap_name = "";
 
-  LBRAggregation lbr_aggregation;
+  if (options_.keep_frontend_intermediate_data() &&
+      options_.perf_names_size() > 1) {
+    // If there are multiple perf data files, we must always call
+    // ResetPerfInfo regardless of options_.keep_frontend_intermediate_data.
+    LOG(ERROR) << "Usage error: --keep_frontend_intermediate_data is only "
+                  "valid for single profile file input.";
+    return llvm::None;
+  }
 
-  int fi = 0;
-  binary_perf_info_.ResetPerfInfo();
-  for (const std::string &perf_file :  options_.perf_names()) {
-    if (perf_file.empty()) continue;
-    LOG(INFO) << "Parsing '" << perf_file << "' [" << ++fi << " of "
-              << options_.perf_names_size() << "] ...";
-    if (!PerfDataReader().SelectPerfInfo(perf_file, match_mmap_name,
-                                         &binary_perf_info_)) {
-      LOG(WARNING) << "Skipped profile '" << perf_file
-                   << "', because reading file failed or no mmap found.";
-      continue;
+  std::vector<const std::string *> perf_files;
+  for (const std::string &perf_file : options_.perf_names())
+    if (!perf_file.empty()) perf_files.push_back(&perf_file);
+
+  // Every job parses one perf file at a time and aggregates it into its own
+  // LBRAggregation, so at most "jobs" files are in flight.
+  const int jobs = std::max<int>(
+      1, std::min<int>(options_.jobs(), perf_files.size()));
+  std::vector<LBRAggregation> aggregations(jobs);
+  std::vector<PropellerStats> job_stats(jobs);
+  std::atomic<int> next_file{0};
+  auto parse_perf_files = [&](int job, BinaryPerfInfo *binary_perf_info) {
+    for (int fi = next_file++; fi < perf_files.size(); fi = next_file++) {
+      const std::string &perf_file = *perf_files[fi];
+      LOG(INFO) << "Parsing '" << perf_file << "' [" << fi + 1 << " of "
+                << perf_files.size() << "] ...";
+      binary_perf_info->ResetPerfInfo();
+      if (!PerfDataReader().SelectPerfInfo(perf_file, match_mmap_name,
+                                           binary_perf_info)) {
+        LOG(WARNING) << "Skipped profile '" << perf_file
+                     << "', because reading file failed or no mmap found.";
+        continue;
+      }
+      if (binary_perf_info->binary_mmaps.empty()) {
+        LOG(WARNING) << "Skipped profile '" << perf_file
+                     << "', because no matching mmap found.";
+        continue;
+      }
+      job_stats[job].binary_mmap_num += binary_perf_info->binary_mmaps.size();
+      ++job_stats[job].perf_file_parsed;
+      perf_data_reader_.AggregateLBR(*binary_perf_info, &aggregations[job]);
+      // "keep_frontend_intermediate_data" is only used by tests.
+      if (!options_.keep_frontend_intermediate_data())
+        binary_perf_info->ResetPerfInfo();  // Release perf data memory.
     }
-    if (binary_perf_info_.binary_mmaps.empty()) {
-      LOG(WARNING) << "Skipped profile '" << perf_file
-                   << "', because no matching mmap found.";
-      continue;
+  };
+
+  binary_perf_info_.ResetPerfInfo();
+  if (jobs == 1) {
+    parse_perf_files(0, &binary_perf_info_);
+  } else {
+    std::vector<std::thread> threads;
+    for (int job = 0; job < jobs; ++job) {
+      threads.emplace_back([&, job] {
+        BinaryPerfInfo binary_perf_info;
+        binary_perf_info.binary_info =
+            binary_perf_info_.binary_info.CopyWithoutContent();
+        parse_perf_files(job, &binary_perf_info);
+      });
     }
-    stats_.binary_mmap_num += binary_perf_info_.binary_mmaps.size();
-    ++stats_.perf_file_parsed;
-    perf_data_reader_.AggregateLBR(binary_perf_info_, &lbr_aggregation);
-    if (!options_.keep_frontend_intermediate_data()) {
-      // "keep_frontend_intermediate_data" is only used by tests.
-      binary_perf_info_.ResetPerfInfo();  // Release quipper parser memory.
-    } else if (options_.perf_names_size() > 1) {
-      // If there are multiple perf data files, we must always call
-      // ResetPerfInfo regardless of options_.keep_frontend_intermediate_data.
-      LOG(ERROR) << "Usage error: --keep_frontend_intermediate_data is only "
-                    "valid for single profile file input.";
-      return llvm::None;
+    for (std::thread &t : threads) t.join();
+
+    // Tree-reduce the per-job aggregations into aggregations[0].
+    for (int stride = 1; stride < jobs; stride *= 2) {
+      threads.clear();
+      for (int job = 0; job + stride < jobs; job += 2 * stride) {
+        threads.emplace_back([&aggregations, job, stride] {
+          aggregations[job].Merge(std::move(aggregations[job + stride]));
+        });
+      }
+      for (std::thread &t : threads) t.join();
     }
   }
+  for (const PropellerStats &s : job_stats) stats_ += s;
+  LBRAggregation lbr_aggregation = std::move(aggregations[0]);
+
   stats_.br_counters_accumulated += std::accumulate(
       lbr_aggregation.branch_counters.begin(),
       lbr_aggregation.branch_counters.end(), 0,
-      [](uint64_t cnt, typename BranchCountersTy::value_type &v) {
+      [](uint64_t cnt, const typename BranchCountersTy::value_type &v) {
         return cnt + v.second;
       });
   if (stats_.br_counters_accumulated <= 100)
@@ -459,8 +621,8 @@ bool PropellerWholeProgramInfo::DoCreateCfgs(LBRAggregation &&lbr_aggregation) {
     }
   }
 
-  // Temp map from SymbolEntry -> CFGNode.
-  std::map<const SymbolEntry *, CFGNode *, SymbolPtrComparator> tmp_node_map;
+  CFGBuilder builder(&cfg_allocator_);
+  SymbolNodeMapTy tmp_node_map;
   // Temp map from SymbolEntry -> ControlFlowGraph.
   std::map<const SymbolEntry *, std::unique_ptr<ControlFlowGraph>,
            SymbolPtrComparator>
@@ -473,24 +635,25 @@ bool PropellerWholeProgramInfo::DoCreateCfgs(LBRAggregation &&lbr_aggregation) {
     std::sort(syms.begin(), syms.end(), SymbolPtrComparator());
     auto cfg = std::make_unique<ControlFlowGraph>(func_symbol->aliases);
 
-    cfg->CreateNodes(syms);
-    stats_.nodes_created += cfg->nodes().size();
-    // Setup mapping from syms <-> nodes.
-    DCHECK_EQ(cfg->nodes().size(), syms.size());
-    std::vector<SymbolEntry *>::iterator symsi = syms.begin();
-    for (const auto &nptr : cfg->nodes()) {
-      CHECK((*symsi)->ordinal == nptr.get()->symbol_ordinal());
-      tmp_node_map[*(symsi++)] = nptr.get();
+    // This is for bbaddressmap workflow, the function symbol is excluded from
+    // "syms" vector, all symbols contains in "syms" are basic block symbols.
+    // bbindex starts from 0.
+    CHECK_NE(syms[0]->func_ptr, syms[0]);
+    uint32_t bbidx = 0;
+    for (SymbolEntry *s : syms) {
+      tmp_node_map[s] =
+          builder.AddNode(cfg.get(), s->ordinal, s->addr, bbidx++, s->size);
     }
+    stats_.nodes_created += syms.size();
     tmp_cfg_map.emplace(func_symbol, std::move(cfg));
     ++stats_.cfgs_created;
   }
-  if (!CreateEdges(lbr_aggregation, tmp_node_map))
+  if (!CreateEdges(lbr_aggregation, tmp_node_map, &builder))
     return false;
+  builder.Build(/*calculate_freqs=*/true);
 
   for (auto &cfgi : tmp_cfg_map) {
     std::unique_ptr<ControlFlowGraph> cfg_ptr = std::move(cfgi.second);
-    cfg_ptr->FinishCreatingControlFlowGraph();
     cfgs_.emplace(std::piecewise_construct,
                   std::forward_as_tuple(cfgi.first->name),
                   std::forward_as_tuple(std::move(cfg_ptr)));
@@ -498,9 +661,10 @@ bool PropellerWholeProgramInfo::DoCreateCfgs(LBRAggregation &&lbr_aggregation) {
 
   // Release / cleanup.
   if (!options_.keep_frontend_intermediate_data()) {
-    binary_perf_info_.binary_mmaps.clear();
+    binary_perf_info_.ResetPerfInfo();
     lbr_aggregation = LBRAggregation();
     // Release ownership and delete SymbolEntry instances.
+    address_index_ = AddressIndex();
     address_map_.clear();
     symtab_.clear();
     bb_addr_map_.clear();
@@ -509,66 +673,63 @@ bool PropellerWholeProgramInfo::DoCreateCfgs(LBRAggregation &&lbr_aggregation) {
   return true;
 }
 
-CFGEdge *PropellerWholeProgramInfo::InternalCreateEdge(
+bool PropellerWholeProgramInfo::InternalCreateEdge(
     const SymbolEntry *from_sym, const SymbolEntry *to_sym, uint64_t weight,
-    CFGEdge::Kind edge_kind,
-    const std::map<const SymbolEntry *, CFGNode *, SymbolPtrComparator>
-        &tmp_node_map,
-    std::map<SymbolPtrPair, CFGEdge *, SymbolPtrPairComparator> *tmp_edge_map) {
-  CFGEdge *edge = nullptr;
+    CFGEdge::Kind edge_kind, const SymbolNodeMapTy &tmp_node_map,
+    SymbolPtrPairEdgeMapTy *tmp_edge_map, CFGBuilder *builder) {
   auto i = tmp_edge_map->find(std::make_pair(from_sym, to_sym));
   if (i != tmp_edge_map->end()) {
-    edge = i->second;
-    if (edge->kind() != edge_kind) {
+    CFGBuilder::EdgeId edge = i->second;
+    if (builder->edge_kind(edge) != edge_kind) {
       LOG(WARNING) << "Edges with same src and sink have different type: "
-                   << CFGEdgeNameFormatter(edge) << " has type " << edge_kind
-                   << " and " << edge->kind();
+                   << SymbolNameFormatter(from_sym) << " -> "
+                   << SymbolNameFormatter(to_sym) << " has type " << edge_kind
+                   << " and " << builder->edge_kind(edge);
       stats_.edges_with_same_src_sink_but_different_type++;
     }
-    edge->IncrementWeight(weight);
+    builder->IncrementEdgeWeight(edge, weight);
   } else {
     auto from_ni = tmp_node_map.find(from_sym),
          to_ni = tmp_node_map.find(to_sym);
     if (from_ni == tmp_node_map.end() || to_ni == tmp_node_map.end())
-      return nullptr;
-    CFGNode *from_node = from_ni->second;
-    CFGNode *to_node = to_ni->second;
-    DCHECK(from_node && to_node);
-    edge = from_node->cfg()->CreateEdge(from_node, to_node, weight, edge_kind);
+      return false;
+    CFGBuilder::EdgeId edge =
+        builder->AddEdge(from_ni->second, to_ni->second, weight, edge_kind);
     ++stats_.edges_created;
     tmp_edge_map->emplace(std::piecewise_construct,
                           std::forward_as_tuple(from_sym, to_sym),
                           std::forward_as_tuple(edge));
   }
-  return edge;
+  return true;
 }
 
 // Create control flow graph edges from branch_counters_. For each address pair
 // <from_addr, to_addr> in "branch_counters_", we translate it to <from_symbol,
 // to_symbol> and by using tmp_node_map, we further translate it to <from_node,
-// to_node>, and finally create a CFGEdge for such CFGNode pair.
+// to_node>, and finally add an edge between such nodes to "builder".
 bool PropellerWholeProgramInfo::CreateEdges(
-    const LBRAggregation &lbr_aggregation,
-    const std::map<const SymbolEntry *, CFGNode *, SymbolPtrComparator>
-        &tmp_node_map) {
+    const LBRAggregation &lbr_aggregation, const SymbolNodeMapTy &tmp_node_map,
+    CFGBuilder *builder) {
   // Temp map that records which CFGEdges are created, so we do not re-create
   // edges. Note this is necessary: although
   // "branch_counters_" have no duplicated <from_addr, to_addr> pairs, the
   // translated <from_sym, to_sym> may have duplicates.
-  std::map<SymbolPtrPair, CFGEdge *, SymbolPtrPairComparator> tmp_edge_map;
+  SymbolPtrPairEdgeMapTy tmp_edge_map;
 
-  std::map<SymbolPtrPair, uint64_t, SymbolPtrPairComparator>
-      tmp_bb_fallthrough_counters;
+  SymbolPtrPairCountersTy tmp_bb_fallthrough_counters;
 
   uint64_t weight_on_dubious_edges = 0;
   uint64_t total_weight_created = 0;
   uint64_t edges_recorded = 0;
-  for (const typename BranchCountersTy::value_type &bcnt :
-       lbr_aggregation.branch_counters) {
+  // branch_counters is unordered, visit it in address order to keep the order
+  // of the created edges deterministic.
+  for (const typename BranchCountersTy::value_type *bcnt :
+       SortedCounters(lbr_aggregation.branch_counters,
+                      std::less<std::pair<uint64_t, uint64_t>>())) {
     ++edges_recorded;
-    uint64_t from = bcnt.first.first;
-    uint64_t to = bcnt.first.second;
-    uint64_t weight = bcnt.second;
+    uint64_t from = bcnt->first.first;
+    uint64_t to = bcnt->first.second;
+    uint64_t weight = bcnt->second;
     const SymbolEntry *from_sym = FindSymbolUsingBinaryAddress(from);
     const SymbolEntry *to_sym = FindSymbolUsingBinaryAddress(to);
     if (!from_sym || !to_sym) continue;
@@ -623,7 +784,7 @@ bool PropellerWholeProgramInfo::CreateEdges(
       edge_kind = CFGEdge::Kind::kRet;
 
     InternalCreateEdge(from_sym, to_sym, weight, edge_kind, tmp_node_map,
-                       &tmp_edge_map);
+                       &tmp_edge_map, builder);
   }
 
   if (weight_on_dubious_edges / static_cast<double>(total_weight_created) >
@@ -644,7 +805,7 @@ bool PropellerWholeProgramInfo::CreateEdges(
   }
 
   CreateFallthroughs(lbr_aggregation, tmp_node_map,
-                     &tmp_bb_fallthrough_counters, &tmp_edge_map);
+                     &tmp_bb_fallthrough_counters, &tmp_edge_map, builder);
   return true;
 }
 
@@ -655,12 +816,10 @@ bool PropellerWholeProgramInfo::CreateEdges(
 //    to_sym>.
 // 3. create edges and apply weights for the above path.
 void PropellerWholeProgramInfo::CreateFallthroughs(
-    const LBRAggregation &lbr_aggregation,
-    const std::map<const SymbolEntry *, CFGNode *, SymbolPtrComparator>
-        &tmp_node_map,
-    std::map<SymbolPtrPair, uint64_t, SymbolPtrPairComparator>
-        *tmp_bb_fallthrough_counters,
-    std::map<SymbolPtrPair, CFGEdge *, SymbolPtrPairComparator> *tmp_edge_map) {
+    const LBRAggregation &lbr_aggregation, const SymbolNodeMapTy &tmp_node_map,
+    SymbolPtrPairCountersTy *tmp_bb_fallthrough_counters,
+    SymbolPtrPairEdgeMapTy *tmp_edge_map, CFGBuilder *builder) {
+  // Accumulating into a hash map does not depend on the visiting order.
   for (auto &i : lbr_aggregation.fallthrough_counters) {
     uint64_t cnt = i.second;
     auto *from_sym = FindSymbolUsingBinaryAddress(i.first.first);
@@ -669,11 +828,13 @@ void PropellerWholeProgramInfo::CreateFallthroughs(
       (*tmp_bb_fallthrough_counters)[std::make_pair(from_sym, to_sym)] += cnt;
   }
 
-  for (auto &i : *tmp_bb_fallthrough_counters) {
-    std::vector<const SymbolEntry *> path;
-    const SymbolEntry *fallthrough_from = i.first.first,
-                      *fallthrough_to = i.first.second;
-    uint64_t weight = i.second;
+  // Reused by all pairs, CalculateFallthroughBBs clears it.
+  std::vector<const SymbolEntry *> path;
+  for (const auto *i : SortedCounters(*tmp_bb_fallthrough_counters,
+                                      SymbolPtrPairComparator())) {
+    const SymbolEntry *fallthrough_from = i->first.first,
+                      *fallthrough_to = i->first.second;
+    uint64_t weight = i->second;
     if (fallthrough_from == fallthrough_to ||
         !CalculateFallthroughBBs(*fallthrough_from, *fallthrough_to, &path))
       continue;
@@ -683,10 +844,10 @@ void PropellerWholeProgramInfo::CreateFallthroughs(
     CHECK_NE(from_sym, nullptr);
     for (auto *to_sym : path) {
       CHECK_NE(to_sym, nullptr);
-      auto *fallthrough_edge = InternalCreateEdge(
-          from_sym, to_sym, weight, CFGEdge::Kind::kBranchOrFallthough,
-          tmp_node_map, tmp_edge_map);
-      if (!fallthrough_edge) break;
+      if (!InternalCreateEdge(from_sym, to_sym, weight,
+                              CFGEdge::Kind::kBranchOrFallthough, tmp_node_map,
+                              tmp_edge_map, builder))
+        break;
       from_sym = to_sym;
     }
   }
@@ -711,13 +872,18 @@ bool PropellerWholeProgramInfo::CalculateFallthroughBBs(
                  << SymbolNameFormatter(from);
     return false;
   }
-  auto p = address_map_.find(from.addr), q = address_map_.find(to.addr),
-       e = address_map_.end();
-  if (p == e || q == e) {
+  // Walk the address index from the address after "from" up to the address of
+  // "to", both included. Positions p and q are found by binary search, so
+  // the walk does not chase the tree nodes of address_map_.
+  DCHECK_EQ(address_index_.starts.size(), address_map_.size())
+      << "address index is not built or out of date.";
+  const size_t p = address_index_.UpperBound(from.addr),
+               q = address_index_.UpperBound(to.addr);
+  if (p == 0 || address_index_.starts[p - 1] != from.addr || q == 0 ||
+      address_index_.starts[q - 1] != to.addr) {
     LOG(FATAL) << "*** Internal error: invalid symbol in fallthrough pair. ***";
     return false;
   }
-  q = std::next(q);
   if (from.func_ptr != to.func_ptr) {
     LOG(ERROR)
         << "fallthrough (" << SymbolNameFormatter(from) << " -> "
@@ -726,11 +892,12 @@ bool PropellerWholeProgramInfo::CalculateFallthroughBBs(
     return false;
   }
   auto func = from.func_ptr;
-  auto i = p;
-  for (++i; i != q && i != e; ++i) {
-    if (i->second.empty()) continue;
-    if (i->second.size() == 1) {  // 99% of the cases.
-      SymbolEntry *s1 = i->second.front().get();
+  for (size_t i = p; i < q; ++i) {
+    const uint32_t first = address_index_.first_symbol[i],
+                   last = address_index_.first_symbol[i + 1];
+    if (first == last) continue;
+    if (last - first == 1) {  // 99% of the cases.
+      const SymbolEntry *s1 = address_index_.symbols[first];
       if (*s1 == to)
         break;
       // (b/62827958) Sometimes LBR contains duplicate entries in the beginning
@@ -767,28 +934,28 @@ bool PropellerWholeProgramInfo::CalculateFallthroughBBs(
     // TODO(b/154263650, rahmanl): only include symbols that meets
     // SymbolEntry::isFallThroughBlock(). This information is accessible only
     // after we have bbinfo implemented.
-    std::vector<SymbolEntry *> candidates;
+
+    // Symbols at the same address are sorted by ordinal, so they are appended
+    // to "path" directly, up to the first one that is not a basic block of
+    // the same function.
+    const size_t path_size = path->size();
+    bool truncated = false;
     uint64_t last_ordinal = 0;
-    for (auto &se : i->second) {
+    for (uint32_t k = first; k < last; ++k) {
+      const SymbolEntry *se = address_index_.symbols[k];
       CHECK(last_ordinal == 0 || last_ordinal < se->ordinal);
       last_ordinal = se->ordinal;
-      if (*se != to)
-        candidates.push_back(se.get());
+      if (*se == to) continue;
+      CHECK(se->ordinal);
+      truncated |= !se->IsBasicBlock() || se->func_ptr != func;
+      if (!truncated) path->push_back(se);
     }
-    for (auto *sptr : candidates) CHECK(sptr->ordinal);
-    std::sort(candidates.begin(), candidates.end(), SymbolPtrComparator());
-    // find the first that is not from the same function
-    std::vector<SymbolEntry *>::iterator i1 = candidates.begin(),
-                                         ie = candidates.end();
-    while (i1 != ie && (*i1)->IsBasicBlock() && (*i1)->func_ptr == func) ++i1;
-    if (i1 != ie) candidates.erase(i1, ie);
-    if (candidates.empty()) {
+    if (path->size() == path_size) {
       LOG(ERROR) << "failed to find a BB for "
                  << "fallthrough (" << SymbolNameFormatter(from) << " -> "
                  << SymbolNameFormatter(to) << ").";
       return false;
     }
-    path->insert(path->end(), candidates.begin(), candidates.end());
   }
   if (path->size() >= 200)
     LOG(WARNING)
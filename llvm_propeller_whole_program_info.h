@@ -3,6 +3,8 @@
 
 #if defined(HAVE_LLVM)
 
+#include <cstddef>
+#include <cstdint>
 #include <future>  // NOLINT(build/c++11)
 #include <list>
 #include <map>
@@ -15,12 +17,40 @@
 #include "llvm_propeller_options.pb.h"
 #include "llvm_propeller_statistics.h"
 #include "perfdata_reader.h"
+#include "third_party/abseil/absl/container/flat_hash_map.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/MemoryBuffer.h"
 
 namespace devtools_crosstool_autofdo {
 
+// Section .llvm_bb_addr_map consists of many AddrMapEntry.
+struct AddrMapEntry {
+  struct BbInfo {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t meta;
+  };
+
+  uint64_t func_address;
+  // Offset of the first block record of the entry in the section.
+  uint64_t bb_info_offset;
+  // Offset of the next entry in the section.
+  uint64_t end_offset;
+  // The blocks are decoded into storage shared by all entries.
+  llvm::ArrayRef<BbInfo> bb_info;
+};
+
+// Decodes all the entries of the .llvm_bb_addr_map section [begin, end) into
+// "entries", whose blocks are stored in "blocks". Entries are scanned serially,
+// and then decoded in chunks of "entries_per_chunk" entries on up to "jobs"
+// threads.
+bool DecodeBbAddrMap(const uint8_t *begin, const uint8_t *end, unsigned jobs,
+                     size_t entries_per_chunk,
+                     std::vector<AddrMapEntry> *entries,
+                     std::vector<AddrMapEntry::BbInfo> *blocks);
+
 class PropellerWholeProgramInfo : public AbstractPropellerWholeProgramInfo {
  public:
   static const uint64_t kInvalidAddress = static_cast<uint64_t>(-1);
@@ -45,14 +75,17 @@ class PropellerWholeProgramInfo : public AbstractPropellerWholeProgramInfo {
   using SymTabTy =
       std::map<uint64_t, llvm::SmallVector<llvm::object::SymbolRef, 2>>;
 
-  // <from_address, to_address> -> branch counter.
-  // Note all addresses are binary addresses, not runtime addresses.
-  using BranchCountersTy = std::map<std::pair<uint64_t, uint64_t>, uint64_t>;
+  using BranchCountersTy = LBRAggregation::BranchCountersTy;
+  using FallthroughCountersTy = LBRAggregation::FallthroughCountersTy;
 
-  // <fallthrough_from, fallthrough_to> -> fallthrough counter.
-  // Note all addresses are symbol address, not virtual addresses.
-  using FallthroughCountersTy =
-      std::map<std::pair<uint64_t, uint64_t>, uint64_t>;
+  // Temporary maps used while creating CFG edges. They are only used for
+  // lookups, or sorted before being iterated.
+  using SymbolPtrPairEdgeMapTy =
+      absl::flat_hash_map<SymbolPtrPair, CFGBuilder::EdgeId>;
+  // Temp map from SymbolEntry -> node of the CFGBuilder.
+  using SymbolNodeMapTy =
+      std::map<const SymbolEntry *, CFGBuilder::NodeId, SymbolPtrComparator>;
+  using SymbolPtrPairCountersTy = absl::flat_hash_map<SymbolPtrPair, uint64_t>;
 
   static std::unique_ptr<PropellerWholeProgramInfo> Create(
       const PropellerOptions &options);
@@ -93,9 +126,10 @@ class PropellerWholeProgramInfo : public AbstractPropellerWholeProgramInfo {
   const SymTabTy &symtab() const { return symtab_; }
 
   const SymbolEntry *FindSymbolUsingBinaryAddress(uint64_t symbol_addr) const {
-    auto i = address_map_.upper_bound(symbol_addr);
-    if (i == address_map_.begin()) return nullptr;
-    i = std::prev(i);
+    DCHECK_EQ(address_index_.starts.size(), address_map_.size())
+        << "address index is not built or out of date.";
+    const size_t i = address_index_.UpperBound(symbol_addr);
+    if (i == 0) return nullptr;
     // This is similar to "ContainsAnotherSymbol" (but instead of comparing 2
     // symbols, this compares an address with a symbol). The range of valid
     // addressed mapped to a Symbol is [s->addr, s->addr + s->size].
@@ -111,18 +145,20 @@ class PropellerWholeProgramInfo : public AbstractPropellerWholeProgramInfo {
     // Even if 110 is the end address of "s1", we do not return s1, which is
     // wrong.
     //
-    // A note about the size of i->second : i->second is of type
-    // SmallVector<unique_ptr<SymbolEntry>>, which stores a set of symbols that
-    // start at the same address (and the address value is used in i->first as
-    // map key). Most of the time (99%+), the size of i->second is 1.
-    SymbolEntry *func_sym = nullptr;
-    SymbolEntry *bb_sym = nullptr;
-    for (auto &s : i->second) {
+    // A note about the number of symbols of an index entry: these are the
+    // symbols that start at the same address (the address value is stored in
+    // "starts"). Most of the time (99%+), there is only 1 of them.
+    const SymbolEntry *func_sym = nullptr;
+    const SymbolEntry *bb_sym = nullptr;
+    for (uint32_t j = address_index_.first_symbol[i - 1],
+                  e = address_index_.first_symbol[i];
+         j != e; ++j) {
       // TODO(b/166130806): properly handle 2 bb symbols, 1 zero-sized and 1
       // non-zero-sied bb, this may need additional metadata in bbaddrmap.
-      if (s->addr <= symbol_addr && symbol_addr < s->addr + s->size + 1) {
-        if (s->IsFunction() && !func_sym) func_sym = s.get();
-        if (!s->IsFunction() && !bb_sym) bb_sym = s.get();
+      if (symbol_addr <= address_index_.symbol_ends[j]) {
+        const SymbolEntry *s = address_index_.symbols[j];
+        if (s->IsFunction() && !func_sym) func_sym = s;
+        if (!s->IsFunction() && !bb_sym) bb_sym = s;
       }
     }
     if (func_sym && !bb_sym)
@@ -174,6 +210,17 @@ class PropellerWholeProgramInfo : public AbstractPropellerWholeProgramInfo {
   // parsed correctly.
   bool ReadBbAddrMapSection();
 
+  // Returns the symbols of address_map_ at "address", inserting an empty list
+  // if there is none. Symbols are mostly created in increasing address order,
+  // so the insertion is first tried at the end of the map, in constant time.
+  AddressMapTy::mapped_type &InsertAddress(uint64_t address) {
+    return address_map_.try_emplace(address_map_.end(), address)->second;
+  }
+
+  // (Re)builds address_index_ from address_map_. Must be called after
+  // address_map_ is modified and before any symbol lookup.
+  void BuildAddressIndex();
+
   bool WriteSymbolsToProtobuf();
 
   // We select mmap events from perfdata file by comparing the mmap event's
@@ -190,31 +237,26 @@ class PropellerWholeProgramInfo : public AbstractPropellerWholeProgramInfo {
 
   bool DoCreateCfgs(LBRAggregation &&lbr_aggregation);
 
-  // Helper method.
-  CFGEdge *InternalCreateEdge(
-      const SymbolEntry *from_sym, const SymbolEntry *to_sym, uint64_t weight,
-      CFGEdge::Kind edge_kind,
-      const std::map<const SymbolEntry *, CFGNode *, SymbolPtrComparator>
-          &tmp_node_map,
-      std::map<SymbolPtrPair, CFGEdge *, SymbolPtrPairComparator>
-          *tmp_edge_map);
+  // Helper method. Returns false if no edge is created for the symbols.
+  bool InternalCreateEdge(const SymbolEntry *from_sym,
+                          const SymbolEntry *to_sym, uint64_t weight,
+                          CFGEdge::Kind edge_kind,
+                          const SymbolNodeMapTy &tmp_node_map,
+                          SymbolPtrPairEdgeMapTy *tmp_edge_map,
+                          CFGBuilder *builder);
 
   // Helper method that creates edges and assign edge weights using
   // branch_counters_. Details in .cc.
   bool CreateEdges(const LBRAggregation &lbr_aggregation,
-                   const std::map<const SymbolEntry *, CFGNode *,
-                                  SymbolPtrComparator> &tmp_node_map);
+                   const SymbolNodeMapTy &tmp_node_map, CFGBuilder *builder);
 
   // Helper method that creates edges and assign edge weights using
   // branch_counters_. Details in .cc.
-  void CreateFallthroughs(
-      const LBRAggregation &lbr_aggregation,
-      const std::map<const SymbolEntry *, CFGNode *, SymbolPtrComparator>
-          &tmp_node_map,
-      std::map<SymbolPtrPair, uint64_t, SymbolPtrPairComparator>
-          *tmp_bb_fallthrough_counters,
-      std::map<SymbolPtrPair, CFGEdge *, SymbolPtrPairComparator>
-          *tmp_edge_map);
+  void CreateFallthroughs(const LBRAggregation &lbr_aggregation,
+                          const SymbolNodeMapTy &tmp_node_map,
+                          SymbolPtrPairCountersTy *tmp_bb_fallthrough_counters,
+                          SymbolPtrPairEdgeMapTy *tmp_edge_map,
+                          CFGBuilder *builder);
 
   // Compute fallthrough BBs for "from" -> "to", and place them in "path".
   // ("from" and "to" are excluded). Details in .cc.
@@ -237,6 +279,34 @@ class PropellerWholeProgramInfo : public AbstractPropellerWholeProgramInfo {
   std::list<std::unique_ptr<char, Deleter>> string_vault_;
   // See AddressMapTy.
   AddressMapTy address_map_;
+
+  // A frozen, flat copy of address_map_ used by FindSymbolUsingBinaryAddress,
+  // which runs twice for every aggregated branch and fallthrough. Lookups
+  // binary search a contiguous array of start addresses instead of chasing
+  // the tree nodes of address_map_.
+  struct AddressIndex {
+    // Returns the index of the first start address greater than "addr", or
+    // starts.size() if there is none. The search is branchless, so it does not
+    // suffer from mispredictions on random addresses.
+    size_t UpperBound(uint64_t addr) const {
+      if (starts.empty()) return 0;
+      const uint64_t *base = starts.data();
+      for (size_t n = starts.size(); n > 1; n -= n / 2)
+        base = base[n / 2] <= addr ? base + n / 2 : base;
+      return (base - starts.data()) + (*base <= addr);
+    }
+
+    // Sorted addresses of address_map_. The symbols starting at starts[i] are
+    // symbols[first_symbol[i], first_symbol[i + 1]), and "first_symbol" has
+    // one more element than "starts".
+    std::vector<uint64_t> starts;
+    std::vector<uint32_t> first_symbol;
+    // Parallel arrays of the symbols and the last address they cover
+    // (s->addr + s->size), so the range check does not dereference them.
+    std::vector<uint64_t> symbol_ends;
+    std::vector<const SymbolEntry *> symbols;
+  };
+  AddressIndex address_index_;
   // See BbAddrMapTy.
   BbAddrMapTy bb_addr_map_;
 
@@ -1,9 +1,14 @@
 #include "llvm_propeller_whole_program_info.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <numeric>
+#include <set>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "llvm_propeller_bbsections.h"
 #include "llvm_propeller_cfg.h"
@@ -14,6 +19,7 @@
 #include "gtest/gtest.h"
 #include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/strings/str_cat.h"
+#include "llvm/Support/LEB128.h"
 #include "llvm/Support/Path.h"
 
 #define FLAGS_test_tmpdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
@@ -22,6 +28,7 @@
 
 namespace {
 
+using ::devtools_crosstool_autofdo::AddrMapEntry;
 using ::devtools_crosstool_autofdo::CFGEdge;
 using ::devtools_crosstool_autofdo::CFGNode;
 using ::devtools_crosstool_autofdo::ControlFlowGraph;
@@ -72,12 +79,12 @@ TEST(LlvmPropellerWholeProgramInfo, CreateCFG) {
   EXPECT_GE(main->nodes().size(), 4);
 
   EXPECT_GE(main->inter_edges().size(), 1);
-  EXPECT_TRUE(main->inter_edges().front()->IsCall());
-  EXPECT_GT(main->inter_edges().front()->weight(), 100);
+  EXPECT_TRUE(main->inter_edges().front().IsCall());
+  EXPECT_GT(main->inter_edges().front().weight(), 100);
 
   EXPECT_GE(compute_flag->inter_edges().size(), 1);
-  EXPECT_TRUE(compute_flag->inter_edges().front()->IsReturn());
-  EXPECT_GT(compute_flag->inter_edges().front()->weight(), 100);
+  EXPECT_TRUE(compute_flag->inter_edges().front().IsReturn());
+  EXPECT_GT(compute_flag->inter_edges().front().weight(), 100);
 }
 
 // This test checks that the mock can load a CFG from the serialized format
@@ -96,7 +103,7 @@ TEST(LlvmPropellerMockWholeProgramInfo, CreateCFGFromProto) {
   const ControlFlowGraph *main = wpi.FindCfg("main");
   EXPECT_NE(main, (nullptr));
   EXPECT_FALSE(main->inter_edges().empty());
-  CFGEdge &edge = *(main->inter_edges().front());
+  const CFGEdge &edge = main->inter_edges().front();
   EXPECT_EQ(edge.src()->cfg(), main);
   EXPECT_NE(edge.sink()->cfg(), main);
   // The same "edge" instance exists both in src->inter_outs_ and
@@ -189,6 +196,123 @@ TEST(LlvmPropellerWholeProgramInfoBbAddrMapTest, ReadBbAddrMap) {
   }
 }
 
+TEST(LlvmPropellerWholeProgramInfoBbAddrMapTest,
+     ReadBbAddrMapWithMultipleJobs) {
+  // Returns <ordinal, address, size, metadata> for all symbols.
+  auto read_symbols = [](unsigned jobs) {
+    std::vector<std::tuple<uint64_t, uint64_t, uint64_t, uint32_t>> symbols;
+    auto wpi = PropellerWholeProgramInfo::Create(PropellerOptions(
+        PropellerOptionsBuilder()
+            .SetBinaryName(absl::StrCat(FLAGS_test_srcdir,
+                                        "/testdata/"
+                                        "propeller_from_icu_genrb"))
+            .SetClusterOutName("dummy.out")
+            .SetJobs(jobs)));
+    if (wpi == nullptr) return symbols;
+    wpi->ReadSymbolTable();
+    if (!wpi->ReadBbAddrMapSection()) return symbols;
+    for (auto &l1 : wpi->address_map())
+      for (const std::unique_ptr<SymbolEntry> &sym : l1.second)
+        symbols.emplace_back(sym->ordinal, sym->addr, sym->size,
+                             sym->metadata);
+    return symbols;
+  };
+  auto symbols = read_symbols(1);
+  EXPECT_FALSE(symbols.empty());
+  EXPECT_EQ(read_symbols(4), symbols);
+}
+
+TEST(LlvmPropellerWholeProgramInfoBbAddrMapTest, DecodeBbAddrMapInChunks) {
+  // A section of 11 entries with 0 to 4 blocks each, some of whose fields are
+  // encoded on several bytes.
+  using Blocks = std::vector<std::tuple<uint64_t, uint64_t, uint64_t>>;
+  std::vector<std::pair<uint64_t, Blocks>> expected;
+  std::vector<uint8_t> section;
+  auto append_uleb = [&section](uint64_t value) {
+    uint8_t bytes[16];
+    const unsigned size = llvm::encodeULEB128(value, bytes);
+    section.insert(section.end(), bytes, bytes + size);
+  };
+  for (uint64_t i = 0; i < 11; ++i) {
+    const uint64_t address = 0x401000 + 0x1000 * i;
+    const uint8_t *address_bytes = reinterpret_cast<const uint8_t *>(&address);
+    section.insert(section.end(), address_bytes,
+                   address_bytes + sizeof(address));
+    append_uleb(i % 5);
+    Blocks blocks;
+    for (uint64_t b = 0; b < i % 5; ++b) {
+      blocks.emplace_back(b * 200, 10 + i * 50, b);
+      append_uleb(b * 200);
+      append_uleb(10 + i * 50);
+      append_uleb(b);
+    }
+    expected.emplace_back(address, std::move(blocks));
+  }
+
+  // Returns the address and blocks of every entry.
+  auto decode = [&section](unsigned jobs, size_t entries_per_chunk) {
+    std::vector<AddrMapEntry> entries;
+    std::vector<AddrMapEntry::BbInfo> blocks_storage;
+    std::vector<std::pair<uint64_t, Blocks>> decoded;
+    if (!devtools_crosstool_autofdo::DecodeBbAddrMap(
+            section.data(), section.data() + section.size(), jobs,
+            entries_per_chunk, &entries, &blocks_storage))
+      return decoded;
+    for (const AddrMapEntry &entry : entries) {
+      Blocks blocks;
+      for (const AddrMapEntry::BbInfo &block : entry.bb_info)
+        blocks.emplace_back(block.offset, block.size, block.meta);
+      decoded.emplace_back(entry.func_address, std::move(blocks));
+    }
+    return decoded;
+  };
+  EXPECT_EQ(decode(1, 1024), expected);
+  // 6 chunks, decoded on 4 threads.
+  EXPECT_EQ(decode(4, 2), expected);
+  EXPECT_EQ(decode(16, 1), expected);
+
+  // A truncated section is rejected whatever the number of jobs.
+  section.pop_back();
+  std::vector<AddrMapEntry> entries;
+  std::vector<AddrMapEntry::BbInfo> blocks_storage;
+  EXPECT_FALSE(devtools_crosstool_autofdo::DecodeBbAddrMap(
+      section.data(), section.data() + section.size(), 4, 2, &entries,
+      &blocks_storage));
+}
+
+TEST(LlvmPropellerWholeProgramInfoBbAddrMapTest, FindSymbolUsingBinaryAddress) {
+  const std::string binary =
+      absl::StrCat(FLAGS_test_srcdir,
+                   "/testdata/"
+                   "propeller_sample.bin");
+  auto wpi = PropellerWholeProgramInfo::Create(PropellerOptions(
+      PropellerOptionsBuilder().SetBinaryName(binary).SetClusterOutName(
+          "dummy.out")));
+  ASSERT_NE(nullptr, wpi) << "Could not initialize whole program info";
+  wpi->ReadSymbolTable();
+  ASSERT_TRUE(wpi->ReadBbAddrMapSection());
+  ASSERT_FALSE(wpi->address_map().empty());
+
+  // Addresses before the first symbol and after the last one.
+  EXPECT_EQ(wpi->FindSymbolUsingBinaryAddress(
+                wpi->address_map().begin()->first - 1),
+            nullptr);
+  uint64_t last_end = 0;
+  for (const std::unique_ptr<SymbolEntry> &sym :
+       wpi->address_map().rbegin()->second)
+    last_end = std::max(last_end, sym->addr + sym->size);
+  EXPECT_EQ(wpi->FindSymbolUsingBinaryAddress(last_end + 1), nullptr);
+
+  // Addresses inside a basic block resolve to that block, including the entry
+  // block, which shares its address with the function symbol.
+  for (const SymbolEntry *sym : wpi->bb_addr_map().at("compute_flag")) {
+    EXPECT_EQ(wpi->FindSymbolUsingBinaryAddress(sym->addr)->addr, sym->addr);
+    if (sym->size < 2) continue;
+    EXPECT_EQ(wpi->FindSymbolUsingBinaryAddress(sym->addr + sym->size / 2),
+              sym);
+  }
+}
+
 TEST(LlvmPropellerWholeProgramInfoBbInfoTest, CreateCfgsFromBbInfo) {
   const PropellerOptions options(
       PropellerOptionsBuilder()
@@ -205,7 +329,7 @@ TEST(LlvmPropellerWholeProgramInfoBbInfoTest, CreateCfgsFromBbInfo) {
   EXPECT_TRUE(ii != cfgs.end());
   const ControlFlowGraph &main_cfg = *(ii->second);
   EXPECT_GT(main_cfg.nodes().size(), 1);
-  CFGNode *entry = main_cfg.nodes().begin()->get();
+  CFGNode *entry = &main_cfg.nodes().front();
   SymbolEntry *main_sym =
       whole_program_info->bb_addr_map().at("main").front()->func_ptr;
   // "main_sym" is a function symbol, and function symbol does not correspond to
@@ -292,9 +416,9 @@ TEST(LlvmPropellerWholeProgramInfoBbInfoTest, TestMultiplePerfDataFiles) {
   auto initialize_edge_set =
       [](ControlFlowGraph *cfg,
          std::set<std::pair<uint64_t, uint64_t>> &edge_set) {
-        for (auto &edge : cfg->intra_edges())
-          edge_set.emplace(edge->src()->symbol_ordinal(),
-                           edge->sink()->symbol_ordinal());
+        for (const CFGEdge &edge : cfg->intra_edges())
+          edge_set.emplace(edge.src()->symbol_ordinal(),
+                           edge.sink()->symbol_ordinal());
       };
   initialize_edge_set(cfg1, edge_set1);
   initialize_edge_set(cfg2, edge_set2);
@@ -320,9 +444,8 @@ TEST(LlvmPropellerWholeProgramInfoBbInfoTest, TestMultiplePerfDataFiles) {
   // those constructed from perf1 and perf2 together.
   EXPECT_EQ(union12, edge_set12);
 
-  auto accumutor = [](uint64_t acc,
-                      const std::unique_ptr<CFGEdge> &e) -> uint64_t {
-    return acc + e->weight();
+  auto accumutor = [](uint64_t acc, const CFGEdge &e) -> uint64_t {
+    return acc + e.weight();
   };
   uint64_t weight1 = std::accumulate(cfg1->intra_edges().begin(),
                                      cfg1->intra_edges().end(), 0, accumutor);
@@ -335,6 +458,47 @@ TEST(LlvmPropellerWholeProgramInfoBbInfoTest, TestMultiplePerfDataFiles) {
   EXPECT_EQ(weight1 + weight2, weight12);
 }
 
+TEST(LlvmPropellerWholeProgramInfoBbInfoTest, TestParallelPerfDataParsing) {
+  const std::string perf1 =
+      GetAutoFdoTestDataFilePath("propeller_sample_1.perfdata1");
+  auto init_whole_program_info =
+      [&](uint32_t jobs) -> std::unique_ptr<PropellerWholeProgramInfo> {
+    PropellerOptionsBuilder options_builder;
+    options_builder
+        .SetBinaryName(GetAutoFdoTestDataFilePath("propeller_sample_1.bin"))
+        .SetJobs(jobs);
+    for (int i = 0; i < 5; ++i) options_builder.AddPerfNames(perf1);
+    const PropellerOptions options(options_builder);
+    std::unique_ptr<PropellerWholeProgramInfo> wpi =
+        PropellerWholeProgramInfo::Create(options);
+    EXPECT_NE(wpi.get(), nullptr);
+    EXPECT_TRUE(wpi->CreateCfgs());
+    return wpi;
+  };
+
+  // Returns <src, sink, weight> for all edges of all cfgs.
+  auto get_edges = [](const PropellerWholeProgramInfo &wpi) {
+    std::set<std::tuple<uint64_t, uint64_t, uint64_t>> edges;
+    for (const auto &[unused, cfg] : wpi.cfgs()) {
+      for (llvm::ArrayRef<CFGEdge> edge_list :
+           {cfg->intra_edges(), cfg->inter_edges()})
+        for (const CFGEdge &edge : edge_list)
+          edges.emplace(edge.src()->symbol_ordinal(),
+                        edge.sink()->symbol_ordinal(), edge.weight());
+    }
+    return edges;
+  };
+
+  auto serial_wpi = init_whole_program_info(1);
+  auto parallel_wpi = init_whole_program_info(3);
+  EXPECT_EQ(serial_wpi->stats().perf_file_parsed, 5);
+  EXPECT_EQ(parallel_wpi->stats().perf_file_parsed, 5);
+  EXPECT_EQ(serial_wpi->stats().br_counters_accumulated,
+            parallel_wpi->stats().br_counters_accumulated);
+  EXPECT_FALSE(get_edges(*serial_wpi).empty());
+  EXPECT_EQ(get_edges(*serial_wpi), get_edges(*parallel_wpi));
+}
+
 TEST(LlvmPropellerWholeProgramInfoBbInfoTest, TestDroppingInvalidDataFile) {
   const PropellerOptions options = PropellerOptions(
       PropellerOptionsBuilder()
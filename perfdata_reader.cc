@@ -1,8 +1,10 @@
 #include "perfdata_reader.h"
 
+#include <algorithm>
 #include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "third_party/abseil/absl/strings/str_format.h"
 #include "llvm/ADT/ArrayRef.h"
@@ -264,8 +266,17 @@ bool PerfDataReader::SelectBinaryInfo(const std::string &binary_file_name,
 bool PerfDataReader::SelectPerfInfo(const std::string &perf_file,
                                     const std::string &match_mmap_name,
                                     BinaryPerfInfo *binary_perf_info) const {
-  // "binary_info" must already be initialized.
-  if (!(binary_perf_info->binary_info.file_content)) return false;
+  // "binary_info" must already be initialized, which means at least one
+  // loadable segment is found.
+  if (binary_perf_info->binary_info.segments.empty()) return false;
+  if (stream_perf_data_) {
+    if (auto perf_stream = PerfDataStream::Open(perf_file)) {
+      binary_perf_info->perf_stream = std::move(perf_stream);
+      return SelectMMaps(binary_perf_info, match_mmap_name);
+    }
+    LOG(INFO) << "Cannot stream perf data file '" << perf_file
+              << "', parsing it with quipper.";
+  }
   auto perf_reader = std::make_unique<quipper::PerfReader>();
   if (!perf_reader->ReadFile(perf_file)) {
     LOG(ERROR) << "Failed to read perf data file: " << perf_file;
@@ -296,8 +307,15 @@ llvm::Optional<std::set<std::string>> FindFileNameInPerfDataWithFileBuildId(
   LOG(INFO) << "Build Id found in '" << binary_file_name
             << "': " << info->binary_info.build_id;
   std::set<std::string> buildid_names;
-  if (PerfDataReader().GetBuildIdNames(
-          *(info->perf_reader), info->binary_info.build_id, &buildid_names)) {
+  bool found =
+      info->perf_stream
+          ? PerfDataReader::GetBuildIdNames(info->perf_stream->build_ids(),
+                                            info->binary_info.build_id,
+                                            &buildid_names)
+          : PerfDataReader().GetBuildIdNames(*(info->perf_reader),
+                                             info->binary_info.build_id,
+                                             &buildid_names);
+  if (found) {
     for (const std::string &fn : buildid_names)
       LOG(INFO) << "Build Id '" << info->binary_info.build_id
                 << "' has filename '" << fn << "'.";
@@ -324,24 +342,14 @@ bool PerfDataReader::SelectMMaps(BinaryPerfInfo *info,
         std::set<std::string>({match_mmap_name}));
   }
 
-  for (const auto &pe : info->perf_parser->parsed_events()) {
-    quipper::PerfDataProto_PerfEvent *event_ptr = pe.event_ptr;
-    if (event_ptr->event_type_case() !=
-        quipper::PerfDataProto_PerfEvent::kMmapEvent)
-      continue;
-    const quipper::PerfDataProto_MMapEvent &mmap_evt = event_ptr->mmap_event();
-    if (!mmap_evt.has_filename() || mmap_evt.filename().empty() ||
-        !mmap_evt.has_start() || !mmap_evt.has_len() || !mmap_evt.has_pid())
-      continue;
-
-    if (!(*mmap_selector)(mmap_evt.filename())) continue;
-
-    uint64_t load_addr = mmap_evt.start();
-    uint64_t load_size = mmap_evt.len();
-    uint64_t page_offset = mmap_evt.has_pgoff() ? mmap_evt.pgoff() : 0;
+  // Records one mmap event of the selected binary. Returns false if it
+  // conflicts with an existing mmap of the same process.
+  auto add_mmap = [&](uint64_t pid, uint64_t load_addr, uint64_t load_size,
+                      uint64_t page_offset, const std::string &filename) {
+    if (filename.empty() || !(*mmap_selector)(filename)) return true;
 
     bool entry_exists = false;
-    auto existing_mmaps = info->binary_mmaps.find(mmap_evt.pid());
+    auto existing_mmaps = info->binary_mmaps.find(pid);
     if (existing_mmaps != info->binary_mmaps.end()) {
       for (const MMapEntry &e : existing_mmaps->second) {
         if (e.load_addr == load_addr && e.load_size == load_size &&
@@ -363,18 +371,46 @@ bool PerfDataReader::SelectMMaps(BinaryPerfInfo *info,
       }
       if (!entry_exists)
         existing_mmaps->second.emplace(load_addr, load_size, page_offset,
-                                       mmap_evt.filename());
+                                       filename);
     } else {
-      info->binary_mmaps[mmap_evt.pid()].emplace(
-          load_addr, load_size, page_offset, mmap_evt.filename());
+      info->binary_mmaps[pid].emplace(load_addr, load_size, page_offset,
+                                      filename);
     }
-  }  // End of iterating perf mmap events.
+    return true;
+  };
+
+  if (info->perf_stream) {
+    // Mmaps are few, so they are read at once to deduce huge page mappings
+    // and combine split mappings like quipper does.
+    std::vector<PerfDataStream::MMapRecord> mmaps;
+    if (!info->perf_stream->ReadMMaps(&mmaps)) return false;
+    for (const PerfDataStream::MMapRecord &mmap : mmaps)
+      if (!add_mmap(mmap.pid, mmap.start, mmap.len, mmap.pgoff, mmap.filename))
+        return false;
+  } else {
+    for (const auto &pe : info->perf_parser->parsed_events()) {
+      quipper::PerfDataProto_PerfEvent *event_ptr = pe.event_ptr;
+      if (event_ptr->event_type_case() !=
+          quipper::PerfDataProto_PerfEvent::kMmapEvent)
+        continue;
+      const quipper::PerfDataProto_MMapEvent &mmap_evt =
+          event_ptr->mmap_event();
+      if (!mmap_evt.has_filename() || !mmap_evt.has_start() ||
+          !mmap_evt.has_len() || !mmap_evt.has_pid())
+        continue;
+      if (!add_mmap(mmap_evt.pid(), mmap_evt.start(), mmap_evt.len(),
+                    mmap_evt.has_pgoff() ? mmap_evt.pgoff() : 0,
+                    mmap_evt.filename()))
+        return false;
+    }  // End of iterating perf mmap events.
+  }
 
   if (info->binary_mmaps.empty()) {
     LOG(ERROR) << "Failed to find any mmap entries matching: '" << match_fn
                << "'.";
     return false;
   }
+  IndexMMaps(info);
   for (auto &mpid : info->binary_mmaps) {
     std::stringstream ss;
     ss << "Found mmap: pid=" << std::noshowbase << std::dec << mpid.first
@@ -385,6 +421,52 @@ bool PerfDataReader::SelectMMaps(BinaryPerfInfo *info,
   return true;
 }
 
+// Splits every mmap into ranges that each map to a single loadable segment
+// (or to none), so that translating an address only needs a binary search for
+// the range and an addition.
+void PerfDataReader::IndexMMaps(BinaryPerfInfo *bpi) {
+  const BinaryInfo &binary_info = bpi->binary_info;
+  std::vector<BinaryInfo::Segment> segments = binary_info.segments;
+  std::sort(segments.begin(), segments.end(),
+            [](const BinaryInfo::Segment &a, const BinaryInfo::Segment &b) {
+              return a.offset < b.offset;
+            });
+  bpi->mmap_ranges.clear();
+  for (const auto &[pid, mmaps] : bpi->binary_mmaps) {
+    std::vector<MMapRange> &ranges = bpi->mmap_ranges[pid];
+    // Mmaps of a pid never overlap, so ranges come out sorted.
+    for (const MMapEntry &mmap : mmaps) {
+      const uint64_t end = mmap.load_addr + mmap.load_size;
+      if (!binary_info.is_pie) {
+        ranges.push_back({mmap.load_addr, end, 0, true, &mmap});
+        continue;
+      }
+      uint64_t cur = mmap.load_addr;
+      for (const auto &segment : segments) {
+        // Runtime range of the segment's part which is inside this mmap.
+        if (segment.offset + segment.memsz <= mmap.page_offset) continue;
+        uint64_t seg_start =
+            segment.offset <= mmap.page_offset
+                ? mmap.load_addr
+                : mmap.load_addr + (segment.offset - mmap.page_offset);
+        uint64_t seg_end = mmap.load_addr + (segment.offset + segment.memsz -
+                                             mmap.page_offset);
+        seg_start = std::max(seg_start, cur);
+        seg_end = std::min(seg_end, end);
+        if (seg_start >= seg_end) continue;
+        if (cur < seg_start)
+          ranges.push_back({cur, seg_start, 0, false, &mmap});
+        ranges.push_back({seg_start, seg_end,
+                          segment.vaddr - segment.offset + mmap.page_offset -
+                              mmap.load_addr,
+                          true, &mmap});
+        cur = seg_end;
+      }
+      if (cur < end) ranges.push_back({cur, end, 0, false, &mmap});
+    }
+  }
+}
+
 // This function translates runtime address to symbol address:
 // First of all, we find all the mmaps that have "pid", and from those to pick a
 // single mmap that covers "addr".
@@ -394,53 +476,62 @@ bool PerfDataReader::SelectMMaps(BinaryPerfInfo *info,
 //
 // Thirdly, find the segment that contains file_offste, and compute symbol
 // address as "file_offset - segment.offset + segment.vaddr".
+//
+// The last two steps are precomputed by IndexMMaps as a bias per mmap range.
 uint64_t PerfDataReader::RuntimeAddressToBinaryAddress(
     uint64_t pid, uint64_t addr, const BinaryPerfInfo &bpi) const {
-  auto i = bpi.binary_mmaps.find(pid);
-  if (i == bpi.binary_mmaps.end()) return kInvalidAddress;
-  const MMapEntry *mmap = nullptr;
-  for (const MMapEntry &p : i->second)
-    if (p.load_addr <= addr && addr < p.load_addr + p.load_size) mmap = &p;
-  if (!mmap) return kInvalidAddress;
-  if (!bpi.binary_info.is_pie) return addr;
-
-  uint64_t file_offset = addr - mmap->load_addr + mmap->page_offset;
-  for (const auto &segment : bpi.binary_info.segments) {
-    if (segment.offset <= file_offset &&
-        file_offset < segment.offset + segment.memsz) {
-      return file_offset - segment.offset + segment.vaddr;
-    }
+  AddressTranslationCache cache;
+  return RuntimeAddressToBinaryAddress(pid, addr, bpi, &cache);
+}
+
+uint64_t PerfDataReader::RuntimeAddressToBinaryAddress(
+    uint64_t pid, uint64_t addr, const BinaryPerfInfo &bpi,
+    AddressTranslationCache *cache) const {
+  if (!cache->ranges || cache->pid != pid) {
+    auto i = bpi.mmap_ranges.find(pid);
+    if (i == bpi.mmap_ranges.end()) return kInvalidAddress;
+    cache->pid = pid;
+    cache->ranges = &i->second;
+    cache->range = nullptr;
+  }
+  const MMapRange *range = cache->range;
+  if (!range || addr < range->start || addr >= range->end) {
+    const std::vector<MMapRange> &ranges = *cache->ranges;
+    auto i = std::upper_bound(
+        ranges.begin(), ranges.end(), addr,
+        [](uint64_t a, const MMapRange &r) { return a < r.start; });
+    if (i == ranges.begin()) return kInvalidAddress;
+    range = &*std::prev(i);
+    if (addr >= range->end) return kInvalidAddress;
+    cache->range = range;
   }
-  LOG(WARNING) << absl::StrFormat(
-      "pid: %u, virtual address: %#x belongs to '%s', file_offset=%lu, not "
-      "inside any loadable segment.",
-      pid, addr, mmap->file_name, file_offset);
-  return kInvalidAddress;
+  if (!range->in_segment) {
+    const MMapEntry *mmap = range->mmap;
+    uint64_t file_offset = addr - mmap->load_addr + mmap->page_offset;
+    LOG(WARNING) << absl::StrFormat(
+        "pid: %u, virtual address: %#x belongs to '%s', file_offset=%lu, not "
+        "inside any loadable segment.",
+        pid, addr, mmap->file_name, file_offset);
+    return kInvalidAddress;
+  }
+  return addr + range->bias;
 }
 
 void PerfDataReader::AggregateLBR(const BinaryPerfInfo &binary_perf_info,
                                   LBRAggregation *result) const {
-  for (const auto &pe : binary_perf_info.perf_parser->parsed_events()) {
-    quipper::PerfDataProto_PerfEvent *event_ptr = pe.event_ptr;
-    if (event_ptr->event_type_case() !=
-        quipper::PerfDataProto_PerfEvent::kSampleEvent)
-      continue;
-    auto &event = event_ptr->sample_event();
-    if (!event.has_pid() || binary_perf_info.binary_mmaps.find(event.pid()) ==
-                                binary_perf_info.binary_mmaps.end())
-      continue;
-
-    uint64_t pid = event.pid();
-    const auto &brstack = event.branch_stack();
-    if (brstack.empty()) continue;
+  // Aggregates one branch stack of "size" entries, where get_branch(p)
+  // returns the runtime <from, to> addresses of the p-th entry (the most
+  // recent branch comes first).
+  AddressTranslationCache cache;
+  auto aggregate_branch_stack = [&](uint64_t pid, int size, auto get_branch) {
     uint64_t last_from = kInvalidAddress;
     uint64_t last_to = kInvalidAddress;
-    for (int p = brstack.size() - 1; p >= 0; --p) {
-      const auto &be = brstack.Get(p);
-      uint64_t from =
-          RuntimeAddressToBinaryAddress(pid, be.from_ip(), binary_perf_info);
+    for (int p = size - 1; p >= 0; --p) {
+      auto [from_ip, to_ip] = get_branch(p);
+      uint64_t from = RuntimeAddressToBinaryAddress(pid, from_ip,
+                                                    binary_perf_info, &cache);
       uint64_t to =
-          RuntimeAddressToBinaryAddress(pid, be.to_ip(), binary_perf_info);
+          RuntimeAddressToBinaryAddress(pid, to_ip, binary_perf_info, &cache);
       // NOTE(shenhan): LBR sometimes duplicates the first entry by mistake (*).
       // For now we treat these to be true entries.
       // (*)  (p == 0 && from == lastFrom && to == lastTo) ==> true
@@ -451,24 +542,70 @@ void PerfDataReader::AggregateLBR(const BinaryPerfInfo &binary_perf_info,
       last_to = to;
       last_from = from;
     }  // End of iterating one br record
-  }    // End of iterating all br records.
+  };
+
+  if (binary_perf_info.perf_stream) {
+    // Samples are decoded one at a time straight from the file.
+    if (!binary_perf_info.perf_stream->ForEachBranchStackSample(
+            [&](uint32_t pid,
+                const std::vector<PerfDataStream::BranchEntry> &brstack) {
+              if (binary_perf_info.binary_mmaps.find(pid) ==
+                  binary_perf_info.binary_mmaps.end())
+                return;
+              aggregate_branch_stack(pid, brstack.size(), [&](int p) {
+                return std::make_pair(brstack[p].from, brstack[p].to);
+              });
+            }))
+      LOG(WARNING) << "Stopped reading branch records from '"
+                   << binary_perf_info.perf_stream->file_name()
+                   << "' at the first malformed record.";
+    return;
+  }
+
+  for (const auto &pe : binary_perf_info.perf_parser->parsed_events()) {
+    quipper::PerfDataProto_PerfEvent *event_ptr = pe.event_ptr;
+    if (event_ptr->event_type_case() !=
+        quipper::PerfDataProto_PerfEvent::kSampleEvent)
+      continue;
+    auto &event = event_ptr->sample_event();
+    if (!event.has_pid() || binary_perf_info.binary_mmaps.find(event.pid()) ==
+                                binary_perf_info.binary_mmaps.end())
+      continue;
+
+    const auto &brstack = event.branch_stack();
+    if (brstack.empty()) continue;
+    aggregate_branch_stack(event.pid(), brstack.size(), [&](int p) {
+      const auto &be = brstack.Get(p);
+      return std::make_pair(be.from_ip(), be.to_ip());
+    });
+  }  // End of iterating all br records.
 }
 
 bool PerfDataReader::GetBuildIdNames(const quipper::PerfReader &perf_reader,
                                      const std::string &buildid,
                                      std::set<std::string> *buildid_names) {
-  buildid_names->clear();
-  std::list<std::pair<std::string, std::string>> existing_build_ids;
+  std::vector<std::pair<std::string, std::string>> file_build_ids;
   for (const auto &buildid_entry : perf_reader.build_ids()) {
     if (!buildid_entry.has_filename() || !buildid_entry.has_build_id_hash())
       continue;
-    const std::string &perf_build_id = buildid_entry.build_id_hash();
+    file_build_ids.emplace_back(buildid_entry.filename(),
+                                buildid_entry.build_id_hash());
+  }
+  return GetBuildIdNames(file_build_ids, buildid, buildid_names);
+}
+
+bool PerfDataReader::GetBuildIdNames(
+    const std::vector<std::pair<std::string, std::string>> &file_build_ids,
+    const std::string &buildid, std::set<std::string> *buildid_names) {
+  buildid_names->clear();
+  std::list<std::pair<std::string, std::string>> existing_build_ids;
+  for (const auto &[filename, perf_build_id] : file_build_ids) {
     std::string ascii_build_id = BinaryDataToAscii(perf_build_id);
-    existing_build_ids.emplace_back(buildid_entry.filename(), ascii_build_id);
+    existing_build_ids.emplace_back(filename, ascii_build_id);
     if (ascii_build_id == buildid) {
-      LOG(INFO) << "Found file name with matching buildid: '"
-                << buildid_entry.filename() << "'.";
-      buildid_names->insert(buildid_entry.filename());
+      LOG(INFO) << "Found file name with matching buildid: '" << filename
+                << "'.";
+      buildid_names->insert(filename);
     }
   }
   if (!buildid_names->empty()) return true;
@@ -8,9 +8,11 @@
 #include <utility>
 #include <vector>
 
+#include "third_party/abseil/absl/container/flat_hash_map.h"
 #include "llvm/BinaryFormat/ELF.h"
 #include "llvm/Object/ELFObjectFile.h"
 #include "llvm/Object/ObjectFile.h"
+#include "perfdata_stream.h"
 #include "quipper/perf_parser.h"
 
 namespace devtools_crosstool_autofdo {
@@ -67,14 +69,50 @@ struct BinaryInfo {
         is_pie(bi.is_pie),
         segments(std::move(bi.segments)),
         build_id(std::move(bi.build_id)) {}
+  BinaryInfo &operator=(BinaryInfo &&bi) = default;
+
+  // Returns a copy of everything except file content and object file, which
+  // is all that is needed to select mmaps from and translate addresses in
+  // perf data.
+  BinaryInfo CopyWithoutContent() const {
+    BinaryInfo bi;
+    bi.file_name = file_name;
+    bi.is_pie = is_pie;
+    bi.segments = segments;
+    bi.build_id = build_id;
+    return bi;
+  }
 };
 
 // MMaps indexed by pid.
 using BinaryMMaps = std::map<uint64_t, std::set<MMapEntry>>;
 
+// A runtime address range [start, end) of a mmap which translates to binary
+// addresses with a single bias. Mmaps are split at the boundaries of the
+// binary's loadable segments.
+struct MMapRange {
+  uint64_t start;
+  uint64_t end;
+  // binary address = runtime address + bias (modulo 2^64).
+  uint64_t bias;
+  // Whether the range is backed by a loadable segment. Addresses in ranges
+  // which are not cannot be translated.
+  bool in_segment;
+  // The mmap containing this range, which points into BinaryMMaps.
+  const MMapEntry *mmap;
+};
+
+// MMapRanges of every pid, sorted by start address.
+using MMapRangeIndex = absl::flat_hash_map<uint64_t, std::vector<MMapRange>>;
+
 struct BinaryPerfInfo {
   BinaryMMaps binary_mmaps;
+  // Index over binary_mmaps used for address translation.
+  MMapRangeIndex mmap_ranges;
   BinaryInfo binary_info;
+  // Streaming reader of the perf data file. When this is set, events are
+  // decoded on demand and perf_reader / perf_parser are not used.
+  std::unique_ptr<PerfDataStream> perf_stream;
   std::unique_ptr<quipper::PerfReader> perf_reader;
   std::unique_ptr<quipper::PerfParser> perf_parser;
 
@@ -83,14 +121,18 @@ struct BinaryPerfInfo {
   BinaryPerfInfo() {}
   BinaryPerfInfo(BinaryPerfInfo &&bpi)
       : binary_mmaps(std::move(bpi.binary_mmaps)),
+        mmap_ranges(std::move(bpi.mmap_ranges)),
         binary_info(std::move(bpi.binary_info)),
+        perf_stream(std::move(bpi.perf_stream)),
         perf_reader(std::move(bpi.perf_reader)),
         perf_parser(std::move(bpi.perf_parser)) {}
 
   void ResetPerfInfo() {
+    perf_stream.reset();
     perf_parser.reset();
     perf_reader.reset();
     binary_mmaps.clear();
+    mmap_ranges.clear();
   }
 
   explicit operator bool() const { return !binary_mmaps.empty(); }
@@ -99,12 +141,15 @@ struct BinaryPerfInfo {
 struct LBRAggregation {
   // <from_address, to_address> -> branch counter.
   // Note all addresses are binary addresses, not runtime addresses.
-  using BranchCountersTy = std::map<std::pair<uint64_t, uint64_t>, uint64_t>;
+  // The counters are unordered, consumers that need a deterministic order
+  // must sort the entries themselves.
+  using BranchCountersTy =
+      absl::flat_hash_map<std::pair<uint64_t, uint64_t>, uint64_t>;
 
   // <fallthrough_from, fallthrough_to> -> fallthrough counter.
   // Note all addresses are symbol address, not virtual addresses.
   using FallthroughCountersTy =
-      std::map<std::pair<uint64_t, uint64_t>, uint64_t>;
+      absl::flat_hash_map<std::pair<uint64_t, uint64_t>, uint64_t>;
 
   LBRAggregation() = default;
   ~LBRAggregation() = default;
@@ -122,22 +167,48 @@ struct LBRAggregation {
   LBRAggregation(const LBRAggregation &) = delete;
   LBRAggregation &operator=(const LBRAggregation &) = delete;
 
+  // Adds all the counters of "other" into this aggregation.
+  void Merge(LBRAggregation &&other) {
+    MergeCounters(std::move(other.branch_counters), &branch_counters);
+    MergeCounters(std::move(other.fallthrough_counters),
+                  &fallthrough_counters);
+  }
+
   // See BranchCountersTy.
   BranchCountersTy branch_counters;
 
   // See FallthroughCountersTy.
   FallthroughCountersTy fallthrough_counters;
+
+ private:
+  template <class CountersTy>
+  static void MergeCounters(CountersTy &&from, CountersTy *to) {
+    // Insert the smaller map into the larger one.
+    if (from.size() > to->size()) std::swap(from, *to);
+    for (const auto &[key, count] : from) (*to)[key] += count;
+    from.clear();
+  }
 };
 
 class PerfDataReader {
  public:
   PerfDataReader() {}
+  // If "stream_perf_data" is false, SelectPerfInfo always parses perf data
+  // files with quipper.
+  explicit PerfDataReader(bool stream_perf_data)
+      : stream_perf_data_(stream_perf_data) {}
   virtual ~PerfDataReader() {}
 
   virtual bool GetBuildIdNames(const quipper::PerfReader &perf_reader,
                                const std::string &buildid,
                                std::set<std::string> *buildid_names);
 
+  // Same as above, but takes the <file name, raw build id> pairs directly,
+  // e.g. from PerfDataStream::build_ids().
+  static bool GetBuildIdNames(
+      const std::vector<std::pair<std::string, std::string>> &file_build_ids,
+      const std::string &buildid, std::set<std::string> *buildid_names);
+
   bool SelectBinaryInfo(const std::string &binary_file_name,
                         BinaryInfo *binary_info) const;
 
@@ -155,12 +226,17 @@ class PerfDataReader {
   // When match_mmap_name is "", SelectBinaryPerfInfo will automatically use the
   // build-id name, if build id is present, otherwise, it falls back to use
   // binary_file_name.
+  //
+  // The perf data file is streamed through PerfDataStream whenever its format
+  // allows, so no events are kept in memory. Otherwise the whole file is
+  // parsed by quipper. Both paths select the same mmaps and aggregate the
+  // same LBR counters.
   bool SelectPerfInfo(const std::string &perf_file,
                       const std::string &match_mmap_name,
                       BinaryPerfInfo *binary_perf_info) const;
 
-  // Parse LBR events that are matched by mmaps in perf_parse and store the data
-  // in the aggregated counters.
+  // Parse LBR events that are matched by mmaps in binary_perf_info and store
+  // the data in the aggregated counters.
   void AggregateLBR(const BinaryPerfInfo &binary_perf_info,
                     LBRAggregation *result) const;
 
@@ -177,13 +253,31 @@ class PerfDataReader {
   uint64_t RuntimeAddressToBinaryAddress(uint64_t pid, uint64_t addr,
                                          const BinaryPerfInfo &bpi) const;
 
+  // Remembers the pid and mmap range of the last translated address.
+  // Consecutive addresses of a branch stack almost always hit the same range.
+  struct AddressTranslationCache {
+    uint64_t pid = 0;
+    const std::vector<MMapRange> *ranges = nullptr;
+    const MMapRange *range = nullptr;
+  };
+
+  // Same as above, but looks up "cache" first and updates it.
+  uint64_t RuntimeAddressToBinaryAddress(uint64_t pid, uint64_t addr,
+                                         const BinaryPerfInfo &bpi,
+                                         AddressTranslationCache *cache) const;
+
   static const uint64_t kInvalidAddress = static_cast<uint64_t>(-1);
 
  private:
+  // Builds bpi->mmap_ranges from bpi->binary_mmaps.
+  static void IndexMMaps(BinaryPerfInfo *bpi);
+
   // Select mmap events from perfdata file by comparing the mmap event's
   // filename against "match_mmap_name".
   bool SelectMMaps(BinaryPerfInfo *info,
                    const std::string &match_mmap_name) const;
+
+  bool stream_perf_data_ = true;
 };
 
 // Utility class that wraps utility functions that need templated
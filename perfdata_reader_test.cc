@@ -1,6 +1,9 @@
 #include "perfdata_reader.h"
 
+#include <set>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -111,6 +114,118 @@ TEST(PerfdataReaderTest, TestSharedLibrary) {
   uint64_t addr = reader.RuntimeAddressToBinaryAddress(902132, 0x7fedfd0306a0,
                                                        binary_perf_info);
   EXPECT_EQ(addr, foo_sym_addr + 0x60);
+
+  // Translating through a cache gives the same results.
+  const uint64_t invalid_addr =
+      devtools_crosstool_autofdo::PerfDataReader::kInvalidAddress;
+  devtools_crosstool_autofdo::PerfDataReader::AddressTranslationCache cache;
+  EXPECT_EQ(reader.RuntimeAddressToBinaryAddress(902132, 0x7fedfd0306a0,
+                                                 binary_perf_info, &cache),
+            foo_sym_addr + 0x60);
+  EXPECT_EQ(reader.RuntimeAddressToBinaryAddress(902132, 0x7fedfd0306a4,
+                                                 binary_perf_info, &cache),
+            foo_sym_addr + 0x64);
+  // The first page of the mapping is not part of the executable segment.
+  EXPECT_EQ(reader.RuntimeAddressToBinaryAddress(902132, 0x7fedfd030000,
+                                                 binary_perf_info, &cache),
+            invalid_addr);
+  // Unknown pid.
+  EXPECT_EQ(reader.RuntimeAddressToBinaryAddress(1, 0x7fedfd0306a0,
+                                                 binary_perf_info, &cache),
+            invalid_addr);
+}
+
+TEST(PerfdataReaderTest, StreamPerfData) {
+  const std::string perfdata =
+      absl::StrCat(FLAGS_test_srcdir,
+                   "/testdata/"
+                   "propeller_sample_1.perfdata1");
+  auto stream = devtools_crosstool_autofdo::PerfDataStream::Open(perfdata);
+  ASSERT_NE(stream, nullptr);
+
+  std::set<std::string> buildid_names;
+  EXPECT_TRUE(devtools_crosstool_autofdo::PerfDataReader::GetBuildIdNames(
+      stream->build_ids(), "9f775610f3c5ce453f91501500d0181d91cc6a50",
+      &buildid_names));
+  EXPECT_THAT(buildid_names,
+              testing::ElementsAre("/usr/grte/v4/lib64/ld-2.19.so"));
+
+  int mmap_num = 0;
+  EXPECT_TRUE(stream->ForEachMMap(
+      [&](const devtools_crosstool_autofdo::PerfDataStream::MMapRecord &mmap) {
+        if (absl::StrContains(mmap.filename, "propeller_sample_1.bin")) {
+          EXPECT_EQ(mmap.pid, 1580);
+          EXPECT_EQ(mmap.start, 0x55b429b66000);
+        }
+        ++mmap_num;
+      }));
+  EXPECT_EQ(mmap_num, 4);
+
+  int sample_num = 0;
+  EXPECT_TRUE(stream->ForEachBranchStackSample(
+      [&](uint32_t pid,
+          const std::vector<
+              devtools_crosstool_autofdo::PerfDataStream::BranchEntry>
+              &branch_stack) {
+        EXPECT_FALSE(branch_stack.empty());
+        EXPECT_LE(branch_stack.size(), 32);
+        ++sample_num;
+      }));
+  EXPECT_EQ(sample_num, 3680);
+}
+
+TEST(PerfdataReaderTest, StreamAndQuipperAggregateSameLBR) {
+  const std::string binary =
+      absl::StrCat(FLAGS_test_srcdir,
+                   "/testdata/"
+                   "propeller_sample.bin");
+  const std::string perfdata =
+      absl::StrCat(FLAGS_test_srcdir,
+                   "/testdata/"
+                   "propeller_sample.perfdata");
+  devtools_crosstool_autofdo::LBRAggregation lbr_aggregations[2];
+  for (bool stream_perf_data : {false, true}) {
+    auto reader = devtools_crosstool_autofdo::PerfDataReader(stream_perf_data);
+    devtools_crosstool_autofdo::BinaryPerfInfo bpi;
+    ASSERT_TRUE(reader.SelectBinaryInfo(binary, &bpi.binary_info));
+    ASSERT_TRUE(reader.SelectPerfInfo(perfdata, "", &bpi));
+    EXPECT_EQ(bpi.perf_stream != nullptr, stream_perf_data);
+    reader.AggregateLBR(bpi, &lbr_aggregations[stream_perf_data]);
+  }
+  const auto &quipper_lbr = lbr_aggregations[0];
+  const auto &stream_lbr = lbr_aggregations[1];
+  EXPECT_FALSE(quipper_lbr.branch_counters.empty());
+  EXPECT_FALSE(quipper_lbr.fallthrough_counters.empty());
+  EXPECT_EQ(stream_lbr.branch_counters, quipper_lbr.branch_counters);
+  EXPECT_EQ(stream_lbr.fallthrough_counters, quipper_lbr.fallthrough_counters);
+}
+
+TEST(PerfdataReaderTest, DeduceAndCombineHugePageMappings) {
+  using MMapRecord = devtools_crosstool_autofdo::PerfDataStream::MMapRecord;
+  // The text of /foo is partly remapped onto huge pages, which show up as
+  // "//anon". The mmaps of pid 2 have a time, so they are left as is.
+  std::vector<MMapRecord> mmaps = {
+      {1, 0x200000, 0x200000, 0, "/foo", 0},
+      {1, 0x400000, 0x400000, 0, "//anon", 0},
+      {1, 0x800000, 0x100000, 0x600000, "/foo", 0},
+      {1, 0x900000, 0x1000, 0, "//anon", 0},
+      {2, 0x1000, 0x1000, 0, "//anon", 7},
+      {2, 0x2000, 0x1000, 0x1000, "/foo", 7},
+  };
+  devtools_crosstool_autofdo::PerfDataStream::DeduceHugePageMappings(&mmaps);
+  devtools_crosstool_autofdo::PerfDataStream::CombineMappings(&mmaps);
+
+  std::vector<std::tuple<uint32_t, uint64_t, uint64_t, uint64_t, std::string>>
+      fields;
+  for (const MMapRecord &mmap : mmaps)
+    fields.emplace_back(mmap.pid, mmap.start, mmap.len, mmap.pgoff,
+                        mmap.filename);
+  EXPECT_THAT(fields,
+              testing::ElementsAre(
+                  std::make_tuple(1, 0x200000, 0x700000, 0, "/foo"),
+                  std::make_tuple(1, 0x900000, 0x1000, 0, "//anon"),
+                  std::make_tuple(2, 0x1000, 0x1000, 0, "//anon"),
+                  std::make_tuple(2, 0x2000, 0x1000, 0x1000, "/foo")));
 }
 
 TEST(PerfdataReaderTest, FirstLoadableSegmentNoneExecutable) {
@@ -0,0 +1,583 @@
+#include "perfdata_stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+
+namespace devtools_crosstool_autofdo {
+
+namespace {
+// Constants below mirror linux/perf_event.h and tools/perf/util/header.h.
+constexpr uint64_t kPerfMagic = 0x32454c4946524550ULL;  // "PERFILE2"
+constexpr uint64_t kPerfMagicSwapped = 0x50455246494c4532ULL;
+
+constexpr uint32_t kPerfRecordMmap = 1;
+constexpr uint32_t kPerfRecordSample = 9;
+constexpr uint32_t kPerfRecordMmap2 = 10;
+constexpr uint32_t kPerfRecordAuxtrace = 71;
+constexpr uint32_t kPerfRecordCompressed = 81;
+
+constexpr uint64_t kSampleIp = 1ULL << 0;
+constexpr uint64_t kSampleTid = 1ULL << 1;
+constexpr uint64_t kSampleTime = 1ULL << 2;
+constexpr uint64_t kSampleAddr = 1ULL << 3;
+constexpr uint64_t kSampleRead = 1ULL << 4;
+constexpr uint64_t kSampleCallchain = 1ULL << 5;
+constexpr uint64_t kSampleId = 1ULL << 6;
+constexpr uint64_t kSampleCpu = 1ULL << 7;
+constexpr uint64_t kSamplePeriod = 1ULL << 8;
+constexpr uint64_t kSampleStreamId = 1ULL << 9;
+constexpr uint64_t kSampleRaw = 1ULL << 10;
+constexpr uint64_t kSampleBranchStack = 1ULL << 11;
+constexpr uint64_t kSampleIdentifier = 1ULL << 16;
+
+constexpr uint64_t kFormatTotalTimeEnabled = 1ULL << 0;
+constexpr uint64_t kFormatTotalTimeRunning = 1ULL << 1;
+constexpr uint64_t kFormatId = 1ULL << 2;
+constexpr uint64_t kFormatGroup = 1ULL << 3;
+constexpr uint64_t kFormatLost = 1ULL << 4;
+
+constexpr uint64_t kSampleBranchHwIndex = 1ULL << 17;
+
+constexpr uint64_t kAttrFlagSampleIdAll = 1ULL << 18;
+
+constexpr int kHeaderBuildIdFeature = 2;
+constexpr int kHeaderCompressedFeature = 27;
+constexpr uint16_t kRecordMiscBuildIdSize = 1U << 15;
+constexpr int kBuildIdArraySize = 20;
+
+// Large enough to always hold the biggest record (64KiB) several times over.
+constexpr size_t kStreamBufferSize = 4 << 20;
+
+struct PerfFileSection {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct PerfFileHeader {
+  uint64_t magic;
+  uint64_t size;
+  uint64_t attr_size;
+  PerfFileSection attrs;
+  PerfFileSection data;
+  PerfFileSection event_types;
+  uint64_t adds_features[4];
+};
+
+struct PerfEventHeader {
+  uint32_t type;
+  uint16_t misc;
+  uint16_t size;
+};
+
+// Offsets of the perf_event_attr fields we need.
+constexpr uint64_t kAttrSampleTypeOffset = 24;
+constexpr uint64_t kAttrReadFormatOffset = 32;
+constexpr uint64_t kAttrFlagsOffset = 40;
+constexpr uint64_t kAttrBranchSampleTypeOffset = 72;
+
+template <class T>
+T Load(const char *p) {
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+bool HasFeature(const PerfFileHeader &header, int feature) {
+  return (header.adds_features[feature / 64] >> (feature % 64)) & 1;
+}
+
+// Helpers below mirror those of quipper's huge_page_deducer.cc.
+using MMapRecord = PerfDataStream::MMapRecord;
+
+constexpr char kAnonFileName[] = "//anon";
+
+bool IsAnon(const MMapRecord &mmap) { return mmap.filename == kAnonFileName; }
+
+// Returns true if "b" immediately follows "a" in the address space of the
+// same process.
+bool IsContiguous(const MMapRecord &a, const MMapRecord &b) {
+  return a.pid == b.pid && a.start + a.len == b.start;
+}
+
+// Returns true if "a" and "b" map the same file, or if either of them is
+// anonymous (and thus maybe a huge page backed part of the other).
+bool IsEquivalentFile(const MMapRecord &a, const MMapRecord &b) {
+  return a.filename == b.filename || IsAnon(a) || IsAnon(b);
+}
+
+// A run of contiguous mmaps of the same file, all with page offset 0 unless
+// the run is a single mmap. "first" and "last" index the candidates passed to
+// FindMMapRun; the run is empty if first > last.
+struct MMapRun {
+  int first = 1;
+  int last = 0;
+
+  bool IsValid() const { return first <= last; }
+};
+
+// Returns the longest run of "candidates" that starts at "start", or an empty
+// run if "start" is out of range.
+MMapRun FindMMapRun(const std::vector<MMapRecord *> &candidates, int start) {
+  MMapRun run;
+  if (start >= candidates.size()) return run;
+  run.first = run.last = start;
+  // An mmap with a page offset is assumed to not be huge page backed.
+  if (candidates[start]->pgoff != 0) return run;
+  while (run.last + 1 < candidates.size()) {
+    const MMapRecord &prev = *candidates[run.last];
+    const MMapRecord &mmap = *candidates[run.last + 1];
+    if (prev.filename != mmap.filename || !IsContiguous(prev, mmap) ||
+        mmap.pgoff != 0)
+      break;
+    ++run.last;
+  }
+  return run;
+}
+
+uint64_t RunLength(const std::vector<MMapRecord *> &candidates,
+                   const MMapRun &run) {
+  return candidates[run.last]->start - candidates[run.first]->start +
+         candidates[run.last]->len;
+}
+}  // namespace
+
+std::unique_ptr<PerfDataStream> PerfDataStream::Open(
+    const std::string &perf_file) {
+  std::unique_ptr<PerfDataStream> stream(new PerfDataStream(perf_file));
+  stream->file_.open(perf_file, std::ios::in | std::ios::binary);
+  if (!stream->file_) {
+    LOG(ERROR) << "Failed to open perf data file: '" << perf_file << "'.";
+    return nullptr;
+  }
+  if (!stream->ReadHeader()) return nullptr;
+  stream->buffer_.resize(kStreamBufferSize);
+  return stream;
+}
+
+bool PerfDataStream::ReadAt(uint64_t offset, void *dest, uint64_t size) {
+  file_.clear();
+  file_.seekg(offset);
+  return static_cast<bool>(file_.read(static_cast<char *>(dest), size));
+}
+
+bool PerfDataStream::ReadHeader() {
+  PerfFileHeader header;
+  if (!ReadAt(0, &header, sizeof(header))) {
+    LOG(WARNING) << "'" << file_name_ << "' is too small for a perf data file.";
+    return false;
+  }
+  if (header.magic == kPerfMagicSwapped) {
+    LOG(INFO) << "'" << file_name_ << "' has a foreign byte order.";
+    return false;
+  }
+  if (header.magic != kPerfMagic || header.size != sizeof(header)) {
+    // Pipe mode files only have the magic and the size in their header.
+    LOG(INFO) << "'" << file_name_ << "' is not a perf data file in file mode.";
+    return false;
+  }
+  if (HasFeature(header, kHeaderCompressedFeature)) {
+    LOG(INFO) << "'" << file_name_ << "' contains compressed records.";
+    return false;
+  }
+
+  // perf_file_attr is a perf_event_attr followed by the section of its ids.
+  if (header.attr_size <= sizeof(PerfFileSection) ||
+      header.attr_size - sizeof(PerfFileSection) <
+          kAttrReadFormatOffset + sizeof(uint64_t)) {
+    LOG(ERROR) << "Invalid attribute size in '" << file_name_ << "'.";
+    return false;
+  }
+  const uint64_t event_attr_size = header.attr_size - sizeof(PerfFileSection);
+  std::vector<char> attr_buf(header.attr_size);
+  std::vector<std::vector<uint64_t>> attr_ids;
+  for (uint64_t offset = header.attrs.offset;
+       offset + header.attr_size <= header.attrs.offset + header.attrs.size;
+       offset += header.attr_size) {
+    if (!ReadAt(offset, attr_buf.data(), header.attr_size)) return false;
+    EventAttr attr;
+    attr.sample_type = Load<uint64_t>(&attr_buf[kAttrSampleTypeOffset]);
+    attr.read_format = Load<uint64_t>(&attr_buf[kAttrReadFormatOffset]);
+    if (event_attr_size >= kAttrFlagsOffset + sizeof(uint64_t))
+      attr.sample_id_all =
+          Load<uint64_t>(&attr_buf[kAttrFlagsOffset]) & kAttrFlagSampleIdAll;
+    if (event_attr_size >= kAttrBranchSampleTypeOffset + sizeof(uint64_t))
+      attr.branch_sample_type =
+          Load<uint64_t>(&attr_buf[kAttrBranchSampleTypeOffset]);
+    attrs_.push_back(attr);
+
+    auto ids_section = Load<PerfFileSection>(&attr_buf[event_attr_size]);
+    std::vector<uint64_t> ids(ids_section.size / sizeof(uint64_t));
+    if (!ids.empty() && !ReadAt(ids_section.offset, ids.data(),
+                                ids.size() * sizeof(uint64_t)))
+      return false;
+    attr_ids.push_back(std::move(ids));
+  }
+  if (attrs_.empty()) {
+    LOG(ERROR) << "No event attributes found in '" << file_name_ << "'.";
+    return false;
+  }
+
+  for (const EventAttr &attr : attrs_) {
+    if (attr.sample_type != attrs_[0].sample_type ||
+        attr.read_format != attrs_[0].read_format ||
+        attr.branch_sample_type != attrs_[0].branch_sample_type)
+      uniform_sample_layout_ = false;
+  }
+  if (!uniform_sample_layout_) {
+    // perf requires all events to put the sample id at the same position
+    // when their sample layouts differ.
+    const uint64_t sample_type = attrs_[0].sample_type;
+    if (sample_type & kSampleIdentifier) {
+      sample_id_offset_ = 0;
+    } else if (sample_type & kSampleId) {
+      sample_id_offset_ = 0;
+      for (uint64_t field : {kSampleIp, kSampleTid, kSampleTime, kSampleAddr})
+        if (sample_type & field) sample_id_offset_ += sizeof(uint64_t);
+    }
+    if (sample_id_offset_ < 0) {
+      LOG(ERROR) << "Events in '" << file_name_
+                 << "' have different sample layouts, but their samples "
+                    "carry no id to tell the layouts apart.";
+      return false;
+    }
+    for (int i = 0; i < attr_ids.size(); ++i)
+      for (uint64_t id : attr_ids[i]) attr_index_by_id_.emplace(id, i);
+  }
+
+  data_offset_ = header.data.offset;
+  data_size_ = header.data.size;
+
+  if (HasFeature(header, kHeaderBuildIdFeature)) {
+    // The feature sections follow the data section, one for every feature
+    // bit set, in increasing order of the feature bits.
+    int index = 0;
+    for (int feature = 0; feature < kHeaderBuildIdFeature; ++feature)
+      if (HasFeature(header, feature)) ++index;
+    PerfFileSection build_id_section;
+    if (!ReadAt(data_offset_ + data_size_ + index * sizeof(PerfFileSection),
+                &build_id_section, sizeof(build_id_section)) ||
+        !ReadBuildIds(build_id_section.offset, build_id_section.size)) {
+      LOG(ERROR) << "Failed to read build ids from '" << file_name_ << "'.";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PerfDataStream::ReadBuildIds(uint64_t offset, uint64_t size) {
+  std::vector<char> section(size);
+  if (size && !ReadAt(offset, section.data(), size)) return false;
+  // Each entry is a build_id_event: the event header, a pid, 24 bytes of
+  // build id (with its size in byte 20, if kRecordMiscBuildIdSize is set) and
+  // the null-terminated file name.
+  constexpr uint64_t kFileNameOffset = sizeof(PerfEventHeader) + 4 + 24;
+  for (uint64_t pos = 0; pos + kFileNameOffset <= size;) {
+    auto event_header = Load<PerfEventHeader>(&section[pos]);
+    if (event_header.size < kFileNameOffset ||
+        pos + event_header.size > size)
+      return false;
+    const char *build_id = &section[pos + sizeof(PerfEventHeader) + 4];
+    int build_id_size = kBuildIdArraySize;
+    if (event_header.misc & kRecordMiscBuildIdSize) {
+      build_id_size = std::min<int>(build_id[kBuildIdArraySize],
+                                    kBuildIdArraySize);
+    } else {
+      // Trim trailing zero words, which pad build ids shorter than 20 bytes.
+      while (build_id_size >= 4 &&
+             Load<uint32_t>(build_id + build_id_size - 4) == 0)
+        build_id_size -= 4;
+    }
+    const char *file_name = &section[pos + kFileNameOffset];
+    build_ids_.emplace_back(
+        std::string(file_name,
+                    strnlen(file_name, event_header.size - kFileNameOffset)),
+        std::string(build_id, build_id_size));
+    pos += event_header.size;
+  }
+  return true;
+}
+
+bool PerfDataStream::ForEachRecord(
+    absl::FunctionRef<void(uint32_t type, uint16_t misc, const char *payload,
+                           uint64_t payload_size)>
+        visitor) {
+  file_.clear();
+  file_.seekg(data_offset_);
+  uint64_t unread = data_size_;
+  // buffer_[pos, end) holds the bytes read but not yet consumed.
+  size_t pos = 0, end = 0;
+  // Makes sure at least "needed" bytes are available from pos.
+  auto fill = [&](size_t needed) {
+    if (end - pos >= needed) return true;
+    std::memmove(buffer_.data(), buffer_.data() + pos, end - pos);
+    end -= pos;
+    pos = 0;
+    size_t n = std::min<uint64_t>(buffer_.size() - end, unread);
+    if (n && !file_.read(buffer_.data() + end, n)) return false;
+    end += n;
+    unread -= n;
+    return end - pos >= needed;
+  };
+
+  while (unread || pos < end) {
+    if (!fill(sizeof(PerfEventHeader))) break;
+    auto header = Load<PerfEventHeader>(buffer_.data() + pos);
+    if (header.size < sizeof(PerfEventHeader) || !fill(header.size)) break;
+    if (header.type == kPerfRecordCompressed) {
+      LOG(ERROR) << "Unexpected compressed record in '" << file_name_ << "'.";
+      return false;
+    }
+    const char *payload = buffer_.data() + pos + sizeof(PerfEventHeader);
+    const uint64_t payload_size = header.size - sizeof(PerfEventHeader);
+    visitor(header.type, header.misc, payload, payload_size);
+    pos += header.size;
+
+    if (header.type == kPerfRecordAuxtrace && payload_size >= 8) {
+      // The aux trace data follows the record and is not part of its size.
+      uint64_t aux_size = Load<uint64_t>(payload);
+      uint64_t buffered = std::min<uint64_t>(aux_size, end - pos);
+      pos += buffered;
+      aux_size -= buffered;
+      if (aux_size) {
+        if (aux_size > unread) break;
+        file_.seekg(aux_size, std::ios::cur);
+        unread -= aux_size;
+      }
+    }
+  }
+  if (unread || pos < end) {
+    LOG(ERROR) << "Truncated or malformed record in '" << file_name_
+               << "' at data offset " << (data_size_ - unread - (end - pos))
+               << ".";
+    return false;
+  }
+  return true;
+}
+
+bool PerfDataStream::ForEachMMap(
+    absl::FunctionRef<void(const MMapRecord &)> visitor) {
+  MMapRecord mmap;
+  return ForEachRecord([&](uint32_t type, uint16_t misc, const char *payload,
+                           uint64_t payload_size) {
+    // MMAP2 has 24 bytes of device/inode (or build id) information and 8
+    // bytes of protection/flags between pgoff and the file name.
+    uint64_t filename_offset;
+    if (type == kPerfRecordMmap)
+      filename_offset = 32;
+    else if (type == kPerfRecordMmap2)
+      filename_offset = 32 + 24 + 8;
+    else
+      return;
+    if (payload_size < filename_offset) return;
+    mmap.pid = Load<uint32_t>(payload);
+    mmap.start = Load<uint64_t>(payload + 8);
+    mmap.len = Load<uint64_t>(payload + 16);
+    mmap.pgoff = Load<uint64_t>(payload + 24);
+    const char *filename = payload + filename_offset;
+    mmap.filename.assign(
+        filename, strnlen(filename, payload_size - filename_offset));
+    mmap.time = GetRecordTime(payload, payload_size);
+    visitor(mmap);
+  });
+}
+
+bool PerfDataStream::ReadMMaps(std::vector<MMapRecord> *mmaps) {
+  mmaps->clear();
+  if (!ForEachMMap([&](const MMapRecord &mmap) { mmaps->push_back(mmap); }))
+    return false;
+  // quipper sorts events by time only if all of them have one, otherwise
+  // every time is 0 here and the file order is kept.
+  std::stable_sort(mmaps->begin(), mmaps->end(),
+                   [](const MMapRecord &a, const MMapRecord &b) {
+                     return a.time < b.time;
+                   });
+  DeduceHugePageMappings(mmaps);
+  CombineMappings(mmaps);
+  return true;
+}
+
+void PerfDataStream::DeduceHugePageMappings(std::vector<MMapRecord> *mmaps) {
+  // Huge page mappings can only be told apart in the mmaps that perf
+  // synthesizes from /proc/<pid>/maps, which have time 0.
+  std::vector<MMapRecord *> candidates;
+  for (MMapRecord &mmap : *mmaps)
+    if (mmap.time == 0) candidates.push_back(&mmap);
+
+  // Slides a window of three runs over the candidates, and gives "run" the
+  // file and page offsets of "next_run" when it fills the gap between the
+  // page offsets of "prev_run" (or 0) and "next_run".
+  auto find_next_run = [&candidates](const MMapRun &run) {
+    return run.IsValid() ? FindMMapRun(candidates, run.last + 1) : MMapRun();
+  };
+  MMapRun prev_run;
+  MMapRun run = FindMMapRun(candidates, 0);
+  MMapRun next_run = find_next_run(run);
+  while (run.IsValid()) {
+    if (next_run.IsValid()) {
+      const MMapRecord &last = *candidates[run.last];
+      const MMapRecord &next = *candidates[next_run.first];
+      if (IsContiguous(last, next) && IsEquivalentFile(last, next)) {
+        uint64_t start_pgoff = 0;
+        if (prev_run.IsValid()) {
+          const MMapRecord &prev = *candidates[prev_run.last];
+          if (IsContiguous(prev, *candidates[run.first]) &&
+              IsEquivalentFile(prev, *candidates[run.first]) &&
+              IsEquivalentFile(prev, next))
+            start_pgoff = prev.pgoff + prev.len;
+        }
+        const uint64_t len = RunLength(candidates, run);
+        if (next.pgoff == start_pgoff + len) {
+          uint64_t pgoff = next.pgoff - len;
+          for (int i = run.first; i <= run.last; ++i) {
+            MMapRecord &mmap = *candidates[i];
+            if (IsAnon(mmap)) mmap.filename = next.filename;
+            if (mmap.pgoff == 0) mmap.pgoff = pgoff;
+            pgoff += mmap.len;
+          }
+        }
+      }
+    }
+    prev_run = run;
+    run = next_run;
+    next_run = find_next_run(run);
+  }
+}
+
+void PerfDataStream::CombineMappings(std::vector<MMapRecord> *mmaps) {
+  // Anonymous mappings not fixed up by DeduceHugePageMappings are never
+  // combined with files, as only mmaps of the same file name are merged.
+  auto combined = mmaps->begin();
+  for (auto it = mmaps->begin(); it != mmaps->end(); ++it) {
+    if (it != mmaps->begin() && combined->filename == it->filename &&
+        IsContiguous(*combined, *it) &&
+        combined->pgoff + combined->len == it->pgoff) {
+      combined->len += it->len;
+      continue;
+    }
+    if (it != mmaps->begin()) ++combined;
+    if (combined != it) *combined = std::move(*it);
+  }
+  if (!mmaps->empty()) mmaps->erase(combined + 1, mmaps->end());
+}
+
+uint64_t PerfDataStream::GetRecordTime(const char *payload,
+                                       uint64_t payload_size) const {
+  // The sample id fields are laid out as pid/tid, time, id, stream id, cpu
+  // and identifier, so the time is found by counting back from the end.
+  const EventAttr *attr = &attrs_[0];
+  if (!uniform_sample_layout_ && (attr->sample_type & kSampleIdentifier) &&
+      payload_size >= sizeof(uint64_t)) {
+    auto it = attr_index_by_id_.find(
+        Load<uint64_t>(payload + payload_size - sizeof(uint64_t)));
+    if (it != attr_index_by_id_.end()) attr = &attrs_[it->second];
+  }
+  if (!attr->sample_id_all || !(attr->sample_type & kSampleTime)) return 0;
+  uint64_t time_offset_from_end = sizeof(uint64_t);
+  for (uint64_t field : {kSampleId, kSampleStreamId, kSampleCpu,
+                         kSampleIdentifier})
+    if (attr->sample_type & field) time_offset_from_end += sizeof(uint64_t);
+  if (time_offset_from_end > payload_size) return 0;
+  return Load<uint64_t>(payload + payload_size - time_offset_from_end);
+}
+
+const PerfDataStream::EventAttr *PerfDataStream::GetSampleAttr(
+    const char *payload, uint64_t payload_size) const {
+  if (uniform_sample_layout_) return &attrs_[0];
+  if (sample_id_offset_ < 0 ||
+      sample_id_offset_ + sizeof(uint64_t) > payload_size)
+    return nullptr;
+  auto it = attr_index_by_id_.find(
+      Load<uint64_t>(payload + sample_id_offset_));
+  if (it == attr_index_by_id_.end()) return nullptr;
+  return &attrs_[it->second];
+}
+
+bool PerfDataStream::DecodeBranchStackSample(const EventAttr &attr,
+                                             const char *payload,
+                                             uint64_t payload_size,
+                                             uint32_t *pid) {
+  const uint64_t sample_type = attr.sample_type;
+  if (!(sample_type & kSampleTid) || !(sample_type & kSampleBranchStack))
+    return false;
+
+  // Fields are laid out in the order of the checks below.
+  uint64_t pos = 0;
+  auto skip = [&](uint64_t n) {
+    if (n > payload_size - pos) return false;
+    pos += n;
+    return true;
+  };
+  auto read_u64 = [&](uint64_t *v) {
+    if (sizeof(uint64_t) > payload_size - pos) return false;
+    *v = Load<uint64_t>(payload + pos);
+    pos += sizeof(uint64_t);
+    return true;
+  };
+
+  if ((sample_type & kSampleIdentifier) && !skip(8)) return false;
+  if ((sample_type & kSampleIp) && !skip(8)) return false;
+  if (payload_size - pos < 8) return false;
+  *pid = Load<uint32_t>(payload + pos);
+  pos += 8;  // pid, tid
+  for (uint64_t field : {kSampleTime, kSampleAddr, kSampleId, kSampleStreamId,
+                         kSampleCpu, kSamplePeriod})
+    if ((sample_type & field) && !skip(8)) return false;
+  if (sample_type & kSampleRead) {
+    const uint64_t read_format = attr.read_format;
+    uint64_t times = ((read_format & kFormatTotalTimeEnabled) ? 1 : 0) +
+                     ((read_format & kFormatTotalTimeRunning) ? 1 : 0);
+    uint64_t words_per_value = 1 + ((read_format & kFormatId) ? 1 : 0) +
+                               ((read_format & kFormatLost) ? 1 : 0);
+    // A group read is prefixed with its number of values.
+    uint64_t nr = 1;
+    if ((read_format & kFormatGroup) &&
+        (!read_u64(&nr) || nr > payload_size / sizeof(uint64_t)))
+      return false;
+    if (!skip(sizeof(uint64_t) * (times + nr * words_per_value)))
+      return false;
+  }
+  if (sample_type & kSampleCallchain) {
+    uint64_t nr;
+    if (!read_u64(&nr) || nr > (payload_size - pos) / sizeof(uint64_t) ||
+        !skip(nr * sizeof(uint64_t)))
+      return false;
+  }
+  if (sample_type & kSampleRaw) {
+    if (payload_size - pos < sizeof(uint32_t)) return false;
+    uint32_t raw_size = Load<uint32_t>(payload + pos);
+    if (!skip(sizeof(uint32_t) + static_cast<uint64_t>(raw_size)))
+      return false;
+  }
+  uint64_t nr;
+  if (!read_u64(&nr)) return false;
+  if ((attr.branch_sample_type & kSampleBranchHwIndex) && !skip(8))
+    return false;
+  if (nr > (payload_size - pos) / sizeof(BranchEntry)) return false;
+
+  branch_stack_.resize(nr);
+  if (nr)
+    std::memcpy(branch_stack_.data(), payload + pos, nr * sizeof(BranchEntry));
+  // Drop trailing null entries, like quipper does.
+  while (!branch_stack_.empty() && branch_stack_.back().from == 0 &&
+         branch_stack_.back().to == 0)
+    branch_stack_.pop_back();
+  return !branch_stack_.empty();
+}
+
+bool PerfDataStream::ForEachBranchStackSample(
+    absl::FunctionRef<void(uint32_t pid,
+                           const std::vector<BranchEntry> &branch_stack)>
+        visitor) {
+  return ForEachRecord([&](uint32_t type, uint16_t misc, const char *payload,
+                           uint64_t payload_size) {
+    if (type != kPerfRecordSample) return;
+    const EventAttr *attr = GetSampleAttr(payload, payload_size);
+    uint32_t pid;
+    if (attr && DecodeBranchStackSample(*attr, payload, payload_size, &pid))
+      visitor(pid, branch_stack_);
+  });
+}
+
+}  // namespace devtools_crosstool_autofdo
@@ -0,0 +1,151 @@
+#ifndef AUTOFDO_PERFDATA_STREAM_H_
+#define AUTOFDO_PERFDATA_STREAM_H_
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "third_party/abseil/absl/container/flat_hash_map.h"
+#include "third_party/abseil/absl/functional/function_ref.h"
+
+namespace devtools_crosstool_autofdo {
+
+// PerfDataStream decodes the records of a perf.data file sequentially through
+// a fixed size buffer, so its memory usage does not depend on the size of the
+// file. Only the records needed by Propeller (MMAP, MMAP2 and SAMPLE records
+// with branch stacks) are decoded, everything else is skipped.
+//
+// Only perf.data files written in file mode (not pipe mode), with the host
+// byte order and without compressed records are supported, and samples must
+// carry an id if the events do not all share the same sample layout. Open()
+// returns nullptr for all other files and callers are expected to fall back
+// to quipper.
+class PerfDataStream {
+ public:
+  struct MMapRecord {
+    uint32_t pid;
+    uint64_t start;
+    uint64_t len;
+    uint64_t pgoff;
+    std::string filename;
+    // Time of the record, or 0 if it has none. perf writes the mmaps of
+    // processes that already run when recording starts with time 0.
+    uint64_t time;
+  };
+
+  struct BranchEntry {
+    uint64_t from;
+    uint64_t to;
+    uint64_t flags;
+  };
+
+  // Opens "perf_file" and reads its header, event attributes and build ids.
+  // Returns nullptr if the file cannot be read or is not supported.
+  static std::unique_ptr<PerfDataStream> Open(const std::string &perf_file);
+
+  PerfDataStream(const PerfDataStream &) = delete;
+  PerfDataStream &operator=(const PerfDataStream &) = delete;
+
+  const std::string &file_name() const { return file_name_; }
+
+  // <file name, raw build id> pairs from the build id feature section.
+  const std::vector<std::pair<std::string, std::string>> &build_ids() const {
+    return build_ids_;
+  }
+
+  // Streams over all records and calls "visitor" for every MMAP and MMAP2
+  // record. Returns false if the file is truncated or malformed.
+  bool ForEachMMap(absl::FunctionRef<void(const MMapRecord &)> visitor);
+
+  // Reads all MMAP and MMAP2 records into "mmaps" as quipper's PerfParser
+  // presents them: sorted by time, then passed through
+  // DeduceHugePageMappings and CombineMappings. Returns false if the file is
+  // truncated or malformed.
+  bool ReadMMaps(std::vector<MMapRecord> *mmaps);
+
+  // Same as quipper's DeduceHugePages: gives the file name and page offset
+  // of the neighbouring file mappings to the "//anon" mappings that back the
+  // text of a binary remapped onto huge pages. Only mmaps with time 0 are
+  // considered.
+  static void DeduceHugePageMappings(std::vector<MMapRecord> *mmaps);
+
+  // Same as quipper's CombineMappings: merges every mmap into the previous
+  // one if they map adjacent parts of the same file to adjacent addresses of
+  // the same process.
+  static void CombineMappings(std::vector<MMapRecord> *mmaps);
+
+  // Streams over all records and calls "visitor" for every SAMPLE record that
+  // has a pid and a non-empty branch stack. Entries are ordered from the most
+  // recent branch to the oldest, with trailing null entries removed. The
+  // vector is reused across calls. Returns false if the file is truncated or
+  // malformed.
+  bool ForEachBranchStackSample(
+      absl::FunctionRef<void(uint32_t pid,
+                             const std::vector<BranchEntry> &branch_stack)>
+          visitor);
+
+ private:
+  // The subset of perf_event_attr needed to decode sample records.
+  struct EventAttr {
+    uint64_t sample_type = 0;
+    uint64_t read_format = 0;
+    uint64_t branch_sample_type = 0;
+    // Whether non-sample records are followed by the sample id fields.
+    bool sample_id_all = false;
+  };
+
+  explicit PerfDataStream(const std::string &perf_file)
+      : file_name_(perf_file) {}
+
+  bool ReadHeader();
+  bool ReadBuildIds(uint64_t offset, uint64_t size);
+  bool ReadAt(uint64_t offset, void *dest, uint64_t size);
+
+  // Streams over the data section and calls "visitor" with the type, misc
+  // bits and payload (everything after the record header) of every record.
+  bool ForEachRecord(
+      absl::FunctionRef<void(uint32_t type, uint16_t misc, const char *payload,
+                             uint64_t payload_size)>
+          visitor);
+
+  // Returns the attribute describing the layout of the sample record in
+  // "payload", or nullptr if it cannot be determined.
+  const EventAttr *GetSampleAttr(const char *payload,
+                                 uint64_t payload_size) const;
+
+  // Returns the time in the sample id fields that trail the non-sample record
+  // in "payload", or 0 if there is none.
+  uint64_t GetRecordTime(const char *payload, uint64_t payload_size) const;
+
+  // Decodes the pid and branch stack of a sample record into "pid" and
+  // branch_stack_. Returns false if the sample has no pid or branch stack.
+  bool DecodeBranchStackSample(const EventAttr &attr, const char *payload,
+                               uint64_t payload_size, uint32_t *pid);
+
+  std::string file_name_;
+  std::ifstream file_;
+  uint64_t data_offset_ = 0;
+  uint64_t data_size_ = 0;
+
+  std::vector<EventAttr> attrs_;
+  // Maps sample ids to indexes in attrs_. Only used when the attributes do
+  // not all share the same sample layout.
+  absl::flat_hash_map<uint64_t, int> attr_index_by_id_;
+  // Offset of the sample id within a sample record, or -1 if samples carry no
+  // id.
+  int sample_id_offset_ = -1;
+  bool uniform_sample_layout_ = true;
+
+  std::vector<std::pair<std::string, std::string>> build_ids_;
+
+  // Streaming buffer and the branch stack handed out to visitors.
+  std::vector<char> buffer_;
+  std::vector<BranchEntry> branch_stack_;
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_PERFDATA_STREAM_H_
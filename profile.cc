@@ -4,24 +4,37 @@
 // Class to represent source level profile.
 #include "profile.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <map>
+#include <memory>
 #include <string>
+#include <thread>  // NOLINT(build/c++11)
 #include <utility>
 #include <vector>
 
 #include "base/commandlineflags.h"
 #include "base/logging.h"
+#include "addr2line.h"
 #include "instruction_map.h"
 #include "sample_reader.h"
 #include "symbol_map.h"
 #include "third_party/abseil/absl/flags/flag.h"
+#include "third_party/abseil/absl/memory/memory.h"
 #include "third_party/abseil/absl/strings/match.h"
 #include "third_party/abseil/absl/strings/strip.h"
 
 ABSL_FLAG(bool, use_lbr, true,
             "Whether to use lbr profile.");
 ABSL_FLAG(bool, llc_misses, false, "The profile represents llc misses.");
+ABSL_FLAG(int32_t, jobs, 1,
+          "Number of threads used to compute the per-function profiles, and "
+          "to parse the DWARF compilation units in builds without LLVM. With "
+          "--format=propeller, also used to decode .llvm_bb_addr_map, to "
+          "parse the perf data files and to build the node chains of the "
+          "code layout. profile_merger uses it to read the LLVM input "
+          "profiles.");
 
 namespace devtools_crosstool_autofdo {
 Profile::ProfileMaps *Profile::GetProfileMaps(uint64_t addr) {
@@ -43,14 +56,14 @@ Profile::ProfileMaps *Profile::GetProfileMaps(uint64_t addr) {
 
 void Profile::AggregatePerFunctionProfile() {
   uint64_t start = symbol_map_->base_addr();
-  const AddressCountMap *count_map = &sample_reader_->address_count_map();
+  const FlatAddressCountMap *count_map = &sample_reader_->address_count_map();
   for (const auto &addr_count : *count_map) {
     ProfileMaps *maps = GetProfileMaps(addr_count.first + start);
     if (maps != nullptr) {
       maps->address_count_map[addr_count.first + start] += addr_count.second;
     }
   }
-  const RangeCountMap *range_map = &sample_reader_->range_count_map();
+  const FlatRangeCountMap *range_map = &sample_reader_->range_count_map();
   for (const auto &range_count : *range_map) {
     ProfileMaps *maps = GetProfileMaps(range_count.first.first + start);
     if (maps != nullptr) {
@@ -59,7 +72,7 @@ void Profile::AggregatePerFunctionProfile() {
           range_count.second;
     }
   }
-  const BranchCountMap *branch_map = &sample_reader_->branch_count_map();
+  const FlatBranchCountMap *branch_map = &sample_reader_->branch_count_map();
   for (const auto &branch_count : *branch_map) {
     ProfileMaps *maps = GetProfileMaps(branch_count.first.first + start);
     if (maps != nullptr) {
@@ -93,8 +106,11 @@ uint64_t Profile::ProfileMaps::GetAggregatedCount() const {
 }
 
 void Profile::ProcessPerFunctionProfile(std::string func_name,
-                                        const ProfileMaps &maps) {
-  InstructionMap inst_map(addr2line_, symbol_map_);
+                                        const ProfileMaps &maps,
+                                        Addr2line *addr2line,
+                                        SymbolMap *symbol_map,
+                                        AddressCountMap *addr_count_map) {
+  InstructionMap inst_map(addr2line, symbol_map);
   inst_map.BuildPerFunctionInstructionMap(func_name, maps.start_addr,
                                           maps.end_addr);
 
@@ -105,44 +121,29 @@ void Profile::ProcessPerFunctionProfile(std::string func_name,
       LOG(WARNING) << "use_lbr was enabled but range_count_map was empty!";
       return;
     }
-    for (const auto &range_count : maps.range_count_map) {
-      for (InstructionMap::InstMap::const_iterator iter =
-               inst_map.inst_map().find(range_count.first.first);
-           iter != inst_map.inst_map().end()
-               && iter->first <= range_count.first.second;
-           ++iter) {
-        map[iter->first] += range_count.second;
-      }
-    }
+    AddRangeCountsToAddresses(maps.range_count_map, inst_map.start_addr(),
+                              inst_map.end_addr(), &map);
     map_ptr = &map;
   } else {
     map_ptr = &maps.address_count_map;
   }
 
   for (const auto &address_count : *map_ptr) {
-    InstructionMap::InstMap::const_iterator iter =
-        inst_map.inst_map().find(address_count.first);
-    if (iter == inst_map.inst_map().end()) {
-      continue;
-    }
-    const InstructionMap::InstInfo *info = iter->second;
+    const InstructionMap::InstInfo *info =
+        inst_map.GetInstInfo(address_count.first);
     if (info == nullptr) {
       continue;
     }
     if (!info->source_stack.empty()) {
-      symbol_map_->AddSourceCount(
+      symbol_map->AddSourceCount(
           func_name, info->source_stack, address_count.second, 0,
           info->source_stack[0].DuplicationFactor(), SymbolMap::PERFDATA);
     }
   }
 
   for (const auto &branch_count : maps.branch_count_map) {
-    InstructionMap::InstMap::const_iterator iter =
-        inst_map.inst_map().find(branch_count.first.first);
-    if (iter == inst_map.inst_map().end()) {
-      continue;
-    }
-    const InstructionMap::InstInfo *info = iter->second;
+    const InstructionMap::InstInfo *info =
+        inst_map.GetInstInfo(branch_count.first.first);
     if (info == nullptr) {
       continue;
     }
@@ -152,16 +153,78 @@ void Profile::ProcessPerFunctionProfile(std::string func_name,
       continue;
     }
     if (symbol_map_->map().count(*callee)) {
-      symbol_map_->AddSymbolEntryCount(*callee, branch_count.second);
-      symbol_map_->AddIndirectCallTarget(func_name, info->source_stack, *callee,
-                                         branch_count.second,
-                                         SymbolMap::PERFDATA);
+      symbol_map->AddSymbol(*callee);
+      symbol_map->AddSymbolEntryCount(*callee, branch_count.second);
+      symbol_map->AddIndirectCallTarget(func_name, info->source_stack, *callee,
+                                        branch_count.second,
+                                        SymbolMap::PERFDATA);
     }
   }
 
   for (const auto &addr_count : *map_ptr) {
-    global_addr_count_map_[addr_count.first] = addr_count.second;
+    (*addr_count_map)[addr_count.first] = addr_count.second;
+  }
+}
+
+void Profile::ProcessPerFunctionProfilesInParallel(
+    const std::vector<std::pair<std::string, const ProfileMaps *>> &functions,
+    int jobs) {
+  // Functions are processed in contiguous chunks. A chunk is the unit of work
+  // handed to a thread, and the partial results are merged in chunk order so
+  // that they do not depend on the thread schedule.
+  struct PartialProfile {
+    SymbolMap symbol_map;
+    AddressCountMap addr_count_map;
+  };
+  const int kChunksPerJob = 16;
+  const int num_chunks = std::min<size_t>(functions.size(),
+                                          jobs * kChunksPerJob);
+  if (num_chunks == 0) return;
+  const size_t chunk_size = (functions.size() + num_chunks - 1) / num_chunks;
+  std::vector<std::unique_ptr<PartialProfile>> partials(num_chunks);
+  std::atomic<int> next_chunk(0);
+
+  auto worker = [&](Addr2line *addr2line) {
+    for (int chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+      auto partial = absl::make_unique<PartialProfile>();
+      partial->symbol_map.set_suffix_elision_policy(
+          symbol_map_->suffix_elision_policy());
+      const size_t end =
+          std::min(functions.size(), (chunk + 1) * chunk_size);
+      for (size_t i = chunk * chunk_size; i < end; ++i) {
+        partial->symbol_map.AddSymbol(functions[i].first);
+        ProcessPerFunctionProfile(functions[i].first, *functions[i].second,
+                                  addr2line, &partial->symbol_map,
+                                  &partial->addr_count_map);
+      }
+      partials[chunk] = std::move(partial);
+    }
+  };
+  // Addr2line is not thread-safe, so each other thread symbolizes with its
+  // own, created with the same sampled functions as addr2line_.
+  std::vector<std::unique_ptr<Addr2line>> addr2lines(jobs - 1);
+  std::vector<std::thread> threads;
+  threads.emplace_back(worker, addr2line_);
+  for (int i = 0; i < jobs - 1; ++i) {
+    threads.emplace_back([&, addr2line = &addr2lines[i]] {
+      addr2line->reset(Addr2line::CreateWithSampledFunctions(
+          binary_name_, sampled_functions_));
+      CHECK(*addr2line != nullptr)
+          << "Failed to create addr2line for " << binary_name_;
+      worker(addr2line->get());
+    });
   }
+  for (std::thread &thread : threads) thread.join();
+
+  for (std::unique_ptr<PartialProfile> &partial : partials) {
+    symbol_map_->MergePerfDataSymbols(partial->symbol_map);
+    for (const auto &addr_count : partial->addr_count_map)
+      global_addr_count_map_[addr_count.first] = addr_count.second;
+    partial.reset();
+  }
+  // The merged symbols refer to function names owned by the worker addr2lines.
+  for (std::unique_ptr<Addr2line> &addr2line : addr2lines)
+    symbol_map_->AddWorkerAddr2line(std::move(addr2line));
 }
 
 void Profile::ComputeProfile() {
@@ -215,10 +278,20 @@ void Profile::ComputeProfile() {
       }
     }
 
+    std::vector<std::pair<std::string, const ProfileMaps *>> functions;
     for (const auto &[name, profile] : symbol_profile_maps_) {
       const uint64_t count = symbol_counts.at(absl::StripSuffix(name, ".cold"));
       if (symbol_map_->ShouldEmit(count)) {
-        ProcessPerFunctionProfile(name, *profile);
+        functions.emplace_back(name, profile);
+      }
+    }
+    const int jobs = absl::GetFlag(FLAGS_jobs);
+    if (jobs > 1) {
+      ProcessPerFunctionProfilesInParallel(functions, jobs);
+    } else {
+      for (const auto &[name, profile] : functions) {
+        ProcessPerFunctionProfile(name, *profile, addr2line_, symbol_map_,
+                                  &global_addr_count_map_);
       }
     }
     symbol_map_->ElideSuffixesAndMerge();
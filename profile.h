@@ -7,13 +7,20 @@
 #define AUTOFDO_PROFILE_H_
 
 #include <cstdint>
+#include <map>
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/integral_types.h"
 #include "base/macros.h"
 #include "sample_reader.h"
 #include "third_party/abseil/absl/container/node_hash_map.h"
+#include "third_party/abseil/absl/flags/declare.h"
+
+// Number of threads used to compute the per-function profiles.
+ABSL_DECLARE_FLAG(int32_t, jobs);
 
 namespace devtools_crosstool_autofdo {
 
@@ -30,12 +37,18 @@ class Profile {
   //   addr2line: an Addr2line.
   //   symbol_map: the symbol map is written by this class to store all symbol
   //               information.
+  //   sampled_functions: if not null, the map from the start address of the
+  //                      sampled functions to their size that addr2line was
+  //                      created with. The symbolizers of the --jobs threads
+  //                      are created with it too.
   Profile(const SampleReader *sample_reader, const std::string &binary_name,
-          Addr2line *addr2line, SymbolMap *symbol_map)
+          Addr2line *addr2line, SymbolMap *symbol_map,
+          const std::map<uint64_t, uint64_t> *sampled_functions = nullptr)
       : sample_reader_(sample_reader),
         binary_name_(binary_name),
         addr2line_(addr2line),
-        symbol_map_(symbol_map) {}
+        symbol_map_(symbol_map),
+        sampled_functions_(sampled_functions) {}
 
   ~Profile();
 
@@ -65,12 +78,27 @@ class Profile {
   // Builds function level profile for specified function:
   //   1. Traverses all instructions to build instruction map.
   //   2. Unwinds the inline stack to add symbol count to each inlined symbol.
-  void ProcessPerFunctionProfile(std::string func_name, const ProfileMaps &map);
+  // The source stacks are derived with ADDR2LINE and the counts are added to
+  // SYMBOL_MAP and ADDR_COUNT_MAP, which may be private to a worker thread.
+  void ProcessPerFunctionProfile(std::string func_name, const ProfileMaps &map,
+                                 Addr2line *addr2line, SymbolMap *symbol_map,
+                                 AddressCountMap *addr_count_map);
+
+  // Runs ProcessPerFunctionProfile for FUNCTIONS on JOBS threads. Each thread
+  // builds partial symbol maps which are merged into symbol_map_ in the order
+  // of FUNCTIONS, so the result is the same as processing them serially. One
+  // thread symbolizes with addr2line_, the others with their own Addr2line
+  // created like it.
+  void ProcessPerFunctionProfilesInParallel(
+      const std::vector<std::pair<std::string, const ProfileMaps *>>
+          &functions,
+      int jobs);
 
   const SampleReader *sample_reader_;
   const std::string binary_name_;
   Addr2line *addr2line_;
   SymbolMap *symbol_map_;
+  const std::map<uint64_t, uint64_t> *sampled_functions_;
   AddressCountMap global_addr_count_map_;
   SymbolProfileMaps symbol_profile_maps_;
 
@@ -188,12 +188,17 @@ bool ProfileCreator::ComputeProfile(SymbolMap *symbol_map) {
   std::set<uint64_t> sampled_addrs = sample_reader_->GetSampledAddresses();
   std::map<uint64_t, uint64_t> sampled_functions =
       symbol_map->GetSampledSymbolStartAddressSizeMap(sampled_addrs);
+#if defined(HAVE_LLVM)
+  // Symbolizers only read the index, so that it is written once and covers
+  // the whole binary, even though they only symbolize the sampled functions.
+  WriteSymbolizationIndex(binary_);
+#endif
   if (!CheckAndAssignAddr2Line(
           symbol_map,
           Addr2line::CreateWithSampledFunctions(binary_, &sampled_functions)))
     return false;
   Profile profile(sample_reader_, binary_, symbol_map->get_addr2line(),
-                  symbol_map);
+                  symbol_map, &sampled_functions);
   profile.ComputeProfile();
   return true;
 }
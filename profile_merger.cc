@@ -15,13 +15,15 @@
 #include "profile_writer.h"
 #include "symbol_map.h"
 #include "third_party/abseil/absl/base/macros.h"
-#include "third_party/abseil/absl/container/node_hash_set.h"
+#include "third_party/abseil/absl/flags/declare.h"
 #include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/memory/memory.h"
 #include "llvm/Config/llvm-config.h"
 #include "third_party/abseil/absl/flags/parse.h"
 #include "third_party/abseil/absl/flags/usage.h"
 
+ABSL_DECLARE_FLAG(int32_t, jobs);
+
 ABSL_FLAG(std::string, output_file, "fbdata.afdo", "Output file name");
 ABSL_FLAG(bool, is_llvm, false, "Whether the profile is for LLVM");
 ABSL_FLAG(std::string, format, "binary",
@@ -147,8 +149,6 @@ int main(int argc, char **argv) {
       strip_all, ABSL_ARRAYSIZE(strip_all), keep_sole,
       ABSL_ARRAYSIZE(keep_sole), keep_cold, ABSL_ARRAYSIZE(keep_cold));
 
-  absl::node_hash_set<std::string> names;
-
   if (!absl::GetFlag(FLAGS_is_llvm)) {
     using devtools_crosstool_autofdo::AutoFDOProfileReader;
     typedef std::unique_ptr<AutoFDOProfileReader> AutoFDOProfileReaderPtr;
@@ -176,20 +176,34 @@ int main(int argc, char **argv) {
         new LLVMProfileReaderPtr[argc - 1]);
     llvm::sampleprof::ProfileSymbolList prof_sym_list;
 
-    for (int i = 1; i < argc; i++) {
-      auto reader = absl::make_unique<LLVMProfileReader>(
-          &symbol_map, names,
-          absl::GetFlag(FLAGS_merge_special_syms) ? nullptr : &special_syms);
-      reader->ReadFromFile(argv[i]);
-
-      if (absl::GetFlag(FLAGS_include_symbol_list) &&
-          absl::GetFlag(FLAGS_format) == "extbinary") {
-        // Merge profile symbol list if it exists.
-        llvm::sampleprof::ProfileSymbolList* input_list =
-            reader->GetProfileSymbolList();
-        if (input_list) prof_sym_list.merge(*input_list);
+    const int jobs = absl::GetFlag(FLAGS_jobs);
+    // Unless they are merged, special symbols are handled depending on the
+    // profiles read before, which needs the inputs to be read in order.
+    const bool read_in_parallel =
+        jobs > 1 && absl::GetFlag(FLAGS_merge_special_syms);
+    if (read_in_parallel) {
+      const bool include_symbol_list =
+          absl::GetFlag(FLAGS_include_symbol_list) &&
+          absl::GetFlag(FLAGS_format) == "extbinary";
+      devtools_crosstool_autofdo::ReadLLVMProfilesInParallel(
+          std::vector<std::string>(argv + 1, argv + argc), jobs, &symbol_map,
+          include_symbol_list ? &prof_sym_list : nullptr);
+    } else {
+      for (int i = 1; i < argc; i++) {
+        auto reader = absl::make_unique<LLVMProfileReader>(
+            &symbol_map,
+            absl::GetFlag(FLAGS_merge_special_syms) ? nullptr : &special_syms);
+        reader->ReadFromFile(argv[i]);
+
+        if (absl::GetFlag(FLAGS_include_symbol_list) &&
+            absl::GetFlag(FLAGS_format) == "extbinary") {
+          // Merge profile symbol list if it exists.
+          llvm::sampleprof::ProfileSymbolList* input_list =
+              reader->GetProfileSymbolList();
+          if (input_list) prof_sym_list.merge(*input_list);
+        }
+        reader.reset(nullptr);
       }
-      reader.reset(nullptr);
     }
     symbol_map.CalculateThreshold();
     std::unique_ptr<LLVMProfileWriter> writer(nullptr);
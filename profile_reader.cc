@@ -12,17 +12,17 @@
 namespace devtools_crosstool_autofdo {
 
 void AutoFDOProfileReader::ReadModuleGroup() {
-  CHECK_EQ(gcov_read_unsigned(), GCOV_TAG_MODULE_GROUPING);
+  CHECK_EQ(gcov_.ReadUnsigned(), GCOV_TAG_MODULE_GROUPING);
   // Length of the section. Always 0.
-  gcov_read_unsigned();
+  gcov_.ReadUnsigned();
   // Number of modules. Always 0.
-  gcov_read_unsigned();
+  gcov_.ReadUnsigned();
 }
 
 void AutoFDOProfileReader::ReadFunctionProfile() {
-  CHECK_EQ(gcov_read_unsigned(), GCOV_TAG_AFDO_FUNCTION);
-  gcov_read_unsigned();
-  uint32_t num_functions = gcov_read_unsigned();
+  CHECK_EQ(gcov_.ReadUnsigned(), GCOV_TAG_AFDO_FUNCTION);
+  gcov_.ReadUnsigned();
+  uint32_t num_functions = gcov_.ReadUnsigned();
   SourceStack stack;
   for (uint32_t i = 0; i < num_functions; i++) {
     ReadSymbolProfile(stack, true);
@@ -33,13 +33,13 @@ void AutoFDOProfileReader::ReadSymbolProfile(const SourceStack &stack,
                                              bool update) {
   uint64_t head_count;
   if (stack.size() == 0) {
-    head_count = gcov_read_counter();
+    head_count = gcov_.ReadCounter();
   } else {
     head_count = 0;
   }
-  const char *name = names_.at(gcov_read_unsigned()).c_str();
-  uint32_t num_pos_counts = gcov_read_unsigned();
-  uint32_t num_callsites = gcov_read_unsigned();
+  const char *name = names_.at(gcov_.ReadUnsigned()).c_str();
+  uint32_t num_pos_counts = gcov_.ReadUnsigned();
+  uint32_t num_callsites = gcov_.ReadUnsigned();
   if (stack.size() == 0) {
     symbol_map_->AddSymbol(name);
     if (!force_update_ && symbol_map_->GetSymbolByName(name)->total_count > 0) {
@@ -50,9 +50,9 @@ void AutoFDOProfileReader::ReadSymbolProfile(const SourceStack &stack,
     }
   }
   for (int i = 0; i < num_pos_counts; i++) {
-    uint32_t offset = gcov_read_unsigned();
-    uint32_t num_targets = gcov_read_unsigned();
-    uint64_t count = gcov_read_counter();
+    uint32_t offset = gcov_.ReadUnsigned();
+    uint32_t num_targets = gcov_.ReadUnsigned();
+    uint64_t count = gcov_.ReadCounter();
     SourceInfo info(name, "", "", 0, offset >> 16, offset & 0xffff);
     SourceStack new_stack;
     new_stack.push_back(info);
@@ -63,9 +63,9 @@ void AutoFDOProfileReader::ReadSymbolProfile(const SourceStack &stack,
     }
     for (int j = 0; j < num_targets; j++) {
       // Only indirect call target histogram is supported now.
-      CHECK_EQ(gcov_read_unsigned(), HIST_TYPE_INDIR_CALL_TOPN);
-      const std::string &target_name = names_.at(gcov_read_counter());
-      uint64_t target_count = gcov_read_counter();
+      CHECK_EQ(gcov_.ReadUnsigned(), HIST_TYPE_INDIR_CALL_TOPN);
+      const std::string &target_name = names_.at(gcov_.ReadCounter());
+      uint64_t target_count = gcov_.ReadCounter();
       if (force_update_ || update) {
         symbol_map_->AddIndirectCallTarget(
             new_stack[new_stack.size() - 1].func_name,
@@ -77,7 +77,7 @@ void AutoFDOProfileReader::ReadSymbolProfile(const SourceStack &stack,
     // offset is encoded as:
     //   higher 16 bits: line offset to the start of the function.
     //   lower 16 bits: discriminator.
-    uint32_t offset = gcov_read_unsigned();
+    uint32_t offset = gcov_.ReadUnsigned();
     SourceInfo info(name, "", "", 0, offset >> 16, offset & 0xffff);
     SourceStack new_stack;
     new_stack.push_back(info);
@@ -87,39 +87,41 @@ void AutoFDOProfileReader::ReadSymbolProfile(const SourceStack &stack,
 }
 
 void AutoFDOProfileReader::ReadNameTable() {
-  CHECK_EQ(gcov_read_unsigned(), GCOV_TAG_AFDO_FILE_NAMES);
-  gcov_read_unsigned();
-  uint32_t name_vector_size = gcov_read_unsigned();
+  CHECK_EQ(gcov_.ReadUnsigned(), GCOV_TAG_AFDO_FILE_NAMES);
+  gcov_.ReadUnsigned();
+  uint32_t name_vector_size = gcov_.ReadUnsigned();
   for (uint32_t i = 0; i < name_vector_size; i++) {
-    names_.push_back(gcov_read_string());
+    names_.push_back(gcov_.ReadString());
   }
 }
 
 void AutoFDOProfileReader::ReadWorkingSet() {
-  CHECK_EQ(gcov_read_unsigned(), GCOV_TAG_AFDO_WORKING_SET);
-  gcov_read_unsigned();
+  CHECK_EQ(gcov_.ReadUnsigned(), GCOV_TAG_AFDO_WORKING_SET);
+  gcov_.ReadUnsigned();
   for (uint32_t i = 0; i < NUM_GCOV_WORKING_SETS; i++) {
-    uint32_t num_counters = gcov_read_unsigned();
-    uint64_t min_counter = gcov_read_counter();
+    uint32_t num_counters = gcov_.ReadUnsigned();
+    uint64_t min_counter = gcov_.ReadCounter();
     symbol_map_->UpdateWorkingSet(
         i, num_counters * WORKING_SET_INSN_PER_BB, min_counter);
   }
 }
 
 bool AutoFDOProfileReader::ReadFromFile(const std::string &output_file) {
-  CHECK_NE(gcov_open(output_file.c_str(), 1), -1);
+  CHECK(gcov_.Open(output_file.c_str())) << output_file;
 
   // Read tags
-  CHECK_EQ(gcov_read_unsigned(), GCOV_DATA_MAGIC) << output_file;
-  absl::SetFlag(&FLAGS_gcov_version, gcov_read_unsigned());
-  gcov_read_unsigned();
+  CHECK_EQ(gcov_.ReadUnsigned(), GCOV_DATA_MAGIC) << output_file;
+  uint32_t version = gcov_.ReadUnsigned();
+  absl::SetFlag(&FLAGS_gcov_version, version);
+  gcov_.set_version(version);
+  gcov_.ReadUnsigned();
 
   ReadNameTable();
   ReadFunctionProfile();
   ReadModuleGroup();
   ReadWorkingSet();
 
-  CHECK(!gcov_close());
+  CHECK(!gcov_.Close()) << output_file;
 
   return true;
 }
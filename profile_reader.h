@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "base_profile_reader.h"
+#include "gcov.h"
 #include "symbol_map.h"
 
 namespace devtools_crosstool_autofdo {
@@ -58,6 +59,7 @@ class AutoFDOProfileReader : public ProfileReader {
   SymbolMap *symbol_map_;
   bool force_update_;
   std::vector<std::string> names_;
+  GcovReader gcov_;
 };
 
 }  // namespace devtools_crosstool_autofdo
@@ -23,6 +23,7 @@
 #include "symbol_map.h"
 #include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/strings/str_format.h"
+#include "third_party/abseil/absl/strings/string_view.h"
 
 // sizeof(gcov_unsigned_t)
 #define SIZEOF_UNSIGNED 4
@@ -33,20 +34,20 @@ ABSL_FLAG(bool, debug_dump, false,
 namespace devtools_crosstool_autofdo {
 // Opens the output file, and writes the header.
 bool AutoFDOProfileWriter::WriteHeader(const std::string &output_filename) {
-  if (gcov_open(output_filename.c_str(), -1) == -1) {
+  if (!gcov_.Open(output_filename.c_str())) {
     LOG(FATAL) << "Cannot open file " << output_filename;
     return false;
   }
 
-  gcov_write_unsigned(GCOV_DATA_MAGIC);
-  gcov_write_unsigned(gcov_version_);
-  gcov_write_unsigned(0);
+  gcov_.WriteUnsigned(GCOV_DATA_MAGIC);
+  gcov_.WriteUnsigned(gcov_version_);
+  gcov_.WriteUnsigned(0);
   return true;
 }
 
 // Finishes writing, closes the output file.
 bool AutoFDOProfileWriter::WriteFinish() {
-  if (gcov_close()) {
+  if (gcov_.Close()) {
     LOG(ERROR) << "Cannot close the gcov file.";
     return false;
   }
@@ -89,61 +90,63 @@ class SourceProfileLengther: public SymbolTraverser {
 
 class SourceProfileWriter: public SymbolTraverser {
  public:
-  static void Write(const SymbolMap &symbol_map, const StringIndexMap &map) {
-    SourceProfileWriter writer(map);
+  static void Write(const SymbolMap &symbol_map, const StringIndexMap &map,
+                    GcovWriter *gcov) {
+    SourceProfileWriter writer(map, gcov);
     writer.Start(symbol_map);
   }
 
  protected:
   virtual void Visit(const Symbol *node) {
-    gcov_write_unsigned(node->pos_counts.size());
-    gcov_write_unsigned(node->callsites.size());
+    gcov_->WriteUnsigned(node->pos_counts.size());
+    gcov_->WriteUnsigned(node->callsites.size());
     for (const auto &pos_count : node->pos_counts) {
       uint64_t value = pos_count.first;
-      gcov_write_unsigned(SourceInfo::GenerateCompressedOffset(value));
-      gcov_write_unsigned(pos_count.second.target_map.size());
-      gcov_write_counter(pos_count.second.count);
+      gcov_->WriteUnsigned(SourceInfo::GenerateCompressedOffset(value));
+      gcov_->WriteUnsigned(pos_count.second.target_map.size());
+      gcov_->WriteCounter(pos_count.second.count);
       TargetCountPairs target_counts;
       GetSortedTargetCountPairs(pos_count.second.target_map, &target_counts);
       for (const auto &target_count : pos_count.second.target_map) {
-        gcov_write_unsigned(HIST_TYPE_INDIR_CALL_TOPN);
-        gcov_write_counter(GetStringIndex(target_count.first));
-        gcov_write_counter(target_count.second);
+        gcov_->WriteUnsigned(HIST_TYPE_INDIR_CALL_TOPN);
+        gcov_->WriteCounter(GetStringIndex(target_count.first));
+        gcov_->WriteCounter(target_count.second);
       }
     }
   }
 
   virtual void VisitTopSymbol(const std::string &name, const Symbol *node) {
-    gcov_write_counter(node->head_count);
-    gcov_write_unsigned(GetStringIndex(Symbol::Name(name.c_str())));
+    gcov_->WriteCounter(node->head_count);
+    gcov_->WriteUnsigned(GetStringIndex(Symbol::Name(name.c_str())));
   }
 
   virtual void VisitCallsite(const Callsite &callsite) {
     uint64_t value = callsite.first;
-    gcov_write_unsigned(SourceInfo::GenerateCompressedOffset(value));
-    gcov_write_unsigned(GetStringIndex(Symbol::Name(callsite.second)));
+    gcov_->WriteUnsigned(SourceInfo::GenerateCompressedOffset(value));
+    gcov_->WriteUnsigned(GetStringIndex(Symbol::Name(callsite.second)));
   }
 
  private:
-  explicit SourceProfileWriter(const StringIndexMap &map) : map_(map) {}
+  SourceProfileWriter(const StringIndexMap &map, GcovWriter *gcov)
+      : map_(map), gcov_(gcov) {}
 
-  int GetStringIndex(const std::string &str) {
+  int GetStringIndex(absl::string_view str) {
     StringIndexMap::const_iterator ret = map_.find(str);
     CHECK(ret != map_.end());
     return ret->second;
   }
 
   const StringIndexMap &map_;
+  GcovWriter *gcov_;
   DISALLOW_COPY_AND_ASSIGN(SourceProfileWriter);
 };
 
 void AutoFDOProfileWriter::WriteFunctionProfile() {
-  typedef std::map<std::string, int> StringIndexMap;
   // Map from a string to its index in this map. Providing a partial
   // ordering of all output strings.
   StringIndexMap string_index_map;
   int length_4bytes = 0, current_name_index = 0;
-  string_index_map[std::string()] = 0;
+  string_index_map[InternString("")] = 0;
 
   StringTableUpdater::Update(*symbol_map_, &string_index_map);
 
@@ -156,11 +159,12 @@ void AutoFDOProfileWriter::WriteFunctionProfile() {
   length_4bytes += 1;
 
   // Writes the GCOV_TAG_AFDO_FILE_NAMES section.
-  gcov_write_unsigned(GCOV_TAG_AFDO_FILE_NAMES);
-  gcov_write_unsigned(length_4bytes);
-  gcov_write_unsigned(string_index_map.size());
+  gcov_.WriteUnsigned(GCOV_TAG_AFDO_FILE_NAMES);
+  gcov_.WriteUnsigned(length_4bytes);
+  gcov_.WriteUnsigned(string_index_map.size());
   for (const auto &name_index : string_index_map) {
-    char *c = strdup(name_index.first.c_str());
+    // Interned strings are null-terminated.
+    char *c = strdup(name_index.first.data());
     int len = strlen(c);
     // Workaround https://gcc.gnu.org/bugzilla/show_bug.cgi?id=64346
     // We should not have D4Ev in our profile because it does not exist
@@ -173,33 +177,33 @@ void AutoFDOProfileWriter::WriteFunctionProfile() {
     } else if (len > 12 && !strcmp(c + len - 11, "C4EPKcRKS2_")) {
       c[len - 10] = '2';
     }
-    gcov_write_string(c);
+    gcov_.WriteString(c);
     free(c);
   }
 
   // Compute the length of the GCOV_TAG_AFDO_FUNCTION section.
   SourceProfileLengther length(*symbol_map_);
-  gcov_write_unsigned(GCOV_TAG_AFDO_FUNCTION);
-  gcov_write_unsigned(length.length() + 1);
-  gcov_write_unsigned(length.num_functions());
-  SourceProfileWriter::Write(*symbol_map_, string_index_map);
+  gcov_.WriteUnsigned(GCOV_TAG_AFDO_FUNCTION);
+  gcov_.WriteUnsigned(length.length() + 1);
+  gcov_.WriteUnsigned(length.num_functions());
+  SourceProfileWriter::Write(*symbol_map_, string_index_map, &gcov_);
 }
 
 void AutoFDOProfileWriter::WriteModuleGroup() {
-  gcov_write_unsigned(GCOV_TAG_MODULE_GROUPING);
+  gcov_.WriteUnsigned(GCOV_TAG_MODULE_GROUPING);
   // Length of the section
-  gcov_write_unsigned(0);
+  gcov_.WriteUnsigned(0);
   // Number of modules
-  gcov_write_unsigned(0);
+  gcov_.WriteUnsigned(0);
 }
 
 void AutoFDOProfileWriter::WriteWorkingSet() {
-  gcov_write_unsigned(GCOV_TAG_AFDO_WORKING_SET);
-  gcov_write_unsigned(3 * NUM_GCOV_WORKING_SETS);
+  gcov_.WriteUnsigned(GCOV_TAG_AFDO_WORKING_SET);
+  gcov_.WriteUnsigned(3 * NUM_GCOV_WORKING_SETS);
   const gcov_working_set_info *working_set = symbol_map_->GetWorkingSets();
   for (int i = 0; i < NUM_GCOV_WORKING_SETS; i++) {
-    gcov_write_unsigned(working_set[i].num_counters / WORKING_SET_INSN_PER_BB);
-    gcov_write_counter(working_set[i].min_counter);
+    gcov_.WriteUnsigned(working_set[i].num_counters / WORKING_SET_INSN_PER_BB);
+    gcov_.WriteCounter(working_set[i].min_counter);
   }
 }
 
@@ -231,9 +235,10 @@ class ProfileDumper : public SymbolTraverser {
 
  protected:
   void DumpSourceInfo(SourceInfo info, int indent) {
-    printf("%*sDirectory name: %s\n", indent, " ", info.dir_name.c_str());
-    printf("%*sFile name:      %s\n", indent, " ",
-           info.file_name.c_str());
+    printf("%*sDirectory name: %.*s\n", indent, " ",
+           static_cast<int>(info.dir_name.size()), info.dir_name.data());
+    printf("%*sFile name:      %.*s\n", indent, " ",
+           static_cast<int>(info.file_name.size()), info.file_name.data());
     printf("%*sFunction name:  %s\n", indent, " ", info.func_name);
     printf("%*sStart line:     %u\n", indent, " ", info.start_line);
     printf("%*sLine:           %u\n", indent, " ", info.line);
@@ -324,13 +329,13 @@ class ProfileDumper : public SymbolTraverser {
     printf("VisitCallSite: %s\n", callsite.second);
     printf("callsite.first: %lu\n", callsite.first);
     printf("GetStringIndex(callsite.second): %u\n",
-           GetStringIndex(callsite.second ? callsite.second : std::string()));
+           GetStringIndex(callsite.second ? callsite.second : ""));
   }
 
  private:
   explicit ProfileDumper(const StringIndexMap &map) : map_(map) {}
 
-  int GetStringIndex(const std::string &str) {
+  int GetStringIndex(absl::string_view str) {
     StringIndexMap::const_iterator ret = map_.find(str);
     CHECK(ret != map_.end());
     return ret->second;
@@ -7,8 +7,12 @@
 #define AUTOFDO_PROFILE_WRITER_H_
 
 #include <cstdint>
+#include <map>
 
+#include "gcov.h"
+#include "string_pool.h"
 #include "symbol_map.h"
+#include "third_party/abseil/absl/strings/string_view.h"
 
 namespace devtools_crosstool_autofdo {
 
@@ -33,9 +37,10 @@ class AutoFDOProfileWriter : public ProfileWriter {
  public:
   explicit AutoFDOProfileWriter(const SymbolMap *symbol_map,
                                 uint32_t gcov_version)
-      : ProfileWriter(symbol_map), gcov_version_(gcov_version) {}
+      : ProfileWriter(symbol_map), gcov_version_(gcov_version),
+        gcov_(gcov_version) {}
   explicit AutoFDOProfileWriter(uint32_t gcov_version)
-      : gcov_version_(gcov_version) {}
+      : gcov_version_(gcov_version), gcov_(gcov_version) {}
 
   bool WriteToFile(const std::string &output_file) override;
 
@@ -107,6 +112,7 @@ class AutoFDOProfileWriter : public ProfileWriter {
   void WriteWorkingSet();
 
   uint32_t gcov_version_;
+  GcovWriter gcov_;
 };
 
 class SymbolTraverser {
@@ -142,7 +148,9 @@ class SymbolTraverser {
   DISALLOW_COPY_AND_ASSIGN(SymbolTraverser);
 };
 
-typedef std::map<std::string, int> StringIndexMap;
+// Keys are interned in StringPool::Global(), so they outlive the symbols they
+// were collected from.
+typedef std::map<absl::string_view, int> StringIndexMap;
 
 class StringTableUpdater: public SymbolTraverser {
  public:
@@ -155,21 +163,26 @@ class StringTableUpdater: public SymbolTraverser {
   void Visit(const Symbol *node) override {
     for (const auto &pos_count : node->pos_counts) {
       for (const auto &name_count : pos_count.second.target_map) {
-        (*map_)[name_count.first] = 0;
+        Add(name_count.first);
       }
     }
   }
 
   void VisitCallsite(const Callsite &callsite) {
-    (*map_)[Symbol::Name(callsite.second)] = 0;
+    Add(Symbol::Name(callsite.second));
   }
 
   void VisitTopSymbol(const std::string &name, const Symbol *node) override {
-    (*map_)[Symbol::Name(name.c_str())] = 0;
+    Add(Symbol::Name(name.c_str()));
   }
 
  private:
   explicit StringTableUpdater(StringIndexMap *map) : map_(map) {}
+
+  // Only names not in the table yet need to be interned.
+  void Add(absl::string_view name) {
+    if (map_->find(name) == map_->end()) map_->emplace(InternString(name), 0);
+  }
   StringIndexMap *map_;
   DISALLOW_COPY_AND_ASSIGN(StringTableUpdater);
 };
@@ -7,12 +7,14 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <list>
 #include <memory>
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "base/commandlineflags.h"
 #include "base/logging.h"
@@ -29,6 +31,52 @@ ABSL_FLAG(uint64_t, strip_dup_backedge_stride_limit, 0x1000,
 
 namespace devtools_crosstool_autofdo {
 
+void AddRangeCountsToAddresses(const RangeCountMap &range_counts,
+                               uint64_t start_addr, uint64_t end_addr,
+                               AddressCountMap *address_counts) {
+  // A range adds its count from its first address, and the number of ranges
+  // covering an address tells whether it has a count at all.
+  struct Boundary {
+    uint64_t addr;
+    uint64_t count;
+    int ranges;
+  };
+  std::vector<Boundary> boundaries;
+  for (auto iter = range_counts.lower_bound(Range(start_addr, 0));
+       iter != range_counts.end() && iter->first.first < end_addr; ++iter) {
+    const uint64_t last_addr = std::min(iter->first.second, end_addr - 1);
+    if (last_addr < iter->first.first) continue;
+    boundaries.push_back({iter->first.first, iter->second, 1});
+    boundaries.push_back({last_addr + 1, iter->second, -1});
+  }
+  std::sort(boundaries.begin(), boundaries.end(),
+            [](const Boundary &a, const Boundary &b) {
+              return a.addr < b.addr;
+            });
+
+  uint64_t count = 0;
+  int ranges = 0;
+  for (size_t i = 0; i < boundaries.size();) {
+    const uint64_t addr = boundaries[i].addr;
+    for (; i < boundaries.size() && boundaries[i].addr == addr; ++i) {
+      if (boundaries[i].ranges > 0)
+        count += boundaries[i].count;
+      else
+        count -= boundaries[i].count;
+      ranges += boundaries[i].ranges;
+    }
+    if (ranges == 0) continue;
+    // The addresses up to the next boundary are covered by the same ranges,
+    // and are inserted in order right before the hint.
+    auto hint = address_counts->lower_bound(addr);
+    for (uint64_t a = addr; a < boundaries[i].addr; ++a) {
+      hint = address_counts->try_emplace(hint, a, 0);
+      hint->second += count;
+      ++hint;
+    }
+  }
+}
+
 PerfDataSampleReader::PerfDataSampleReader(const std::string &profile_file,
                                            const std::string &re,
                                            const std::string &build_id)
@@ -100,7 +148,7 @@ std::set<uint64_t> SampleReader::GetSampledAddresses() const {
 }
 
 uint64_t SampleReader::GetSampleCountOrZero(uint64_t addr) const {
-  AddressCountMap::const_iterator iter = address_count_map_.find(addr);
+  FlatAddressCountMap::const_iterator iter = address_count_map_.find(addr);
   if (iter == address_count_map_.end())
     return 0;
   else
@@ -165,7 +213,7 @@ bool TextSampleReaderWriter::Append(const std::string &profile_file) {
       fclose(fp);
       return false;
     }
-    range_count_map_[Range(from, to)] += count;
+    range_count_map_.Add(Range(from, to), count);
   }
 
   // Reads in the addr_count_map
@@ -181,7 +229,7 @@ bool TextSampleReaderWriter::Append(const std::string &profile_file) {
       fclose(fp);
       return false;
     }
-    address_count_map_[addr] += count;
+    address_count_map_.Add(addr, count);
   }
 
   // Reads in the branch_count_map
@@ -198,25 +246,28 @@ bool TextSampleReaderWriter::Append(const std::string &profile_file) {
       fclose(fp);
       return false;
     }
-    branch_count_map_[Branch(from, to)] += count;
+    branch_count_map_.Add(Branch(from, to), count);
   }
   fclose(fp);
+  CompactMaps();
   return true;
 }
 
 void TextSampleReaderWriter::Merge(const SampleReader &reader) {
   for (const auto &range_count : reader.range_count_map()) {
-    range_count_map_[range_count.first] += range_count.second;
+    range_count_map_.Add(range_count.first, range_count.second);
   }
   for (const auto &addr_count : reader.address_count_map()) {
-    address_count_map_[addr_count.first] += addr_count.second;
+    address_count_map_.Add(addr_count.first, addr_count.second);
   }
   for (const auto &branch_count : reader.branch_count_map()) {
-    branch_count_map_[branch_count.first] += branch_count.second;
+    branch_count_map_.Add(branch_count.first, branch_count.second);
   }
+  CompactMaps();
 }
 
 bool TextSampleReaderWriter::Write(const char *aux_info) {
+  CompactMaps();
   FILE *fp = fopen(profile_file_.c_str(), "w");
   if (fp == NULL) {
     LOG(ERROR) << "Cannot open " << profile_file_ << " to write";
@@ -278,13 +329,14 @@ bool PerfDataSampleReader::Append(const std::string &profile_file) {
       continue;
     }
     if (MatchBinary(event.dso_and_offset.dso_name())) {
-      address_count_map_[event.dso_and_offset.offset()]++;
+      address_count_map_.Add(event.dso_and_offset.offset(), 1);
     }
     if (event.branch_stack.size() > 0 &&
         MatchBinary(event.branch_stack[0].to.dso_name()) &&
         MatchBinary(event.branch_stack[0].from.dso_name())) {
-      branch_count_map_[Branch(event.branch_stack[0].from.offset(),
-                               event.branch_stack[0].to.offset())]++;
+      branch_count_map_.Add(Branch(event.branch_stack[0].from.offset(),
+                                   event.branch_stack[0].to.offset()),
+                            1);
     }
     for (int i = 1; i < event.branch_stack.size(); i++) {
       if (!MatchBinary(event.branch_stack[i].to.dso_name())) {
@@ -314,13 +366,15 @@ bool PerfDataSampleReader::Append(const std::string &profile_file) {
         LOG(WARNING) << "Bogus LBR data: " << begin << "->" << end;
         continue;
       }
-      range_count_map_[Range(begin, end)]++;
+      range_count_map_.Add(Range(begin, end), 1);
       if (MatchBinary(event.branch_stack[i].from.dso_name())) {
-        branch_count_map_[Branch(event.branch_stack[i].from.offset(),
-                                 event.branch_stack[i].to.offset())]++;
+        branch_count_map_.Add(Branch(event.branch_stack[i].from.offset(),
+                                     event.branch_stack[i].to.offset()),
+                              1);
       }
     }
   }
+  CompactMaps();
   return true;
 }
 }  // namespace devtools_crosstool_autofdo
@@ -6,12 +6,14 @@
 #ifndef AUTOFDO_SAMPLE_READER_H_
 #define AUTOFDO_SAMPLE_READER_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <map>
 #include <regex>  // NOLINT
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "base/integral_types.h"
 #include "base/macros.h"
@@ -35,6 +37,85 @@ typedef std::map<Range, uint64_t> RangeCountMap;
 typedef std::pair<uint64_t, uint64_t> Branch;
 typedef std::map<Branch, uint64_t> BranchCountMap;
 
+// Flat map from a sample key to its count, stored as a vector sorted by key.
+// Samples are appended unsorted and merged into the sorted part in batches,
+// so that reading a profile does not allocate a tree node per sample.
+// Compact() must be called after the last Add() and before any lookup.
+template <typename KeyT>
+class FlatCountMap {
+ public:
+  typedef std::pair<KeyT, uint64_t> value_type;
+  typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+  FlatCountMap() : sorted_size_(0) {}
+
+  // Adds COUNT to the count of KEY.
+  void Add(const KeyT &key, uint64_t count) {
+    entries_.emplace_back(key, count);
+    // Bound the unsorted part by the size of the sorted part, which keeps
+    // the memory within a constant factor of the number of distinct keys.
+    if (entries_.size() >= 2 * sorted_size_ + kMinPendingEntries) Compact();
+  }
+
+  // Sorts the pending entries and merges the counts of equal keys.
+  void Compact() {
+    if (sorted_size_ == entries_.size()) return;
+    auto key_less = [](const value_type &a, const value_type &b) {
+      return a.first < b.first;
+    };
+    auto middle = entries_.begin() + sorted_size_;
+    std::sort(middle, entries_.end(), key_less);
+    std::inplace_merge(entries_.begin(), middle, entries_.end(), key_less);
+    size_t out = 0;
+    for (size_t in = 1; in < entries_.size(); ++in) {
+      if (entries_[in].first == entries_[out].first)
+        entries_[out].second += entries_[in].second;
+      else
+        entries_[++out] = entries_[in];
+    }
+    entries_.resize(out + 1);
+    sorted_size_ = entries_.size();
+  }
+
+  void clear() {
+    entries_.clear();
+    sorted_size_ = 0;
+  }
+
+  const_iterator begin() const { return entries_.begin(); }
+  const_iterator end() const { return entries_.end(); }
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+
+  const_iterator find(const KeyT &key) const {
+    const_iterator iter = std::lower_bound(
+        entries_.begin(), entries_.end(), key,
+        [](const value_type &entry, const KeyT &k) { return entry.first < k; });
+    if (iter == entries_.end() || iter->first != key) return entries_.end();
+    return iter;
+  }
+
+ private:
+  static constexpr size_t kMinPendingEntries = 1 << 16;
+
+  std::vector<value_type> entries_;
+  // entries_[0, sorted_size_) is sorted by key and has no duplicate keys.
+  size_t sorted_size_;
+};
+
+typedef FlatCountMap<uint64_t> FlatAddressCountMap;
+typedef FlatCountMap<Range> FlatRangeCountMap;
+typedef FlatCountMap<Branch> FlatBranchCountMap;
+
+// Adds the count of each range of RANGE_COUNTS that starts in
+// [START_ADDR, END_ADDR) to every address of the range, which ends at most at
+// END_ADDR, in ADDRESS_COUNTS. The counts of overlapping ranges are summed in
+// a single sweep over the sorted range boundaries, so each address is only
+// visited once however many ranges cover it.
+void AddRangeCountsToAddresses(const RangeCountMap &range_counts,
+                               uint64_t start_addr, uint64_t end_addr,
+                               AddressCountMap *address_counts);
+
 // Reads in the profile data, and represent it in address_count_map_.
 class SampleReader {
  public:
@@ -43,15 +124,15 @@ class SampleReader {
 
   bool ReadAndSetTotalCount();
 
-  const AddressCountMap &address_count_map() const {
+  const FlatAddressCountMap &address_count_map() const {
     return address_count_map_;
   }
 
-  const RangeCountMap &range_count_map() const {
+  const FlatRangeCountMap &range_count_map() const {
     return range_count_map_;
   }
 
-  const BranchCountMap &branch_count_map() const {
+  const FlatBranchCountMap &branch_count_map() const {
     return branch_count_map_;
   }
 
@@ -74,10 +155,17 @@ class SampleReader {
   // Virtual read function to read from different types of profiles.
   virtual bool Read() = 0;
 
+  // Compacts all maps. Must be called after adding samples to them.
+  void CompactMaps() {
+    address_count_map_.Compact();
+    range_count_map_.Compact();
+    branch_count_map_.Compact();
+  }
+
   uint64_t total_count_;
-  AddressCountMap address_count_map_;
-  RangeCountMap range_count_map_;
-  BranchCountMap branch_count_map_;
+  FlatAddressCountMap address_count_map_;
+  FlatRangeCountMap range_count_map_;
+  FlatBranchCountMap branch_count_map_;
 };
 
 // Base class that reads in the profile from a sample data file.
@@ -118,14 +206,19 @@ class TextSampleReaderWriter : public FileSampleReader {
   bool Write(const char *aux_info);
   bool IsFileExist() const;
   void SetAddressCountMap(const AddressCountMap &map) {
-    address_count_map_ = map;
+    address_count_map_.clear();
+    for (const auto &addr_count : map)
+      address_count_map_.Add(addr_count.first, addr_count.second);
+    address_count_map_.Compact();
   }
-  void IncAddress(uint64_t addr) { address_count_map_[addr]++; }
+  // The Inc* functions only append the samples. The maps are compacted by
+  // Write().
+  void IncAddress(uint64_t addr) { address_count_map_.Add(addr, 1); }
   void IncRange(uint64_t start, uint64_t end) {
-    range_count_map_[Range(start, end)]++;
+    range_count_map_.Add(Range(start, end), 1);
   }
   void IncBranch(uint64_t from, uint64_t to) {
-    branch_count_map_[Branch(from, to)]++;
+    branch_count_map_.Add(Branch(from, to), 1);
   }
   void set_profile_file(const std::string &file) { profile_file_ = file; }
 
@@ -8,6 +8,7 @@
 
 #include "sample_reader.h"
 
+#include <algorithm>
 #include <utility>
 
 #include "base/commandlineflags.h"
@@ -57,7 +58,7 @@ TEST_F(SampleReaderTest, ReadLBR) {
   EXPECT_EQ(reader.GetSampleCountOrZero(0x1005), 18);
   EXPECT_EQ(reader.GetTotalSampleCount(), 134622);
 
-  const devtools_crosstool_autofdo::RangeCountMap &range_map =
+  const devtools_crosstool_autofdo::FlatRangeCountMap &range_map =
       reader.range_count_map();
   EXPECT_EQ(range_map.size(), 357);
 
@@ -94,7 +95,7 @@ TEST_F(SampleReaderTest, ReadLBRWithDupEntries) {
 
   EXPECT_EQ(reader.GetTotalSampleCount(), 327191);
 
-  const devtools_crosstool_autofdo::RangeCountMap &range_map =
+  const devtools_crosstool_autofdo::FlatRangeCountMap &range_map =
       reader.range_count_map();
 
   // Expect sampleReader to filter out duplicated LBR entries
@@ -135,4 +136,51 @@ TEST_F(SampleReaderTest, ReadVmlinuxProfile) {
   ASSERT_TRUE(reader.ReadAndSetTotalCount());
   EXPECT_EQ(reader.GetTotalSampleCount(), 1936);
 }
+
+TEST(FlatCountMapTest, CollapsesEqualKeys) {
+  devtools_crosstool_autofdo::FlatRangeCountMap map;
+  // Add enough samples to trigger compaction while adding.
+  for (int i = 0; i < 300000; i++) {
+    map.Add(devtools_crosstool_autofdo::Range(i % 1000, i % 1000 + 4), 1);
+  }
+  map.Add(devtools_crosstool_autofdo::Range(5, 9), 10);
+  map.Compact();
+
+  EXPECT_EQ(map.size(), 1000);
+  EXPECT_TRUE(std::is_sorted(
+      map.begin(), map.end(),
+      [](const auto &a, const auto &b) { return a.first < b.first; }));
+  auto iter = map.find(devtools_crosstool_autofdo::Range(5, 9));
+  ASSERT_NE(iter, map.end());
+  EXPECT_EQ(iter->second, 310);
+  EXPECT_EQ(map.find(devtools_crosstool_autofdo::Range(5, 8)), map.end());
+}
+
+TEST(AddRangeCountsToAddressesTest, MatchesPerAddressExpansion) {
+  devtools_crosstool_autofdo::RangeCountMap range_counts;
+  // Overlapping ranges, some of them crossing the function boundaries.
+  for (uint64_t begin = 0x90; begin < 0x180; begin += 7) {
+    for (uint64_t size = 0; size < 0x40; size += 13)
+      range_counts[devtools_crosstool_autofdo::Range(begin, begin + size)] +=
+          begin * size + 1;
+  }
+  range_counts[devtools_crosstool_autofdo::Range(0x120, 0x110)] = 5;
+  range_counts[devtools_crosstool_autofdo::Range(0x130, 0x138)] = 0;
+  const uint64_t start_addr = 0x100, end_addr = 0x160;
+
+  devtools_crosstool_autofdo::AddressCountMap expected;
+  for (const auto &range_count : range_counts) {
+    if (range_count.first.first < start_addr ||
+        range_count.first.first >= end_addr)
+      continue;
+    const uint64_t last_addr =
+        std::min(range_count.first.second, end_addr - 1);
+    for (uint64_t addr = range_count.first.first; addr <= last_addr; addr++)
+      expected[addr] += range_count.second;
+  }
+  devtools_crosstool_autofdo::AddressCountMap actual;
+  devtools_crosstool_autofdo::AddRangeCountsToAddresses(
+      range_counts, start_addr, end_addr, &actual);
+  EXPECT_EQ(actual, expected);
+}
 }  // namespace
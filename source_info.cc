@@ -41,14 +41,15 @@ bool SourceInfo::operator<(const SourceInfo &p) const {
   // llvm::StringRef::compare. C++ string compare should return the same result,
   // but since converting to llvm::StringRef is very cheap, and both functions
   // may not stay in sync, preferring to retain the prior functionality.
-  auto p_file_name_ref = llvm::StringRef(p.file_name);
-  auto file_name_ref = llvm::StringRef(file_name);
+  auto p_file_name_ref =
+      llvm::StringRef(p.file_name.data(), p.file_name.size());
+  auto file_name_ref = llvm::StringRef(file_name.data(), file_name.size());
   ret = file_name_ref.compare(p_file_name_ref);
   if (ret != 0) {
     return ret < 0;
   }
-  auto p_dir_name_ref = llvm::StringRef(p.dir_name);
-  auto dir_name_ref = llvm::StringRef(dir_name);
+  auto p_dir_name_ref = llvm::StringRef(p.dir_name.data(), p.dir_name.size());
+  auto dir_name_ref = llvm::StringRef(dir_name.data(), dir_name.size());
   return dir_name_ref.compare(p_dir_name_ref) < 0;
 }
 }  // namespace devtools_crosstool_autofdo
@@ -9,6 +9,9 @@
 
 #include "base/integral_types.h"
 #include "base/macros.h"
+#include "string_pool.h"
+#include "third_party/abseil/absl/strings/str_cat.h"
+#include "third_party/abseil/absl/strings/string_view.h"
 #if defined(HAVE_LLVM)
 #include "llvm/IR/DebugInfoMetadata.h"
 #endif
@@ -19,17 +22,14 @@ namespace devtools_crosstool_autofdo {
 struct SourceInfo {
   SourceInfo() : func_name(NULL), start_line(0), line(0), discriminator(0) {}
 
-#if defined(HAVE_LLVM)
-  SourceInfo(const char *func_name, llvm::StringRef dir_name,
-             llvm::StringRef file_name, uint32_t start_line, uint32_t line,
+  // "dir_name" and "file_name" are interned, so they do not need to outlive
+  // the SourceInfo.
+  SourceInfo(const char *func_name, absl::string_view dir_name,
+             absl::string_view file_name, uint32_t start_line, uint32_t line,
              uint32_t discriminator)
-#else
-  SourceInfo(const char *func_name, std::string dir_name, std::string file_name,
-             uint32_t start_line, uint32_t line, uint32_t discriminator)
-#endif
       : func_name(func_name),
-        dir_name(dir_name),
-        file_name(file_name),
+        dir_name(InternString(dir_name)),
+        file_name(InternString(file_name)),
         start_line(start_line),
         line(line),
         discriminator(discriminator) {
@@ -39,8 +39,8 @@ struct SourceInfo {
 
   std::string RelativePath() const {
     if (!dir_name.empty())
-      return dir_name + "/" + file_name;
-    if (!file_name.empty()) return file_name;
+      return absl::StrCat(dir_name, "/", file_name);
+    if (!file_name.empty()) return std::string(file_name);
     return std::string();
   }
 
@@ -100,8 +100,10 @@ struct SourceInfo {
 #endif
 
   const char *func_name;
-  std::string dir_name;
-  std::string file_name;
+  // Views of strings in StringPool::Global(). Source infos are copied around a
+  // lot and most of them share a handful of file names.
+  absl::string_view dir_name;
+  absl::string_view file_name;
   uint32_t start_line;
   uint32_t line;
   uint32_t discriminator;
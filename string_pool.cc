@@ -0,0 +1,80 @@
+// Class to intern the strings shared by many profile data structures.
+
+#include "string_pool.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "third_party/abseil/absl/hash/hash.h"
+
+namespace devtools_crosstool_autofdo {
+
+namespace {
+// Most interned strings are file, directory and function names, so a block
+// holds many thousands of them.
+constexpr size_t kBlockSize = 256 << 10;
+}  // namespace
+
+StringPool &StringPool::Global() {
+  static StringPool *const pool = new StringPool();
+  return *pool;
+}
+
+absl::string_view StringPool::Intern(absl::string_view str) {
+  if (str.empty()) return absl::string_view("", 0);
+  // The sets hash the strings again and use the low bits of the hash, so the
+  // shard is picked by the high bits.
+  const size_t hash = absl::Hash<absl::string_view>()(str);
+  Shard &shard = shards_[hash >> (8 * sizeof(size_t) - kShardBits)];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.strings.find(str);
+  if (it != shard.strings.end()) return *it;
+  absl::string_view stored = shard.Store(str);
+  shard.strings.insert(stored);
+  return stored;
+}
+
+absl::string_view StringPool::Shard::Store(absl::string_view str) {
+  const size_t size = str.size() + 1;
+  if (size > free_size) {
+    // Strings larger than a block get a block of their own, so they do not
+    // waste the rest of the current one.
+    const size_t block_size = std::max(size, kBlockSize);
+    blocks.emplace_back(new char[block_size]);
+    allocated_bytes += block_size;
+    if (block_size == kBlockSize) {
+      free_begin = blocks.back().get();
+      free_size = block_size;
+    } else {
+      std::memcpy(blocks.back().get(), str.data(), str.size());
+      blocks.back()[str.size()] = '\0';
+      return absl::string_view(blocks.back().get(), str.size());
+    }
+  }
+  char *dest = free_begin;
+  std::memcpy(dest, str.data(), str.size());
+  dest[str.size()] = '\0';
+  free_begin += size;
+  free_size -= size;
+  return absl::string_view(dest, str.size());
+}
+
+size_t StringPool::size() const {
+  size_t size = 0;
+  for (const Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size += shard.strings.size();
+  }
+  return size;
+}
+
+size_t StringPool::allocated_bytes() const {
+  size_t allocated_bytes = 0;
+  for (const Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    allocated_bytes += shard.allocated_bytes;
+  }
+  return allocated_bytes;
+}
+
+}  // namespace devtools_crosstool_autofdo
@@ -0,0 +1,70 @@
+// Class to intern the strings shared by many profile data structures.
+
+#ifndef AUTOFDO_STRING_POOL_H_
+#define AUTOFDO_STRING_POOL_H_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "third_party/abseil/absl/container/flat_hash_set.h"
+#include "third_party/abseil/absl/strings/string_view.h"
+
+namespace devtools_crosstool_autofdo {
+
+// StringPool keeps one copy of every distinct string interned into it, packed
+// into large blocks. The views it hands out stay valid for the lifetime of the
+// pool and point to null-terminated characters, so their data() can be used
+// as a C string. Strings are never freed individually.
+//
+// All methods are thread-safe. The strings are split by hash into shards with
+// a lock each, so that threads interning different strings rarely wait for
+// each other.
+class StringPool {
+ public:
+  StringPool() = default;
+  StringPool(const StringPool &) = delete;
+  StringPool &operator=(const StringPool &) = delete;
+
+  // Returns the process-wide pool. It is never destroyed, so its strings can
+  // be referenced from objects with static storage duration.
+  static StringPool &Global();
+
+  // Returns the pooled copy of "str", adding it to the pool if needed.
+  absl::string_view Intern(absl::string_view str);
+
+  // Returns the number of distinct strings in the pool.
+  size_t size() const;
+
+  // Returns the number of bytes allocated for the pooled characters.
+  size_t allocated_bytes() const;
+
+ private:
+  static constexpr int kShardBits = 4;
+  static constexpr int kNumShards = 1 << kShardBits;
+
+  // The strings whose hash selects the shard, and the blocks that hold them.
+  struct alignas(64) Shard {
+    // Copies "str" and a null terminator into the current block.
+    absl::string_view Store(absl::string_view str);
+
+    mutable std::mutex mutex;
+    absl::flat_hash_set<absl::string_view> strings;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *free_begin = nullptr;
+    size_t free_size = 0;
+    size_t allocated_bytes = 0;
+  };
+
+  Shard shards_[kNumShards];
+};
+
+// Interns "str" into StringPool::Global().
+inline absl::string_view InternString(absl::string_view str) {
+  return StringPool::Global().Intern(str);
+}
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_STRING_POOL_H_
@@ -0,0 +1,82 @@
+// These tests check that StringPool returns stable, shared copies of strings.
+#include "string_pool.h"
+
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "source_info.h"
+#include "gtest/gtest.h"
+#include "third_party/abseil/absl/strings/str_cat.h"
+#include "third_party/abseil/absl/strings/string_view.h"
+
+namespace {
+
+using ::devtools_crosstool_autofdo::InternString;
+using ::devtools_crosstool_autofdo::SourceInfo;
+using ::devtools_crosstool_autofdo::StringPool;
+
+TEST(StringPoolTest, InternReturnsSharedCopies) {
+  StringPool pool;
+  std::string foo = "foo.cc";
+  absl::string_view interned = pool.Intern(foo);
+  EXPECT_EQ(interned, "foo.cc");
+  EXPECT_NE(interned.data(), foo.data());
+  // Interned strings are null-terminated.
+  EXPECT_EQ(interned.data()[interned.size()], '\0');
+
+  // The copy does not depend on the original string.
+  foo = "bar.cc";
+  EXPECT_EQ(interned, "foo.cc");
+  EXPECT_EQ(pool.Intern("foo.cc").data(), interned.data());
+  EXPECT_NE(pool.Intern(foo).data(), interned.data());
+  EXPECT_EQ(pool.size(), 2);
+
+  EXPECT_TRUE(pool.Intern("").empty());
+  EXPECT_EQ(pool.size(), 2);
+}
+
+TEST(StringPoolTest, LargeStringsStayValid) {
+  StringPool pool;
+  std::vector<absl::string_view> interned;
+  // Fill several blocks, with a few strings larger than a block.
+  for (int i = 0; i < 20000; ++i)
+    interned.push_back(pool.Intern(absl::StrCat("/some/directory/", i)));
+  std::string large(1 << 20, 'x');
+  absl::string_view interned_large = pool.Intern(large);
+  for (int i = 0; i < 20000; ++i)
+    EXPECT_EQ(interned[i], absl::StrCat("/some/directory/", i));
+  EXPECT_EQ(interned_large, large);
+  EXPECT_EQ(pool.size(), 20001);
+  EXPECT_GE(pool.allocated_bytes(), large.size());
+}
+
+TEST(StringPoolTest, ConcurrentInterning) {
+  StringPool pool;
+  std::vector<std::vector<absl::string_view>> results(4);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < results.size(); ++t) {
+    threads.emplace_back([&pool, &results, t] {
+      for (int i = 0; i < 1000; ++i)
+        results[t].push_back(pool.Intern(absl::StrCat("name", i)));
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+  EXPECT_EQ(pool.size(), 1000);
+  for (int t = 1; t < results.size(); ++t)
+    for (int i = 0; i < 1000; ++i)
+      EXPECT_EQ(results[t][i].data(), results[0][i].data());
+}
+
+TEST(StringPoolTest, SourceInfoInternsNames) {
+  std::string dir = "/src", file = "foo.cc";
+  SourceInfo info1("foo", dir, file, 1, 2, 0);
+  SourceInfo info2("foo", "/src", "foo.cc", 1, 2, 0);
+  dir.clear();
+  file.clear();
+  EXPECT_EQ(info1.RelativePath(), "/src/foo.cc");
+  EXPECT_EQ(info1.file_name.data(), info2.file_name.data());
+  EXPECT_EQ(info1.dir_name.data(), InternString("/src").data());
+}
+
+}  // namespace
@@ -144,6 +144,63 @@ void Symbol::Merge(const Symbol *other) {
   }
 }
 
+void Symbol::MergePerfData(const Symbol *other) {
+  total_count += other->total_count;
+  head_count += other->head_count;
+  if (info.file_name.empty()) {
+    info.file_name = other->info.file_name;
+    info.dir_name = other->info.dir_name;
+  }
+  for (const auto &pos_count : other->pos_counts) {
+    ProfileInfo &profile = pos_counts[pos_count.first];
+    profile.count = std::max(profile.count, pos_count.second.count);
+    profile.num_inst += pos_count.second.num_inst;
+    for (const auto &target_count : pos_count.second.target_map)
+      profile.target_map[target_count.first] = target_count.second;
+  }
+  for (const auto &callsite_symbol : other->callsites) {
+    std::pair<CallsiteMap::iterator, bool> ret = callsites.insert(
+        CallsiteMap::value_type(callsite_symbol.first, NULL));
+    if (ret.second) {
+      const SourceInfo &callee_info = callsite_symbol.second->info;
+      ret.first->second =
+          new Symbol(callee_info.func_name, callee_info.dir_name,
+                     callee_info.file_name, callee_info.start_line);
+    }
+    ret.first->second->MergePerfData(callsite_symbol.second);
+  }
+}
+
+void Symbol::MergeLLVMProfile(const Symbol *other) {
+  // LLVMProfileReader gives a function without body samples the total count of
+  // its profile header, unless an earlier profile gave it a non-zero count.
+  // Only the body samples of OTHER are added otherwise.
+  uint64_t body_count = 0;
+  for (const auto &pos_count : other->pos_counts)
+    body_count += pos_count.second.count;
+  for (const auto &callsite_symbol : other->callsites)
+    body_count += callsite_symbol.second->total_count;
+  total_count += body_count;
+  if (total_count == 0) total_count = other->total_count;
+  head_count += other->head_count;
+  for (const auto &pos_count : other->pos_counts) {
+    ProfileInfo &profile = pos_counts[pos_count.first];
+    profile.count += pos_count.second.count;
+    profile.num_inst += pos_count.second.num_inst;
+    // As in LLVMProfileReader, the count of a call target is the one in the
+    // last profile.
+    for (const auto &target_count : pos_count.second.target_map)
+      profile.target_map[target_count.first] = target_count.second;
+  }
+  for (const auto &callsite_symbol : other->callsites) {
+    std::pair<CallsiteMap::iterator, bool> ret = callsites.insert(
+        CallsiteMap::value_type(callsite_symbol.first, NULL));
+    if (ret.second)
+      ret.first->second = new Symbol(ret.first->first.second, "", "", 0);
+    ret.first->second->MergeLLVMProfile(callsite_symbol.second);
+  }
+}
+
 struct CallsiteLessThan {
   bool operator()(const Callsite& c1, const Callsite& c2) const {
     if (c1.first != c2.first)
@@ -311,31 +368,43 @@ std::string SymbolMap::GetOriginalName(const char *name) const {
 }
 
 void SymbolMap::ElideSuffixesAndMerge() {
-  std::vector<std::string> suffix_elide_set;
-  for (auto &name_symbol : map_) {
+  // The names to elide, with their original name, in the order of map_.
+  std::vector<std::pair<std::string, std::string>> suffix_elide_set;
+  // The names of each symbol. Names that were erased or now refer to another
+  // symbol are not removed, they are skipped when the symbol is redirected.
+  absl::flat_hash_map<Symbol *, std::vector<std::string>> names_by_symbol;
+  for (const auto &name_symbol : map_) {
     std::string orig_name = GetOriginalName(name_symbol.first.c_str());
-    if (orig_name != name_symbol.first.c_str())
-      suffix_elide_set.push_back(name_symbol.first.c_str());
+    if (orig_name != name_symbol.first)
+      suffix_elide_set.emplace_back(name_symbol.first, std::move(orig_name));
+    names_by_symbol[name_symbol.second].push_back(name_symbol.first);
   }
-  for (const auto &name : suffix_elide_set) {
-    std::string orig_name = GetOriginalName(name.c_str());
-    auto iter = map_.find(name);
+  for (const auto &name_orig_name : suffix_elide_set) {
+    auto iter = map_.find(name_orig_name.first);
     CHECK(iter != map_.end());
     Symbol *sym = iter->second;
     map_.erase(iter);
 
     std::pair<NameSymbolMap::iterator, bool> ret =
-        map_.insert(NameSymbolMap::value_type(orig_name, NULL));
+        map_.insert(NameSymbolMap::value_type(name_orig_name.second, NULL));
     if (ret.second || sym == ret.first->second) {
       unique_symbols_.push_back(
           absl::make_unique<Symbol>(ret.first->first.c_str(), "", "", 0));
       ret.first->second = unique_symbols_.back().get();
+      names_by_symbol[ret.first->second].push_back(ret.first->first);
     }
 
-    ret.first->second->Merge(sym);
-    for (auto &n_s : map_) {
-      if (n_s.second == sym)
-        n_s.second = ret.first->second;
+    Symbol *merged = ret.first->second;
+    merged->Merge(sym);
+    // Redirects the remaining names of sym to the merged symbol.
+    std::vector<std::string> sym_names = std::move(names_by_symbol[sym]);
+    names_by_symbol.erase(sym);
+    std::vector<std::string> &merged_names = names_by_symbol[merged];
+    for (std::string &name : sym_names) {
+      auto name_iter = map_.find(name);
+      if (name_iter == map_.end() || name_iter->second != sym) continue;
+      name_iter->second = merged;
+      merged_names.push_back(std::move(name));
     }
   }
 }
@@ -367,6 +436,22 @@ void SymbolMap::AddSymbolMappings(const NameSymbolMap &new_map) {
   }
 }
 
+void SymbolMap::MergePerfDataSymbols(const SymbolMap &partial) {
+  for (const auto &name_symbol : partial.map_) {
+    NameSymbolMap::iterator iter = map_.find(name_symbol.first);
+    CHECK(iter != map_.end()) << "Symbol " << name_symbol.first
+                              << " is missing from the symbol map.";
+    iter->second->MergePerfData(name_symbol.second);
+  }
+}
+
+void SymbolMap::MergeSymbols(const SymbolMap &other) {
+  for (const auto &name_symbol : other.map_) {
+    AddSymbol(name_symbol.first);
+    map_.find(name_symbol.first)->second->MergeLLVMProfile(name_symbol.second);
+  }
+}
+
 void SymbolMap::CalculateThresholdFromTotalCount(int64_t total_count) {
   count_threshold_ = total_count * absl::GetFlag(FLAGS_sample_threshold_frac);
   if (count_threshold_ < kMinSamples) {
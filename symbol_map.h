@@ -21,6 +21,7 @@
 #include "third_party/abseil/absl/container/flat_hash_set.h"
 #include "third_party/abseil/absl/container/node_hash_map.h"
 #include "third_party/abseil/absl/flags/declare.h"
+#include "third_party/abseil/absl/strings/string_view.h"
 
 #if defined(HAVE_LLVM)
 #include "llvm/ADT/StringSet.h"
@@ -125,12 +126,8 @@ class CallGraph;
 class Symbol {
  public:
   // This constructor is used to create inlined symbol.
-#if defined(HAVE_LLVM)
-  Symbol(const char *name, llvm::StringRef dir, llvm::StringRef file,
+  Symbol(const char *name, absl::string_view dir, absl::string_view file,
          uint32_t start)
-#else
-  Symbol(const char *name, std::string dir, std::string file, uint32_t start)
-#endif
       : info(SourceInfo(name, dir, file, start, 0, 0)),
         total_count(0),
         total_count_incl(0),
@@ -172,6 +169,16 @@ class Symbol {
   // Merges profile stored in src symbol with this symbol.
   void Merge(const Symbol *src);
 
+  // Merges profile stored in src symbol, which was built from perf data, with
+  // this symbol. Counts at the same location are combined the same way
+  // SymbolMap::AddSourceCount combines PERFDATA samples.
+  void MergePerfData(const Symbol *src);
+
+  // Merges profile stored in src symbol, which LLVMProfileReader read from
+  // profiles that come after the ones read into this symbol. The result is the
+  // same as reading all of them into this symbol in order.
+  void MergeLLVMProfile(const Symbol *src);
+
   // Get an estimation of head count from the starting source or callsite
   // locations.
   void EstimateHeadCount();
@@ -299,6 +306,12 @@ class SymbolMap {
     addr2line_ = std::move(addr2line);
   }
 
+  // Takes ownership of an additional Addr2line, e.g. one used by a worker
+  // thread, whose strings are referenced by the symbols in the map.
+  void AddWorkerAddr2line(std::unique_ptr<Addr2line> addr2line) {
+    worker_addr2lines_.push_back(std::move(addr2line));
+  }
+
   Addr2line *get_addr2line() const { return addr2line_.get(); }
 
   // Adds an empty named symbol.
@@ -317,6 +330,17 @@ class SymbolMap {
   // that overlap with entries in new_map, will be updated to the new symbols.
   void AddSymbolMappings(const NameSymbolMap &new_map);
 
+  // Merges the symbols of PARTIAL, which was built from perf data for a
+  // disjoint set of functions, into this map. Every symbol in PARTIAL must
+  // already be present in this map.
+  void MergePerfDataSymbols(const SymbolMap &partial);
+
+  // Merges the symbols of OTHER, which LLVMProfileReader read from profiles
+  // that come after the ones read into this map, with Symbol::MergeLLVMProfile,
+  // adding them to this map if needed. OTHER must not map several names to the
+  // same symbol.
+  void MergeSymbols(const SymbolMap &other);
+
   const NameSymbolMap &map() const {
     return map_;
   }
@@ -543,6 +567,7 @@ class SymbolMap {
   bool ignore_thresholds_;
   uint8_t suffix_elision_policy_;
   std::unique_ptr<Addr2line> addr2line_;
+  std::vector<std::unique_ptr<Addr2line>> worker_addr2lines_;
   /* working_set_[i] stores # of instructions that consumes
      i/NUM_GCOV_WORKING_SETS of total instruction counts.  */
   gcov_working_set_info working_set_[NUM_GCOV_WORKING_SETS];
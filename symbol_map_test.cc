@@ -12,7 +12,6 @@
 #include "source_info.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
-#include "third_party/abseil/absl/container/node_hash_set.h"
 #include "third_party/abseil/absl/flags/flag.h"
 #include "third_party/abseil/absl/types/optional.h"
 
@@ -125,10 +124,65 @@ TEST(SymbolMapTest, TestEntryCount) {
   EXPECT_EQ(qux->EntryCount(), 100);
 }
 
+TEST(SymbolMapTest, MergePerfDataSymbols) {
+  using devtools_crosstool_autofdo::Symbol;
+  SourceStack foo_stack = {
+      {"bar", "", "", 1, 10, 0},
+      {"foo", "", "", 1, 50, 0},
+  };
+  SourceStack baz_stack = {
+      {"baz", "", "", 1, 5, 0},
+  };
+
+  // Adding all counts to a single map.
+  SymbolMap serial;
+  serial.AddSymbol("foo");
+  serial.AddSymbol("baz");
+  serial.AddSourceCount("foo", foo_stack, 100, 1, 1, SymbolMap::PERFDATA);
+  serial.AddSourceCount("foo", foo_stack, 40, 3, 1, SymbolMap::PERFDATA);
+  serial.AddSymbolEntryCount("baz", 7);
+  serial.AddSourceCount("baz", baz_stack, 20, 1, 1, SymbolMap::PERFDATA);
+  serial.AddSymbolEntryCount("baz", 5);
+
+  // Adding the same counts to two partial maps, then merging them.
+  SymbolMap merged;
+  merged.AddSymbol("foo");
+  merged.AddSymbol("baz");
+  SymbolMap partial1;
+  partial1.AddSymbol("foo");
+  partial1.AddSymbol("baz");
+  partial1.AddSourceCount("foo", foo_stack, 100, 1, 1, SymbolMap::PERFDATA);
+  partial1.AddSymbolEntryCount("baz", 7);
+  SymbolMap partial2;
+  partial2.AddSymbol("foo");
+  partial2.AddSymbol("baz");
+  partial2.AddSourceCount("foo", foo_stack, 40, 3, 1, SymbolMap::PERFDATA);
+  partial2.AddSourceCount("baz", baz_stack, 20, 1, 1, SymbolMap::PERFDATA);
+  partial2.AddSymbolEntryCount("baz", 5);
+  merged.MergePerfDataSymbols(partial1);
+  merged.MergePerfDataSymbols(partial2);
+
+  for (const std::string name : {"foo", "baz"}) {
+    const Symbol *expected = serial.GetSymbolByName(name);
+    const Symbol *actual = merged.GetSymbolByName(name);
+    EXPECT_EQ(actual->total_count, expected->total_count);
+    EXPECT_EQ(actual->head_count, expected->head_count);
+    EXPECT_EQ(actual->pos_counts.size(), expected->pos_counts.size());
+    EXPECT_EQ(actual->callsites.size(), expected->callsites.size());
+  }
+  const Symbol *bar =
+      merged.GetSymbolByName("foo")
+          ->callsites.find(std::make_pair(foo_stack[1].Offset(false), "bar"))
+          ->second;
+  const auto &pos_count = bar->pos_counts.at(foo_stack[0].Offset(false));
+  EXPECT_EQ(pos_count.count, 100);
+  EXPECT_EQ(pos_count.num_inst, 4);
+  EXPECT_EQ(merged.GetSymbolByName("baz")->head_count, 12);
+}
+
 TEST(SymbolMapTest, ComputeAllCounts) {
   SymbolMap symbol_map;
-  absl::node_hash_set<std::string> names;
-  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map, names);
+  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map);
   reader.ReadFromFile(FLAGS_test_srcdir + kTestDataDir +
                       "callgraph_with_cycles.txt");
 
@@ -179,8 +233,7 @@ TEST(SymbolMapTest, TestInterestingSymbolNames) {
     std::string policy(p);
     SymbolMap symbol_map;
     symbol_map.set_suffix_elision_policy(policy);
-    absl::node_hash_set<std::string> names;
-    devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map, names);
+    devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map);
         reader.ReadFromFile(FLAGS_test_srcdir + kTestDataDir +
                             "symbols_with_fun_characters.txt");
 
@@ -371,8 +424,7 @@ TEST(SymbolMapTest, FSDiscriminator) {
 
 TEST(SymbolMapTest, RemoveSymsMatchingRegex) {
   SymbolMap symbol_map;
-  absl::node_hash_set<std::string> names;
-  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map, names);
+  devtools_crosstool_autofdo::LLVMProfileReader reader(&symbol_map);
   reader.ReadFromFile(FLAGS_test_srcdir + kTestDataDir +
                       "strip_symbols_regex.textprof");
 
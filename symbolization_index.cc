@@ -0,0 +1,343 @@
+// Class to derive inline stacks from a prebuilt symbolization index.
+
+#include "symbolization_index.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "string_pool.h"
+#include "third_party/abseil/absl/container/flat_hash_map.h"
+#include "third_party/abseil/absl/strings/string_view.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace devtools_crosstool_autofdo {
+
+namespace {
+constexpr char kMagic[8] = {'A', 'F', 'D', 'O', 'S', 'Y', 'M', 'I'};
+constexpr uint32_t kVersion = 1;
+
+size_t AlignTo8(size_t size) { return (size + 7) & ~static_cast<size_t>(7); }
+
+// Accumulates the contents of an index, sharing the strings, files and inline
+// stacks that appear several times.
+class IndexBuilder {
+ public:
+  void AddRange(uint64_t start_addr, uint64_t end_addr,
+                const SourceStack &stack) {
+    std::vector<IndexedAddr2line::Frame> stack_frames;
+    for (const SourceInfo &info : stack) {
+      IndexedAddr2line::Frame frame;
+      frame.func_name = info.func_name == nullptr
+                            ? IndexedAddr2line::kNoString
+                            : AddString(info.func_name);
+      frame.file = AddFile(info.dir_name, info.file_name);
+      frame.start_line = info.start_line;
+      frame.line = info.line;
+      frame.discriminator = info.discriminator;
+      stack_frames.push_back(frame);
+    }
+    std::string key(reinterpret_cast<const char *>(stack_frames.data()),
+                    stack_frames.size() * sizeof(IndexedAddr2line::Frame));
+    auto inserted = stacks_.emplace(std::move(key), frames_.size());
+    if (inserted.second)
+      frames_.insert(frames_.end(), stack_frames.begin(), stack_frames.end());
+    const uint32_t first_frame = inserted.first->second;
+    const uint32_t num_frames = stack_frames.size();
+
+    // Merge ranges that follow each other and have the same inline stack.
+    if (!ranges_.empty() && ranges_.back().end_addr == start_addr &&
+        ranges_.back().first_frame == first_frame &&
+        ranges_.back().num_frames == num_frames) {
+      ranges_.back().end_addr = end_addr;
+      return;
+    }
+    ranges_.push_back({start_addr, end_addr, first_frame, num_frames});
+  }
+
+  // Returns the serialized index.
+  std::string Serialize(const std::string &build_id) const {
+    IndexedAddr2line::Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.build_id_size = build_id.size();
+    header.num_ranges = ranges_.size();
+    header.num_frames = frames_.size();
+    header.num_files = files_.size();
+    header.strings_size = strings_.size();
+
+    std::string data;
+    auto append = [&data](const void *bytes, size_t size) {
+      data.append(static_cast<const char *>(bytes), size);
+      data.resize(AlignTo8(data.size()), '\0');
+    };
+    append(&header, sizeof(header));
+    append(build_id.data(), build_id.size());
+    append(ranges_.data(), ranges_.size() * sizeof(ranges_[0]));
+    append(frames_.data(), frames_.size() * sizeof(frames_[0]));
+    append(files_.data(), files_.size() * sizeof(files_[0]));
+    append(strings_.data(), strings_.size());
+    return data;
+  }
+
+ private:
+  uint32_t AddString(absl::string_view str) {
+    auto inserted = string_offsets_.emplace(str, strings_.size());
+    if (inserted.second) {
+      strings_.append(str.data(), str.size());
+      strings_.push_back('\0');
+    }
+    return inserted.first->second;
+  }
+
+  uint32_t AddFile(absl::string_view dir_name, absl::string_view file_name) {
+    const IndexedAddr2line::File file = {AddString(dir_name),
+                                         AddString(file_name)};
+    auto inserted = file_indices_.emplace(
+        std::make_pair(file.dir_name, file.file_name), files_.size());
+    if (inserted.second) files_.push_back(file);
+    return inserted.first->second;
+  }
+
+  std::vector<IndexedAddr2line::Range> ranges_;
+  std::vector<IndexedAddr2line::Frame> frames_;
+  std::vector<IndexedAddr2line::File> files_;
+  std::string strings_;
+  // Map from the serialized frames of each inline stack to the index of its
+  // first frame.
+  absl::flat_hash_map<std::string, uint32_t> stacks_;
+  absl::flat_hash_map<std::pair<uint32_t, uint32_t>, uint32_t> file_indices_;
+  absl::flat_hash_map<std::string, uint32_t> string_offsets_;
+};
+}  // namespace
+
+std::string IndexedAddr2line::IndexPath(const std::string &index_dir,
+                                        const std::string &build_id) {
+  if (index_dir.empty() || build_id.empty()) return std::string();
+  return index_dir + "/" + build_id + ".symidx";
+}
+
+bool IndexedAddr2line::WriteIndex(
+    const Addr2line &addr2line,
+    const std::vector<std::pair<uint64_t, uint64_t>> &code_ranges,
+    const std::string &build_id, const std::string &index_path) {
+  std::vector<std::pair<uint64_t, uint64_t>> sorted_ranges = code_ranges;
+  std::sort(sorted_ranges.begin(), sorted_ranges.end());
+
+  IndexBuilder builder;
+  // Adds the inline stack of [start_addr, end_addr), which is the same for
+  // all of its addresses.
+  auto add_range = [&addr2line, &builder](uint64_t start_addr,
+                                          uint64_t end_addr) {
+    SourceStack stack;
+    addr2line.GetInlineStack(start_addr, &stack);
+    if (!stack.empty()) builder.AddRange(start_addr, end_addr, stack);
+  };
+  uint64_t last_end_addr = 0;
+  std::vector<uint64_t> boundaries;
+  for (const auto &code_range : sorted_ranges) {
+    const uint64_t start_addr = std::max(code_range.first, last_end_addr);
+    last_end_addr = std::max(last_end_addr, code_range.second);
+    if (start_addr >= code_range.second) continue;
+    if (!addr2line.GetInlineStackBoundaries(start_addr, code_range.second,
+                                            &boundaries)) {
+      for (uint64_t addr = start_addr; addr < code_range.second; ++addr)
+        add_range(addr, addr + 1);
+      continue;
+    }
+    for (int i = 0; i < boundaries.size(); ++i)
+      add_range(boundaries[i], i + 1 < boundaries.size() ? boundaries[i + 1]
+                                                         : code_range.second);
+  }
+  const std::string data = builder.Serialize(build_id);
+
+  // Write to a temporary file first, so that the index appears complete.
+  int fd;
+  llvm::SmallString<128> temp_path;
+  if (llvm::sys::fs::createUniqueFile(index_path + ".tmp-%%%%%%%%", fd,
+                                      temp_path)) {
+    LOG(WARNING) << "Cannot create a temporary file for '" << index_path
+                 << "'.";
+    return false;
+  }
+  llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+  os.write(data.data(), data.size());
+  os.close();
+  if (os.has_error()) {
+    os.clear_error();
+    llvm::sys::fs::remove(temp_path);
+    LOG(WARNING) << "Failed to write '" << temp_path.str().str() << "'.";
+    return false;
+  }
+  if (llvm::sys::fs::rename(temp_path, index_path)) {
+    llvm::sys::fs::remove(temp_path);
+    LOG(WARNING) << "Failed to rename '" << temp_path.str().str() << "' to '"
+                 << index_path << "'.";
+    return false;
+  }
+  return true;
+}
+
+bool IndexedAddr2line::Prepare() {
+#if LLVM_VERSION_MAJOR >= 13
+  auto buffer_or = llvm::MemoryBuffer::getFile(
+      index_path_, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+#else
+  auto buffer_or = llvm::MemoryBuffer::getFile(
+      index_path_, /*FileSize=*/-1, /*RequiresNullTerminator=*/false);
+#endif
+  if (!buffer_or) return false;
+  buffer_ = std::move(buffer_or.get());
+
+  const char *data = buffer_->getBufferStart();
+  const size_t size = buffer_->getBufferSize();
+  Header header;
+  if (size < sizeof(header) || reinterpret_cast<uintptr_t>(data) % 8 != 0) {
+    LOG(WARNING) << "Invalid symbolization index '" << index_path_ << "'.";
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    LOG(WARNING) << "Invalid symbolization index '" << index_path_ << "'.";
+    return false;
+  }
+  if (absl::string_view(data + sizeof(header),
+                        std::min<size_t>(header.build_id_size,
+                                         size - sizeof(header))) !=
+      build_id_) {
+    LOG(WARNING) << "Symbolization index '" << index_path_
+                 << "' does not match the build id of '" << binary_name_
+                 << "'.";
+    return false;
+  }
+
+  // Check that the sections fit in the file before computing their offsets,
+  // so that corrupted counts cannot overflow them.
+  if (header.num_ranges > size / sizeof(Range) ||
+      header.num_frames > size / sizeof(Frame) ||
+      header.num_files > size / sizeof(File) || header.strings_size > size) {
+    LOG(WARNING) << "Invalid symbolization index '" << index_path_ << "'.";
+    return false;
+  }
+  size_t offset = AlignTo8(sizeof(header) + header.build_id_size);
+  const size_t ranges_offset = offset;
+  offset = AlignTo8(offset + header.num_ranges * sizeof(Range));
+  const size_t frames_offset = offset;
+  offset = AlignTo8(offset + header.num_frames * sizeof(Frame));
+  const size_t files_offset = offset;
+  offset = AlignTo8(offset + header.num_files * sizeof(File));
+  const size_t strings_offset = offset;
+  offset = AlignTo8(offset + header.strings_size);
+  if (offset != size ||
+      (header.strings_size > 0 && data[strings_offset + header.strings_size -
+                                       1] != '\0')) {
+    LOG(WARNING) << "Invalid symbolization index '" << index_path_ << "'.";
+    return false;
+  }
+
+  ranges_ = reinterpret_cast<const Range *>(data + ranges_offset);
+  num_ranges_ = header.num_ranges;
+  frames_ = reinterpret_cast<const Frame *>(data + frames_offset);
+  strings_ = data + strings_offset;
+  const File *files = reinterpret_cast<const File *>(data + files_offset);
+
+  // Lookups do not check bounds, so a corrupted index must be rejected here.
+  bool valid = true;
+  uint64_t last_end_addr = 0;
+  for (size_t i = 0; valid && i < num_ranges_; ++i) {
+    const Range &range = ranges_[i];
+    valid = range.start_addr >= last_end_addr &&
+            range.start_addr < range.end_addr &&
+            static_cast<uint64_t>(range.first_frame) + range.num_frames <=
+                header.num_frames;
+    last_end_addr = range.end_addr;
+  }
+  for (size_t i = 0; valid && i < header.num_frames; ++i) {
+    valid = frames_[i].file < header.num_files &&
+            (frames_[i].func_name == kNoString ||
+             frames_[i].func_name < header.strings_size);
+  }
+  for (size_t i = 0; valid && i < header.num_files; ++i) {
+    valid = files[i].dir_name < header.strings_size &&
+            files[i].file_name < header.strings_size;
+  }
+  if (!valid) {
+    LOG(WARNING) << "Invalid symbolization index '" << index_path_ << "'.";
+    return false;
+  }
+  files_.reserve(header.num_files);
+  for (size_t i = 0; i < header.num_files; ++i) {
+    files_.emplace_back(InternString(strings_ + files[i].dir_name),
+                        InternString(strings_ + files[i].file_name));
+  }
+  return true;
+}
+
+size_t IndexedAddr2line::FindRange(uint64_t addr) const {
+  // The ranges are disjoint, so their end addresses are sorted too.
+  return std::upper_bound(ranges_, ranges_ + num_ranges_, addr,
+                          [](uint64_t addr, const Range &range) {
+                            return addr < range.end_addr;
+                          }) -
+         ranges_;
+}
+
+void IndexedAddr2line::GetInlineStack(uint64_t addr, SourceStack *stack) const {
+  const size_t i = FindRange(addr);
+  if (i == num_ranges_ || ranges_[i].start_addr > addr) return;
+  const Range &range = ranges_[i];
+  stack->reserve(stack->size() + range.num_frames);
+  for (const Frame *frame = frames_ + range.first_frame,
+                   *end = frame + range.num_frames;
+       frame != end; ++frame) {
+    SourceInfo info;
+    info.func_name = frame->func_name == kNoString
+                         ? nullptr
+                         : strings_ + frame->func_name;
+    info.dir_name = files_[frame->file].first;
+    info.file_name = files_[frame->file].second;
+    info.start_line = frame->start_line;
+    info.line = frame->line;
+    info.discriminator = frame->discriminator;
+    stack->push_back(info);
+  }
+}
+
+bool IndexedAddr2line::GetInlineStackBoundaries(
+    uint64_t start_addr, uint64_t end_addr,
+    std::vector<uint64_t> *boundaries) const {
+  boundaries->clear();
+  boundaries->push_back(start_addr);
+  for (size_t i = FindRange(start_addr);
+       i < num_ranges_ && ranges_[i].start_addr < end_addr; ++i) {
+    for (uint64_t addr : {ranges_[i].start_addr, ranges_[i].end_addr}) {
+      if (addr > boundaries->back() && addr < end_addr)
+        boundaries->push_back(addr);
+    }
+  }
+  return true;
+}
+
+bool IndexedAddr2line::GetInlineStackRange(uint64_t addr, uint64_t *start_addr,
+                                           uint64_t *end_addr) const {
+  const size_t i = FindRange(addr);
+  if (i < num_ranges_ && ranges_[i].start_addr <= addr) {
+    *start_addr = ranges_[i].start_addr;
+    *end_addr = ranges_[i].end_addr;
+    return true;
+  }
+  // "addr" is between two ranges, where the inline stack is empty.
+  *start_addr = i > 0 ? ranges_[i - 1].end_addr : 0;
+  *end_addr = i < num_ranges_ ? ranges_[i].start_addr : ~0ULL;
+  return true;
+}
+
+}  // namespace devtools_crosstool_autofdo
@@ -0,0 +1,113 @@
+// Class to derive inline stacks from a prebuilt symbolization index.
+
+#ifndef AUTOFDO_SYMBOLIZATION_INDEX_H_
+#define AUTOFDO_SYMBOLIZATION_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "addr2line.h"
+#include "source_info.h"
+#include "third_party/abseil/absl/strings/string_view.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace devtools_crosstool_autofdo {
+
+// Addr2line that reads the inline stacks of a binary from an index file
+// written by a previous run, instead of parsing its DWARF. The index is mapped
+// into memory and the returned function names point into it, so it stays
+// mapped for the lifetime of the IndexedAddr2line.
+//
+// An index file holds, in this order:
+//   - a header, with the build id of the binary it was built from,
+//   - the sorted, disjoint address ranges over which the inline stack does not
+//     change, each referring to a run of frames,
+//   - the frames of the distinct inline stacks,
+//   - the (directory, file) pairs referred to by the frames,
+//   - the null-terminated strings referred to by the frames and files.
+// Addresses outside of all ranges have an empty inline stack.
+class IndexedAddr2line : public Addr2line {
+ public:
+  // "build_id" is the build id of "binary_name", as returned by
+  // ElfReader::GetBuildId. Prepare() fails if the index at "index_path" was
+  // built for another binary.
+  IndexedAddr2line(const std::string &binary_name,
+                   const std::string &index_path, const std::string &build_id)
+      : Addr2line(binary_name), index_path_(index_path), build_id_(build_id) {}
+
+  // Returns the path of the index of "binary_name" in "index_dir", or an empty
+  // string if the binary has no build id.
+  static std::string IndexPath(const std::string &index_dir,
+                               const std::string &build_id);
+
+  // Writes to "index_path" the index of the inline stacks that "addr2line"
+  // finds in the "code_ranges" of the binary with "build_id". The file is
+  // replaced atomically, so concurrent readers never see a partial index.
+  // Returns false on failure.
+  static bool WriteIndex(
+      const Addr2line &addr2line,
+      const std::vector<std::pair<uint64_t, uint64_t>> &code_ranges,
+      const std::string &build_id, const std::string &index_path);
+
+  // Maps the index and checks that it matches the binary.
+  bool Prepare() override;
+  void GetInlineStack(uint64_t addr, SourceStack *stack) const override;
+  bool GetInlineStackBoundaries(
+      uint64_t start_addr, uint64_t end_addr,
+      std::vector<uint64_t> *boundaries) const override;
+  bool GetInlineStackRange(uint64_t addr, uint64_t *start_addr,
+                           uint64_t *end_addr) const override;
+
+  // On-disk layout of the index. All integers are in host byte order.
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t build_id_size;
+    uint64_t num_ranges;
+    uint64_t num_frames;
+    uint64_t num_files;
+    uint64_t strings_size;
+  };
+  struct Range {
+    uint64_t start_addr;
+    uint64_t end_addr;
+    uint32_t first_frame;
+    uint32_t num_frames;
+  };
+  struct Frame {
+    // Offset of the function name in the strings, or kNoString.
+    uint32_t func_name;
+    uint32_t file;
+    uint32_t start_line;
+    uint32_t line;
+    uint32_t discriminator;
+  };
+  struct File {
+    uint32_t dir_name;
+    uint32_t file_name;
+  };
+  static constexpr uint32_t kNoString = ~0U;
+
+ private:
+  // Returns the index of the first range ending after "addr".
+  size_t FindRange(uint64_t addr) const;
+
+  const std::string index_path_;
+  const std::string build_id_;
+  std::unique_ptr<llvm::MemoryBuffer> buffer_;
+  const Range *ranges_ = nullptr;
+  size_t num_ranges_ = 0;
+  const Frame *frames_ = nullptr;
+  const char *strings_ = nullptr;
+  // The directory and file names of each file, interned in
+  // StringPool::Global() once when the index is mapped.
+  std::vector<std::pair<absl::string_view, absl::string_view>> files_;
+  DISALLOW_COPY_AND_ASSIGN(IndexedAddr2line);
+};
+
+}  // namespace devtools_crosstool_autofdo
+
+#endif  // AUTOFDO_SYMBOLIZATION_INDEX_H_
@@ -0,0 +1,133 @@
+// These tests check that IndexedAddr2line returns the same inline stacks as
+// the LLVMAddr2line its index was built from.
+
+#include "symbolization_index.h"
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "addr2line.h"
+#include "source_info.h"
+#include "gtest/gtest.h"
+#include "third_party/abseil/absl/flags/declare.h"
+#include "third_party/abseil/absl/flags/flag.h"
+#include "util/symbolize/elf_reader.h"
+
+ABSL_DECLARE_FLAG(std::string, symbolization_index_dir);
+
+#define FLAGS_test_srcdir std::string(testing::UnitTest::GetInstance()->original_working_dir())
+
+namespace {
+
+using ::devtools_crosstool_autofdo::Addr2line;
+using ::devtools_crosstool_autofdo::ElfReader;
+using ::devtools_crosstool_autofdo::IndexedAddr2line;
+using ::devtools_crosstool_autofdo::LLVMAddr2line;
+using ::devtools_crosstool_autofdo::SourceStack;
+
+const char kTestDataDir[] = "/testdata/";
+// test.binary has no build id, any string identifies it in these tests.
+const char kBuildId[] = "0123456789abcdef0123456789abcdef01234567";
+
+class SymbolizationIndexTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    binary_ = FLAGS_test_srcdir + kTestDataDir + "test.binary";
+    index_path_ = IndexedAddr2line::IndexPath(testing::TempDir(), kBuildId);
+    addr2line_ = std::make_unique<LLVMAddr2line>(binary_);
+    ASSERT_TRUE(addr2line_->Prepare());
+  }
+
+  void TearDown() override { remove(index_path_.c_str()); }
+
+  std::string binary_;
+  std::string index_path_;
+  std::unique_ptr<LLVMAddr2line> addr2line_;
+};
+
+TEST_F(SymbolizationIndexTest, MatchesDwarf) {
+  ASSERT_TRUE(IndexedAddr2line::WriteIndex(
+      *addr2line_, addr2line_->GetCodeRanges(), kBuildId, index_path_));
+  IndexedAddr2line indexed(binary_, index_path_, kBuildId);
+  ASSERT_TRUE(indexed.Prepare());
+
+  for (const auto &code_range : addr2line_->GetCodeRanges()) {
+    for (uint64_t addr = code_range.first; addr < code_range.second; ++addr) {
+      SourceStack expected, actual;
+      addr2line_->GetInlineStack(addr, &expected);
+      indexed.GetInlineStack(addr, &actual);
+      ASSERT_EQ(actual.size(), expected.size()) << std::hex << addr;
+      for (int i = 0; i < expected.size(); ++i) {
+        EXPECT_STREQ(actual[i].func_name, expected[i].func_name);
+        EXPECT_EQ(actual[i].dir_name, expected[i].dir_name);
+        EXPECT_EQ(actual[i].file_name, expected[i].file_name);
+        EXPECT_EQ(actual[i].start_line, expected[i].start_line);
+        EXPECT_EQ(actual[i].line, expected[i].line);
+        EXPECT_EQ(actual[i].discriminator, expected[i].discriminator);
+      }
+    }
+  }
+
+  // longest_match, as in instruction_map_test.
+  std::vector<uint64_t> boundaries;
+  ASSERT_TRUE(indexed.GetInlineStackBoundaries(0x401680, 0x401871,
+                                               &boundaries));
+  ASSERT_FALSE(boundaries.empty());
+  EXPECT_EQ(boundaries.front(), 0x401680);
+  for (int i = 1; i < boundaries.size(); ++i) {
+    EXPECT_LT(boundaries[i - 1], boundaries[i]);
+    EXPECT_LT(boundaries[i], 0x401871);
+  }
+}
+
+TEST_F(SymbolizationIndexTest, RejectsOtherBinaries) {
+  ASSERT_TRUE(IndexedAddr2line::WriteIndex(
+      *addr2line_, addr2line_->GetCodeRanges(), kBuildId, index_path_));
+  IndexedAddr2line indexed(binary_, index_path_, "0123456789abcdef");
+  EXPECT_FALSE(indexed.Prepare());
+
+  IndexedAddr2line missing(binary_, index_path_ + ".missing", kBuildId);
+  EXPECT_FALSE(missing.Prepare());
+}
+
+TEST_F(SymbolizationIndexTest, RejectsTruncatedIndex) {
+  ASSERT_TRUE(IndexedAddr2line::WriteIndex(
+      *addr2line_, addr2line_->GetCodeRanges(), kBuildId, index_path_));
+  FILE *index = fopen(index_path_.c_str(), "r+");
+  ASSERT_NE(index, nullptr);
+  fseek(index, 0, SEEK_END);
+  const long size = ftell(index);
+  fclose(index);
+  ASSERT_EQ(truncate(index_path_.c_str(), size - 8), 0);
+
+  IndexedAddr2line indexed(binary_, index_path_, kBuildId);
+  EXPECT_FALSE(indexed.Prepare());
+}
+
+TEST(WriteSymbolizationIndexTest, OnlyWriterWritesIndex) {
+  const std::string binary =
+      FLAGS_test_srcdir + kTestDataDir + "test.fs.binary";
+  const std::string build_id = ElfReader(binary).GetBuildId();
+  const std::string index_path =
+      IndexedAddr2line::IndexPath(testing::TempDir(), build_id);
+  ASSERT_FALSE(index_path.empty());
+  absl::SetFlag(&FLAGS_symbolization_index_dir, testing::TempDir());
+
+  std::unique_ptr<Addr2line> addr2line(Addr2line::Create(binary));
+  ASSERT_NE(addr2line, nullptr);
+  EXPECT_NE(access(index_path.c_str(), F_OK), 0);
+
+  devtools_crosstool_autofdo::WriteSymbolizationIndex(binary);
+  IndexedAddr2line indexed(binary, index_path, build_id);
+  EXPECT_TRUE(indexed.Prepare());
+
+  absl::SetFlag(&FLAGS_symbolization_index_dir, "");
+  remove(index_path.c_str());
+}
+
+}  // namespace
@@ -661,6 +661,43 @@ void InlineStackHandler::GetSubprogramAddresses(std::set<uint64> *addrs) {
   }
 }
 
+void InlineStackHandler::Merge(InlineStackHandler *other) {
+  CHECK(subprogram_stack_.empty() && other->subprogram_stack_.empty());
+  if (!other->subprograms_by_offset_maps_.empty()) {
+    if (subprograms_by_offset_maps_.empty()) {
+      input_file_index_ = 0;
+      subprograms_by_offset_maps_.push_back(new SubprogramsByOffsetMap);
+    }
+    // The subprograms of the binary itself are keyed by their offset in
+    // .debug_info, which is unique across compilation units.
+    SubprogramsByOffsetMap *binary_subprograms =
+        other->subprograms_by_offset_maps_[0];
+    subprograms_by_offset_maps_[0]->insert(binary_subprograms->begin(),
+                                           binary_subprograms->end());
+    delete binary_subprograms;
+    // Each .dwo has its own map, numbered in the order they were read.
+    const int bias = subprograms_by_offset_maps_.size() - 1;
+    for (int i = 1; i < other->subprograms_by_offset_maps_.size(); ++i) {
+      SubprogramsByOffsetMap *dwo_subprograms =
+          other->subprograms_by_offset_maps_[i];
+      for (const auto &offset_subprogram : *dwo_subprograms)
+        offset_subprogram.second->set_input_file_index(bias + i);
+      subprograms_by_offset_maps_.push_back(dwo_subprograms);
+    }
+    other->subprograms_by_offset_maps_.clear();
+  }
+  subprogram_insert_order_.insert(subprogram_insert_order_.end(),
+                                  other->subprogram_insert_order_.begin(),
+                                  other->subprogram_insert_order_.end());
+  other->subprogram_insert_order_.clear();
+  compilation_unit_comp_dir_.insert(compilation_unit_comp_dir_.end(),
+                                    other->compilation_unit_comp_dir_.begin(),
+                                    other->compilation_unit_comp_dir_.end());
+  other->compilation_unit_comp_dir_.clear();
+  overlap_count_ += other->overlap_count_;
+  other->overlap_count_ = 0;
+}
+
 InlineStackHandler::~InlineStackHandler() {
   for (auto map : subprograms_by_offset_maps_) {
     for (const auto &addr_subprog : *map)
@@ -59,6 +59,7 @@ class SubprogramInfo {
         used_(false) { }
 
   const int input_file_index() const { return input_file_index_; }
+  void set_input_file_index(int index) { input_file_index_ = index; }
 
   const uint64 offset() const { return offset_; }
   const SubprogramInfo *parent() const { return parent_; }
@@ -232,6 +233,12 @@ class InlineStackHandler: public Dwarf2Handler {
 
   void PopulateSubprogramsByAddress();
 
+  // Takes over the subprograms that OTHER read from compilation units
+  // following the ones read by this handler, leaving OTHER empty. Used to
+  // combine the handlers of compilation units that were read concurrently,
+  // before PopulateSubprogramsByAddress is called.
+  void Merge(InlineStackHandler *other);
+
   ~InlineStackHandler();
 
  private:
@@ -147,6 +147,35 @@ class AddressToLineMap {
     line_map_[addr] = logical_num;
   }
 
+  // Appends the lines and subprograms of OTHER, which was filled from
+  // compilation units that follow the ones of this map. The logical and
+  // subprogram numbers of OTHER are rebased after ours, and its addresses
+  // override ours, as if its compilation units had been added to this map.
+  void Append(const AddressToLineMap &other) {
+    const uint32 logical_bias = logical_lines_.size();
+    const uint32 subprog_bias = subprogs_.size();
+    subprogs_.insert(subprogs_.end(), other.subprogs_.begin(),
+                     other.subprogs_.end());
+    logical_lines_.reserve(logical_bias + other.logical_lines_.size());
+    for (LineIdentifier line_id : other.logical_lines_) {
+      if (line_id.context > 0) {
+        line_id.context += logical_bias;
+      }
+      if (line_id.subprog_num > 0) {
+        line_id.subprog_num += subprog_bias;
+      }
+      logical_lines_.push_back(line_id);
+    }
+    for (const auto &addr_logical : other.line_map_) {
+      // Logical number 0 marks the end of a sequence.
+      const uint32 logical_num =
+          addr_logical.second > 0 ? addr_logical.second + logical_bias : 0;
+      line_map_.insert_or_assign(line_map_.end(), addr_logical.first,
+                                 logical_num);
+    }
+    subprog_bias_ = subprogs_.size();
+  }
+
   const_iterator begin() const {
     return line_map_.begin();
   }